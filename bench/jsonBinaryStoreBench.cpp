@@ -0,0 +1,142 @@
+/*!
+ * @file jsonBinaryStoreBench.cpp
+ * @brief Benchmark of the start up cost of a reference dataset loaded with
+ * Parse against the same dataset opened as a JsonBinaryStore.
+ * Details. The dataset is generated from a fixed seed: an object of
+ * BENCH_ENTRIES entries keyed by code, each with a few strings and numbers.
+ * Start up is measured up to the first lookup, then a run of random lookups
+ * is timed on both, and every value read from the store is checked against
+ * the parsed document; the program fails if one differs.
+ * Build it together with the library sources, e.g.
+ *   g++ -O2 -std=c++17 -I. bench/jsonBinaryStoreBench.cpp json*.cpp -ljansson
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+#include "jsonBinaryStore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_ENTRIES 200000
+#define BENCH_LOOKUPS 100000
+#define BENCH_PATH "jsonBinaryStoreBench.bin"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double Ms(Clock::time_point start) {
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    return elapsed.count();
+}
+
+std::string Code(size_t i) {
+    std::ostringstream code;
+    code << "C" << i * 7919 % 1000003;
+    return code.str();
+}
+
+std::string BuildDataset() {
+    std::mt19937_64 rng(20131);
+    JsonSerializer root;
+    root.CreateRootObject();
+    for (size_t i = 0; i < BENCH_ENTRIES; ++i) {
+        JsonSerializer entry;
+        entry.CreateRootObject();
+        entry.PutValue("name", "entry " + Code(i));
+        entry.PutValue("region", std::string(rng() % 2 ? "emea" : "apac"));
+        entry.PutValue("rate", (double)(rng() % 1000000) / 997);
+        entry.PutValue("limit", (long long)(rng() % 1000000000));
+        root.PutObject(Code(i), entry);
+    }
+
+    char* buffer = root.StreamJsonToBuffer();
+    std::string dataset(buffer ? buffer : "");
+    free(buffer);
+    return dataset;
+}
+
+}  // namespace
+
+int main() {
+    std::string dataset = BuildDataset();
+    JsonSerializer json;
+    if (!json.Parse(dataset) || !JsonBinaryStore::Compile(json, BENCH_PATH)) {
+        fprintf(stderr, "dataset does not compile\n");
+        return 1;
+    }
+    printf("dataset: %zu bytes, %d entries\n", dataset.size(), BENCH_ENTRIES);
+
+    std::mt19937_64 rng(7);
+    std::vector<std::string> keys;
+    for (int i = 0; i < BENCH_LOOKUPS; ++i) {
+        keys.push_back(Code(rng() % BENCH_ENTRIES));
+    }
+
+    Clock::time_point start = Clock::now();
+    JsonSerializer parsed;
+    JsonSerializer entry;
+    double rate = 0;
+    if (!parsed.Parse(dataset) || !parsed.GetObject(keys[0], entry) ||
+        !entry.GetValue("rate", rate)) {
+        return 1;
+    }
+    double parseStart = Ms(start);
+
+    start = Clock::now();
+    JsonBinaryStore store;
+    JsonBinaryView root, view;
+    if (!store.Open(BENCH_PATH) || !store.Root(root) ||
+        !root.GetObject(keys[0], view) || !view.GetValue("rate", rate)) {
+        return 1;
+    }
+    double openStart = Ms(start);
+
+    start = Clock::now();
+    double sum = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        parsed.GetObject(keys[i], entry);
+        entry.GetValue("rate", rate);
+        sum += rate;
+    }
+    double parsedLookup = Ms(start) * 1e6 / keys.size();
+
+    start = Clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        root.GetObject(keys[i], view);
+        view.GetValue("rate", rate);
+        sum += rate;
+    }
+    double storeLookup = Ms(start) * 1e6 / keys.size();
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::string a, b;
+        long long x = 0, y = 1;
+        if (!parsed.GetObject(keys[i], entry) ||
+            !root.GetObject(keys[i], view) || !entry.GetValue("name", a) ||
+            !view.GetValue("name", b) || a != b ||
+            !entry.GetValue("limit", x) || !view.GetValue("limit", y) ||
+            x != y) {
+            ++mismatches;
+        }
+    }
+
+    printf("start up to first lookup: Parse %.1f ms, Open %.3f ms\n",
+           parseStart, openStart);
+    printf("lookup: parsed %.0f ns, store %.0f ns (checksum %g)\n",
+           parsedLookup, storeLookup, sum);
+    remove(BENCH_PATH);
+
+    if (mismatches) {
+        fprintf(stderr, "%zu lookups differ\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
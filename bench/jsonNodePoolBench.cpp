@@ -0,0 +1,155 @@
+/*!
+ * @file jsonNodePoolBench.cpp
+ * @brief Benchmark of document building with and without JsonNodePool, at
+ * 1, 8 and 32 threads.
+ * Details. Every thread builds BENCH_DOCUMENTS documents the way our
+ * builders do: CreateRootObject, a few PutValue calls and a PutCollection
+ * of BENCH_ROWS rows. It streams each to a buffer and frees it. In the
+ * local run a thread frees its own documents; in the handoff run they are
+ * freed by the next thread, as when a document is built on one thread and
+ * sent from another. Each run is timed with malloc as jansson's allocator
+ * and with the pool installed, BENCH_ROUNDS times each, and the best time
+ * is reported. The allocator that goes first alternates between rounds, so
+ * that neither always gets the pages the other has already touched. The
+ * allocator may only be switched while no jansson value is alive, so each
+ * run releases everything before the next one starts. The program fails if
+ * the two allocators give different output.
+ * Build it together with the library sources, e.g.
+ *   g++ -O2 -std=c++17 -I. bench/jsonNodePoolBench.cpp json*.cpp -ljansson \
+ *     -lpthread
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+#include "jsonNodePool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BENCH_DOCUMENTS 2000
+#define BENCH_ROWS 32
+#define BENCH_ROUNDS 4
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+JsonSerializer Build(int document) {
+    JsonSerializer root;
+    root.CreateRootObject();
+    root.PutValue("id", document);
+    root.PutValue("source", std::string("builder"));
+    root.PutValue("ts", 1380000000000LL + document);
+
+    std::vector<JsonSerializer> rows;
+    rows.reserve(BENCH_ROWS);
+    for (int i = 0; i < BENCH_ROWS; ++i) {
+        JsonSerializer row;
+        row.CreateRootObject();
+        row.PutValue("seq", i);
+        row.PutValue("name", std::string("row-name"));
+        row.PutValue("value", 0.5 * i);
+        row.PutValue("enabled", i % 2 == 0);
+        rows.push_back(row);
+    }
+    root.PutCollection("rows", rows);
+    return root;
+}
+
+/* Checksum of what a thread streamed, to compare the two allocators. */
+size_t Stream(const JsonSerializer& json) {
+    char* buffer = json.StreamJsonToBuffer();
+    size_t sum = 0;
+    for (const char* p = buffer; p && *p; ++p) sum = sum * 31 + *p;
+    free(buffer);
+    return sum;
+}
+
+/* ns per document over all threads. */
+double Run(unsigned int threads, bool handoff, size_t& checksum) {
+    std::vector<std::vector<JsonSerializer> > built(threads);
+    std::vector<size_t> sums(threads, 0);
+    Clock::time_point start = Clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&built, &sums, t, handoff]() {
+            for (int d = 0; d < BENCH_DOCUMENTS; ++d) {
+                JsonSerializer json = Build(d);
+                sums[t] += Stream(json);
+                if (handoff) built[t].push_back(json);
+            }
+        }));
+    }
+    for (unsigned int t = 0; t < threads; ++t) workers[t].join();
+
+    if (handoff) {
+        workers.clear();
+        for (unsigned int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([&built, t, threads]() {
+                built[(t + 1) % threads].clear();
+            }));
+        }
+        for (unsigned int t = 0; t < threads; ++t) workers[t].join();
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    checksum = 0;
+    for (unsigned int t = 0; t < threads; ++t) checksum += sums[t];
+    return elapsed.count() / ((double)threads * BENCH_DOCUMENTS);
+}
+
+/* Switches jansson's allocator; nothing it allocated may be alive. */
+void UseAllocator(bool pooled) {
+    if (pooled) {
+        JsonNodePool::Install();
+    } else {
+        json_set_alloc_funcs(malloc, free);
+    }
+}
+
+}  // namespace
+
+int main() {
+    unsigned int counts[] = {1, 8, 32};
+    double times[2][2][3];
+    size_t checksums[2][2][3];
+
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        for (int i = 0; i < 2; ++i) {
+            int pooled = (round + i) % 2;
+            UseAllocator(pooled != 0);
+            for (int handoff = 0; handoff < 2; ++handoff) {
+                for (int c = 0; c < 3; ++c) {
+                    double time = Run(counts[c], handoff != 0,
+                                      checksums[pooled][handoff][c]);
+                    double& best = times[pooled][handoff][c];
+                    if (round == 0 || time < best) best = time;
+                }
+            }
+        }
+    }
+
+    int mismatches = 0;
+    printf("threads  run       malloc ns/doc   pool ns/doc   speedup\n");
+    for (int handoff = 0; handoff < 2; ++handoff) {
+        for (int c = 0; c < 3; ++c) {
+            if (checksums[0][handoff][c] != checksums[1][handoff][c]) {
+                ++mismatches;
+            }
+            printf("%7u  %-8s %14.0f %13.0f %8.2fx\n", counts[c],
+                   handoff ? "handoff" : "local", times[0][handoff][c],
+                   times[1][handoff][c],
+                   times[0][handoff][c] / times[1][handoff][c]);
+        }
+    }
+    printf("pool: %zu blocks cached by this thread, %zu in the depot\n",
+           JsonNodePool::CachedBlocks(), JsonNodePool::DepotBlocks());
+    printf("output mismatches %d\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
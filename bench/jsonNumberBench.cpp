@@ -0,0 +1,213 @@
+/*!
+ * @file jsonNumberBench.cpp
+ * @brief Benchmark of the number paths of JsonSerializer on a numeric heavy
+ * corpus.
+ * Details. The corpus imitates our telemetry documents: records of
+ * timestamps, counters, positions and sensor readings, more than 80% of the
+ * values numbers. It is generated from a fixed seed so that runs compare.
+ * Every real put into a document is read back and checked bit for bit; the
+ * program fails if one does not round trip.
+ * Build it together with the library sources, e.g.
+ *   g++ -O2 -std=c++17 -I. bench/jsonNumberBench.cpp json*.cpp -ljansson
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_RECORDS 20000
+#define BENCH_READINGS 8
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double NsPerOp(Clock::time_point start, size_t ops) {
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    return ops ? elapsed.count() / ops : 0;
+}
+
+/* Values as our sensors produce them: a few digits of precision, a wide
+ * spread of magnitudes, and now and then a full precision double. */
+double Reading(std::mt19937_64& rng) {
+    switch (rng() % 4) {
+        case 0:
+            return (double)(int64_t)(rng() % 2000001 - 1000000) / 1000;
+        case 1:
+            return (double)(rng() % 100000) * 1e-7;
+        case 2:
+            return ldexp((double)(rng() >> 11), -53) * 1e5;
+        default:
+            return (double)(int64_t)(rng() % 200001 - 100000) / 3;
+    }
+}
+
+std::string BuildCorpus(std::vector<double>& reals) {
+    std::mt19937_64 rng(20131);
+    JsonSerializer root;
+    root.CreateRootObject();
+    std::vector<JsonSerializer> records;
+
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        JsonSerializer record;
+        record.CreateRootObject();
+        record.PutValue("ts", 1380000000000LL + i * 250LL);
+        record.PutValue("seq", i);
+        record.PutValue("id", std::string("vessel-7"));
+        for (int r = 0; r < BENCH_READINGS; ++r) {
+            std::ostringstream key;
+            key << "r" << r;
+            reals.push_back(Reading(rng));
+            record.PutValue(key.str(), reals.back());
+        }
+        record.PutValue("count", (long long)(rng() % 1000000000));
+        records.push_back(record);
+    }
+    root.PutCollection("records", records);
+
+    char* buffer = root.StreamJsonToBuffer();
+    std::string corpus(buffer ? buffer : "");
+    free(buffer);
+    return corpus;
+}
+
+/* The string round trip GetValue<double> made before it converted numbers
+ * directly. */
+bool StreamGet(const JsonSerializer& json, const std::string& key,
+               double& value) {
+    std::string text;
+    long long integer;
+    if (json.GetValue(key, integer)) {
+        std::ostringstream oss;
+        oss << integer;
+        text = oss.str();
+    } else {
+        return false;
+    }
+    std::istringstream iss(text);
+    return !(iss >> value).fail();
+}
+
+}  // namespace
+
+int main() {
+    std::vector<double> reals;
+    std::string corpus = BuildCorpus(reals);
+    printf("corpus: %zu bytes, %d records, %zu reals\n", corpus.size(),
+           BENCH_RECORDS, reals.size());
+
+    Clock::time_point start = Clock::now();
+    JsonSerializer json;
+    if (!json.Parse(corpus)) {
+        fprintf(stderr, "corpus does not parse\n");
+        return 1;
+    }
+    double parse = NsPerOp(start, corpus.size());
+
+    std::vector<JsonSerializer> records;
+    json.GetCollection("records", records);
+    std::vector<std::string> keys;
+    for (int r = 0; r < BENCH_READINGS; ++r) {
+        std::ostringstream key;
+        key << "r" << r;
+        keys.push_back(key.str());
+    }
+
+    size_t mismatches = 0;
+    double sum = 0;
+    start = Clock::now();
+    for (size_t i = 0, n = 0; i < records.size(); ++i) {
+        for (size_t k = 0; k < keys.size(); ++k, ++n) {
+            double value = 0;
+            if (!records[i].GetValue(keys[k], value) ||
+                memcmp(&value, &reals[n], sizeof(value)) != 0) {
+                ++mismatches;
+            }
+            sum += value;
+        }
+    }
+    double get = NsPerOp(start, reals.size());
+
+    start = Clock::now();
+    size_t ints = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        double value;
+        if (StreamGet(records[i], "ts", value)) {
+            sum += value;
+            ++ints;
+        }
+        if (StreamGet(records[i], "count", value)) {
+            sum += value;
+            ++ints;
+        }
+    }
+    double streamGet = NsPerOp(start, ints);
+
+    start = Clock::now();
+    ints = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        double value;
+        if (records[i].GetValue("ts", value)) {
+            sum += value;
+            ++ints;
+        }
+        if (records[i].GetValue("count", value)) {
+            sum += value;
+            ++ints;
+        }
+    }
+    double fastGet = NsPerOp(start, ints);
+
+    start = Clock::now();
+    for (size_t i = 0, n = 0; i < records.size(); ++i) {
+        for (size_t k = 0; k < keys.size(); ++k, ++n) {
+            records[i].PutValue(keys[k], reals[n]);
+        }
+    }
+    double put = NsPerOp(start, reals.size());
+
+    double dump[2];
+    for (int shortest = 0; shortest < 2; ++shortest) {
+        JsonSerializer fresh;
+        fresh.Parse(corpus);
+        start = Clock::now();
+        char* buffer = fresh.StreamJsonToBuffer(shortest != 0);
+        dump[shortest] = NsPerOp(start, corpus.size());
+
+        JsonSerializer back;
+        std::vector<JsonSerializer> backRecords;
+        if (!buffer || !back.Parse(buffer) ||
+            !back.GetCollection("records", backRecords)) {
+            ++mismatches;
+        }
+        free(buffer);
+        for (size_t i = 0, n = 0; i < backRecords.size(); ++i) {
+            for (size_t k = 0; k < keys.size(); ++k, ++n) {
+                double value = 0;
+                backRecords[i].GetValue(keys[k], value);
+                if (memcmp(&value, &reals[n], sizeof(value)) != 0) {
+                    ++mismatches;
+                }
+            }
+        }
+    }
+
+    printf("Parse                       %8.2f ns/byte\n", parse);
+    printf("GetValue<double> real       %8.2f ns/op\n", get);
+    printf("GetValue<double> integer    %8.2f ns/op (iostream %.2f)\n",
+           fastGet, streamGet);
+    printf("PutValue<double>            %8.2f ns/op\n", put);
+    printf("StreamJsonToBuffer          %8.2f ns/byte\n", dump[0]);
+    printf("StreamJsonToBuffer shortest %8.2f ns/byte\n", dump[1]);
+    printf("checksum %g, round trip mismatches %zu\n", sum, mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,382 @@
+/*!
+ * @file jsonThroughputBench.cpp
+ * @brief Throughput regression check of JsonSerializer on the standard
+ * corpora.
+ * Details. The standard corpora are generated from fixed seeds so that runs
+ * compare: records like our service payloads, numeric telemetry, string
+ * heavy documents with escapes and UTF-8, and deep nesting. Further corpora
+ * can be given as files. Parse, StreamJsonToBuffer, GetCollection and
+ * GetValue are timed on each corpus, taking the best of BENCH_ROUNDS rounds
+ * of at least BENCH_ROUND_NS each.
+ * json_loads is timed on each corpus as well, and the other operations are
+ * compared as multiples of it, so that a machine that is busier or slower
+ * than when the baseline was taken does not count as a regression. With
+ * --record the results are written to a baseline file; with --baseline they
+ * are compared against one, and the program fails if any operation got
+ * slower by more than the tolerance (BENCH_TOLERANCE percent by default).
+ * Record the baseline with the same build of jansson the check runs with.
+ * Build it together with the library sources, e.g.
+ *   g++ -O2 -std=c++17 -I. bench/jsonThroughputBench.cpp json*.cpp -ljansson
+ * and run it as
+ *   ./a.out --record throughput.baseline
+ *   ./a.out --baseline throughput.baseline [--tolerance 10] [--corpus f.json]
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_ROUNDS 7
+#define BENCH_TOLERANCE 10.0
+
+/* Rounds shorter than this are too noisy to compare. */
+#define BENCH_ROUND_NS 50e6
+
+/* Every corpus is generated to about this many bytes. */
+#define BENCH_CORPUS_SIZE (4 * 1024 * 1024)
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Corpus {
+    std::string name;
+    std::string text;
+};
+
+struct Result {
+    std::string corpus;
+    std::string op;
+    double ns;
+};
+
+std::string Dumped(const JsonSerializer& json) {
+    char* buffer = json.StreamJsonToBuffer();
+    std::string text(buffer ? buffer : "");
+    free(buffer);
+    return text;
+}
+
+/* Objects with a few strings, numbers and a small nested list each. */
+std::string Records(std::mt19937_64& rng) {
+    std::ostringstream out;
+    out << "{\"records\":[";
+    for (int i = 0; out.tellp() < BENCH_CORPUS_SIZE; ++i) {
+        if (i) out << ',';
+        out << "{\"id\":" << i << ",\"name\":\"host-" << rng() % 10000
+            << "\",\"port\":\"" << 30000 + rng() % 1000
+            << "\",\"enabled\":" << (rng() % 2 ? "true" : "false")
+            << ",\"weight\":" << (double)(rng() % 100000) / 1000
+            << ",\"tags\":[\"a" << rng() % 50 << "\",\"b" << rng() % 50
+            << "\"]}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+/* Records that are nearly all numbers, integers and reals. */
+std::string Numbers(std::mt19937_64& rng) {
+    std::ostringstream out;
+    out.precision(17);
+    out << "{\"records\":[";
+    for (int i = 0; out.tellp() < BENCH_CORPUS_SIZE; ++i) {
+        if (i) out << ',';
+        out << "{\"ts\":" << 1380000000000LL + i * 250LL << ",\"seq\":" << i;
+        for (int r = 0; r < 8; ++r) {
+            out << ",\"r" << r
+                << "\":" << ldexp((double)(rng() >> 11), -53) * 1e5;
+        }
+        out << '}';
+    }
+    out << "]}";
+    return out.str();
+}
+
+/* Long strings with escapes and multi byte UTF-8. */
+std::string Strings(std::mt19937_64& rng) {
+    static const char* kPieces[] = {"lorem ", "ipsum ", "\\\"quoted\\\" ",
+                                    "tab\\t ", "caf\xc3\xa9 ", "\\u00e9 ",
+                                    "\xe2\x82\xac ", "line\\n "};
+    std::ostringstream out;
+    out << "{\"records\":[";
+    for (int i = 0; out.tellp() < BENCH_CORPUS_SIZE; ++i) {
+        if (i) out << ',';
+        out << "{\"text\":\"";
+        for (int p = 0; p < 24; ++p) out << kPieces[rng() % 8];
+        out << "\",\"title\":\"t" << i << "\"}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+/* Records holding objects nested a few dozen levels deep. */
+std::string Nested(std::mt19937_64& rng) {
+    std::ostringstream out;
+    out << "{\"records\":[";
+    for (int i = 0; out.tellp() < BENCH_CORPUS_SIZE; ++i) {
+        if (i) out << ',';
+        int depth = 8 + rng() % 24;
+        out << "{\"depth\":" << depth;
+        for (int d = 0; d < depth; ++d) out << ",\"n\":[{\"d\":" << d;
+        for (int d = 0; d < depth; ++d) out << "}]";
+        out << '}';
+    }
+    out << "]}";
+    return out.str();
+}
+
+double NsPerOp(Clock::time_point start, size_t ops) {
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+/* Calls per round, so that a round takes at least BENCH_ROUND_NS. */
+size_t Calls(double ns) {
+    return ns >= BENCH_ROUND_NS ? 1 : (size_t)(BENCH_ROUND_NS / ns) + 1;
+}
+
+/* Best of BENCH_ROUNDS rounds of calls of run, in ns per call. */
+template <typename Run>
+double Best(Run run) {
+    Clock::time_point start = Clock::now();
+    run();
+    size_t calls = Calls(NsPerOp(start, 1));
+
+    double best = 0;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        start = Clock::now();
+        for (size_t i = 0; i < calls; ++i) run();
+        double ns = NsPerOp(start, calls);
+        if (round == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+bool Measure(const Corpus& corpus, std::vector<Result>& results,
+             double& checksum) {
+    JsonSerializer json;
+    if (!json.Parse(corpus.text)) {
+        fprintf(stderr, "%s: corpus does not parse\n", corpus.name.c_str());
+        return false;
+    }
+    std::string expected = Dumped(json);
+
+    /* raw jansson on the same corpus, to factor out the speed of the
+     * machine at the time of the run. */
+    Result reference = {corpus.name, "json_loads", Best([&corpus]() {
+                            json_t* doc =
+                                json_loads(corpus.text.c_str(), 0, NULL);
+                            json_decref(doc);
+                        })};
+    results.push_back(reference);
+
+    Result parse = {corpus.name, "Parse", Best([&corpus]() {
+                        JsonSerializer doc;
+                        doc.Parse(corpus.text);
+                    })};
+    results.push_back(parse);
+
+    /* fresh documents each round, so that no dump is cached. */
+    bool same = true;
+    Result dump = {corpus.name, "StreamJsonToBuffer", 0};
+    size_t calls = 1;
+    for (int round = 0; round <= BENCH_ROUNDS; ++round) {
+        std::vector<JsonSerializer> docs(calls);
+        for (size_t i = 0; i < calls; ++i) docs[i].Parse(corpus.text);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < calls; ++i) {
+            char* buffer = docs[i].StreamJsonToBuffer();
+            if (buffer == 0 || expected != buffer) same = false;
+            free(buffer);
+        }
+        double ns = NsPerOp(start, calls);
+        /* the first round only calibrates. */
+        if (round == 0) {
+            calls = Calls(ns);
+        } else if (round == 1 || ns < dump.ns) {
+            dump.ns = ns;
+        }
+    }
+    results.push_back(dump);
+    if (!same) {
+        fprintf(stderr, "%s: dumps differ\n", corpus.name.c_str());
+        return false;
+    }
+
+    /* corpora given as files need not hold "records". */
+    std::vector<JsonSerializer> records;
+    if (!json.GetCollection("records", records) || records.empty()) {
+        return true;
+    }
+    Result collection = {corpus.name, "GetCollection", Best([&json]() {
+                             std::vector<JsonSerializer> rows;
+                             json.GetCollection("records", rows);
+                         })};
+    results.push_back(collection);
+
+    std::vector<std::string> keys;
+    keys.push_back("id");
+    keys.push_back("ts");
+    keys.push_back("weight");
+    keys.push_back("depth");
+    size_t next = 0;
+    Result get = {corpus.name, "GetValue", Best([&]() {
+                      const JsonSerializer& record = records[next];
+                      next = (next + 1) % records.size();
+                      double value;
+                      for (size_t k = 0; k < keys.size(); ++k) {
+                          if (record.GetValue(keys[k], value)) {
+                              checksum += value;
+                          }
+                      }
+                  })};
+    results.push_back(get);
+    return true;
+}
+
+std::string Key(const std::string& corpus, const std::string& op) {
+    return corpus + " " + op;
+}
+
+/* Time of an operation relative to json_loads on the same corpus. */
+double Relative(const std::map<std::string, double>& times,
+                const std::string& corpus, const std::string& op) {
+    std::map<std::string, double>::const_iterator it =
+        times.find(Key(corpus, op));
+    std::map<std::string, double>::const_iterator reference =
+        times.find(Key(corpus, "json_loads"));
+    if (it == times.end() || reference == times.end() ||
+        reference->second <= 0) {
+        return 0;
+    }
+    return it->second / reference->second;
+}
+
+bool ReadBaseline(const char* path, std::map<std::string, double>& baseline) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string corpus, op;
+    double ns;
+    while (in >> corpus >> op >> ns) baseline[Key(corpus, op)] = ns;
+    return true;
+}
+
+bool WriteBaseline(const char* path, const std::vector<Result>& results) {
+    FILE* out = fopen(path, "w");
+    if (out == 0) return false;
+    for (size_t i = 0; i < results.size(); ++i) {
+        fprintf(out, "%s %s %.2f\n", results[i].corpus.c_str(),
+                results[i].op.c_str(), results[i].ns);
+    }
+    return fclose(out) == 0;
+}
+
+bool ReadFile(const char* path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+int Usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--record FILE | --baseline FILE] [--tolerance PCT] "
+            "[--corpus FILE]...\n",
+            program);
+    return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const char* record = 0;
+    const char* baselinePath = 0;
+    double tolerance = BENCH_TOLERANCE;
+    std::vector<Corpus> corpora;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) return Usage(argv[0]);
+        if (strcmp(argv[i], "--record") == 0) {
+            record = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--corpus") == 0) {
+            Corpus corpus;
+            corpus.name = argv[++i];
+            if (!ReadFile(corpus.name.c_str(), corpus.text)) {
+                fprintf(stderr, "cannot read %s\n", corpus.name.c_str());
+                return 2;
+            }
+            corpora.push_back(corpus);
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+
+    std::mt19937_64 rng(20131);
+    Corpus standard[] = {{"records", Records(rng)},
+                         {"numbers", Numbers(rng)},
+                         {"strings", Strings(rng)},
+                         {"nested", Nested(rng)}};
+    corpora.insert(corpora.begin(), standard, standard + 4);
+
+    std::vector<Result> results;
+    double checksum = 0;
+    for (size_t i = 0; i < corpora.size(); ++i) {
+        if (!Measure(corpora[i], results, checksum)) return 1;
+    }
+
+    std::map<std::string, double> baseline;
+    if (baselinePath && !ReadBaseline(baselinePath, baseline)) {
+        fprintf(stderr, "cannot read %s\n", baselinePath);
+        return 2;
+    }
+
+    std::map<std::string, double> current;
+    for (size_t i = 0; i < results.size(); ++i) {
+        current[Key(results[i].corpus, results[i].op)] = results[i].ns;
+    }
+
+    int regressions = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        printf("%-12s %-20s %14.2f ns/op", result.corpus.c_str(),
+               result.op.c_str(), result.ns);
+        double now = Relative(current, result.corpus, result.op);
+        double then = Relative(baseline, result.corpus, result.op);
+        if (result.op != "json_loads" && now > 0 && then > 0) {
+            double change = (now / then - 1) * 100;
+            bool regressed = change > tolerance;
+            if (regressed) ++regressions;
+            printf("  %+7.1f%%%s", change, regressed ? "  REGRESSION" : "");
+        }
+        printf("\n");
+    }
+    printf("checksum %g\n", checksum);
+
+    if (record && !WriteBaseline(record, results)) {
+        fprintf(stderr, "cannot write %s\n", record);
+        return 2;
+    }
+    if (regressions) {
+        printf("%d operations slower than the baseline by more than %.1f%%\n",
+               regressions, tolerance);
+        return 1;
+    }
+    return 0;
+}
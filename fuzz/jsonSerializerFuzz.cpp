@@ -0,0 +1,341 @@
+/*!
+ * @file jsonSerializerFuzz.cpp
+ * @brief Differential fuzz target of JsonSerializer against raw jansson.
+ * Details. Every input is parsed by JsonSerializer in each of its parse
+ * modes and by jansson itself, and the two must agree: on whether the input
+ * is accepted, on the tree built, on the bytes StreamJsonToBuffer writes
+ * and on what GetValue<T> and the collection getters return for the members
+ * of the root. GetValue<T> is checked against the iostream conversion it
+ * stands for. A disagreement aborts with a message, which the fuzzer
+ * reports as a crash together with the input.
+ * Build it under the sanitizers together with the library sources, with
+ * ParseParallel's size thresholds lowered so that every input is split at
+ * its elements and parsed in chunks of one or more of them, e.g. for
+ * libFuzzer
+ *   clang++ -g -O1 -std=c++17 -fsanitize=fuzzer,address,undefined -I. \
+ *     -DPARALLEL_PARSE_MIN_SIZE=1 -DPARALLEL_PARSE_MIN_CHUNK=1 \
+ *     fuzz/jsonSerializerFuzz.cpp json*.cpp -ljansson
+ *   ./a.out -dict=fuzz/json.dict fuzz/corpus
+ * and for AFL, or to replay inputs without a fuzzer, with JSON_FUZZ_MAIN
+ *   afl-clang-fast++ -g -O1 -std=c++17 -fsanitize=address,undefined \
+ *     -DPARALLEL_PARSE_MIN_SIZE=1 -DPARALLEL_PARSE_MIN_CHUNK=1 \
+ *     -DJSON_FUZZ_MAIN -I. fuzz/jsonSerializerFuzz.cpp json*.cpp -ljansson
+ *   afl-fuzz -i fuzz/corpus -o findings -- ./a.out
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Members of the root checked per input, to keep inputs fast. */
+#define FUZZ_MAX_MEMBERS 64
+
+#define FUZZ_CHECK(cond)                                                    \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                 \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+namespace {
+
+/* Takes ownership of a jansson reference. */
+class JsonRef {
+   public:
+    explicit JsonRef(json_t* json) : m_Json(json) {}
+    ~JsonRef() {
+        if (m_Json) json_decref(m_Json);
+    }
+    json_t* Get() const { return m_Json; }
+
+   private:
+    JsonRef(const JsonRef&);
+    JsonRef& operator=(const JsonRef&);
+
+    json_t* m_Json;
+};
+
+std::string Dumped(const JsonSerializer& json, bool shortestReals) {
+    char* buffer = json.StreamJsonToBuffer(shortestReals);
+    FUZZ_CHECK(buffer != 0);
+    std::string text(buffer);
+    free(buffer);
+    return text;
+}
+
+bool Equal(const JsonSerializer& json, json_t* reference) {
+    return json.Equals(JsonSerializer(reference));
+}
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+std::string Trimmed(const char* text) {
+    size_t begin = 0;
+    size_t end = strlen(text);
+    while (begin < end && IsSpace(text[begin])) ++begin;
+    while (end > begin && IsSpace(text[end - 1])) --end;
+    return std::string(text + begin, end - begin);
+}
+
+/* RFC 6901 pointer to a member of the root. */
+std::string PointerTo(const char* key) {
+    std::string pointer = "/";
+    for (; *key; ++key) {
+        if (*key == '~') {
+            pointer += "~0";
+        } else if (*key == '/') {
+            pointer += "~1";
+        } else {
+            pointer += *key;
+        }
+    }
+    return pointer;
+}
+
+/* The iostream conversion GetValue<T> is defined by; its fast paths must
+ * give the same answers. */
+template <typename T>
+bool StreamValue(json_t* item, T& value) {
+    std::ostringstream oss;
+    if (json_is_integer(item)) {
+        oss << json_integer_value(item);
+    } else if (json_is_real(item)) {
+        char buffer[JSON_NUMBER_BUFFER_SIZE];
+        FormatJsonReal(json_real_value(item), true, buffer);
+        oss << buffer;
+    } else if (json_is_string(item)) {
+        oss << json_string_value(item);
+    } else if (json_is_boolean(item)) {
+        oss << json_boolean_value(item);
+    } else {
+        std::string text;
+        if (!JsonNodeItem(item).Dump(text)) return false;
+        oss << text;
+    }
+
+    std::istringstream iss(oss.str());
+    return !(iss >> value).fail();
+}
+
+template <typename T>
+void CheckValue(const JsonSerializer& json, const char* key, json_t* item) {
+    T value = T();
+    T expected = T();
+    bool ok = json.GetValue(key, value);
+    FUZZ_CHECK(ok == StreamValue(item, expected));
+    if (ok) FUZZ_CHECK(value == expected);
+}
+
+void CheckCollections(const JsonSerializer& json, const std::string& key,
+                      json_t* item) {
+    std::vector<JsonSerializer> vec;
+    bool ok = json.GetCollection(key, vec);
+    FUZZ_CHECK(ok == (json_is_array(item) != 0));
+    if (ok) {
+        FUZZ_CHECK(vec.size() == json_array_size(item));
+        for (size_t i = 0; i < vec.size(); ++i) {
+            FUZZ_CHECK(Equal(vec[i], json_array_get(item, i)));
+        }
+    }
+
+    int limits[] = {DEFAULT_LIMIT_GET_COLLECTION, 0, 1, 2, 3};
+    for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); ++l) {
+        std::set<std::string> strings;
+        ok = json.GetStringCollection(key, strings, limits[l]);
+
+        /* a limit of n takes n - 1 strings. */
+        std::set<std::string> expected;
+        bool expectedOk = json_is_array(item) != 0;
+        for (size_t i = 0; expectedOk && i < json_array_size(item); ++i) {
+            if (limits[l] != DEFAULT_LIMIT_GET_COLLECTION &&
+                (int)i == limits[l] - 1) {
+                break;
+            }
+            json_t* element = json_array_get(item, i);
+            if (!json_is_string(element)) {
+                expectedOk = false;
+            } else {
+                expected.insert(json_string_value(element));
+            }
+        }
+        FUZZ_CHECK(ok == expectedOk);
+        if (ok) FUZZ_CHECK(strings == expected);
+    }
+}
+
+void CheckMember(const JsonSerializer& json, const char* data, size_t size,
+                 const char* key, json_t* item) {
+    CheckValue<long long>(json, key, item);
+    CheckValue<int>(json, key, item);
+    CheckValue<unsigned int>(json, key, item);
+    CheckValue<unsigned long long>(json, key, item);
+    CheckValue<double>(json, key, item);
+    CheckValue<bool>(json, key, item);
+
+    std::string text;
+    bool ok = json.GetValue(key, text);
+    FUZZ_CHECK(ok == (json_is_string(item) != 0));
+    if (ok) FUZZ_CHECK(text == json_string_value(item));
+
+    JsonSerializer object;
+    FUZZ_CHECK(json.GetObject(key, object));
+    FUZZ_CHECK(Equal(object, item));
+
+    /* the collection getters take an empty key for the root itself, which
+     * is an object here, not for the member with that key. */
+    if (*key == '\0') {
+        std::vector<JsonSerializer> vec;
+        std::set<std::string> strings;
+        FUZZ_CHECK(!json.GetCollection(key, vec));
+        FUZZ_CHECK(!json.GetStringCollection(key, strings));
+    } else {
+        CheckCollections(json, key, item);
+    }
+
+    /* the projection of one member holds just that member. */
+    std::set<std::string> projection;
+    projection.insert(PointerTo(key));
+    JsonSerializer projected;
+    FUZZ_CHECK(projected.Parse(data, size, projection));
+    JsonRef expected(json_object());
+    json_object_set(expected.Get(), key, item);
+    FUZZ_CHECK(Equal(projected, expected.Get()));
+}
+
+/* Parse modes that keep the source must accept what jansson accepts with
+ * the same flags and build the same tree. */
+void CheckParseOptions(const std::string& input) {
+    const char* data = input.c_str();
+    size_t len = strlen(data);
+    int modes[] = {JsonSerializer::kRejectDuplicates,
+                   JsonSerializer::kDecodeAny,
+                   JsonSerializer::kPreserveOrder,
+                   JsonSerializer::kPreserveOrder | JsonSerializer::kDecodeAny,
+                   JsonSerializer::kPreserveOrder |
+                       JsonSerializer::kRejectDuplicates,
+                   JsonSerializer::kLosslessNumbers,
+                   JsonSerializer::kLosslessNumbers |
+                       JsonSerializer::kPreserveOrder |
+                       JsonSerializer::kDecodeAny};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        int options = modes[m];
+        size_t flags = 0;
+        if (options & JsonSerializer::kRejectDuplicates) {
+            flags |= JSON_REJECT_DUPLICATES;
+        }
+        if (options & JsonSerializer::kDecodeAny) flags |= JSON_DECODE_ANY;
+        JsonRef reference(json_loadb(data, len, flags, NULL));
+
+        JsonSerializer json;
+        bool ok = json.Parse(input, options);
+        if (options & JsonSerializer::kLosslessNumbers) {
+            /* integers out of range are accepted on top. */
+            FUZZ_CHECK(ok || !reference.Get());
+        } else {
+            FUZZ_CHECK(ok == (reference.Get() != 0));
+        }
+        if (!ok) continue;
+        if (reference.Get()) FUZZ_CHECK(Equal(json, reference.Get()));
+
+        std::string dump = Dumped(json, false);
+        JsonSerializer back;
+        FUZZ_CHECK(back.Parse(dump, options));
+        FUZZ_CHECK(back.Equals(json));
+        FUZZ_CHECK(Dumped(back, false) == dump);
+
+        /* a document without duplicate keys dumps as it was read. */
+        JsonRef unique(
+            json_loadb(data, len, JSON_DECODE_ANY | JSON_REJECT_DUPLICATES,
+                       NULL));
+        if ((options & JsonSerializer::kPreserveOrder) && unique.Get() &&
+            (json_is_object(unique.Get()) || json_is_array(unique.Get()))) {
+            FUZZ_CHECK(dump == Trimmed(data));
+        }
+    }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* bytes, size_t size) {
+    /* Parse, like json_loads, reads up to the first NUL. */
+    std::string input(size ? reinterpret_cast<const char*>(bytes) : "", size);
+    const char* data = input.c_str();
+
+    JsonRef reference(json_loads(data, 0, NULL));
+    JsonSerializer json;
+    bool ok = json.Parse(input);
+    FUZZ_CHECK(ok == (reference.Get() != 0));
+    CheckParseOptions(input);
+
+    /* with the build lines above this takes the pre-scan and the split. */
+    JsonSerializer parallel;
+    FUZZ_CHECK(parallel.ParseParallel(input, 2) == ok);
+    if (!ok) return 0;
+
+    /* the cached dump is json_dumps's compact form, byte for byte. */
+    char* expected = json_dumps(reference.Get(), JSON_COMPACT);
+    FUZZ_CHECK(expected != 0);
+    FUZZ_CHECK(Dumped(json, false) == expected);
+    FUZZ_CHECK(Dumped(json, false) == expected);
+    free(expected);
+
+    JsonRef shortest(json_loads(Dumped(json, true).c_str(), 0, NULL));
+    FUZZ_CHECK(shortest.Get() != 0);
+    FUZZ_CHECK(json_equal(shortest.Get(), reference.Get()));
+
+    FUZZ_CHECK(parallel.Equals(json));
+
+    std::set<std::string> whole;
+    whole.insert("");
+    JsonSerializer projected;
+    FUZZ_CHECK(projected.Parse(data, strlen(data), whole));
+    FUZZ_CHECK(projected.Equals(json));
+
+    if (json_is_array(reference.Get())) {
+        CheckCollections(json, "", reference.Get());
+        return 0;
+    }
+
+    size_t members = 0;
+    for (void* iter = json_object_iter(reference.Get());
+         iter && members < FUZZ_MAX_MEMBERS;
+         iter = json_object_iter_next(reference.Get(), iter), ++members) {
+        CheckMember(json, data, strlen(data), json_object_iter_key(iter),
+                    json_object_iter_value(iter));
+    }
+    return 0;
+}
+
+#ifdef JSON_FUZZ_MAIN
+/* Runs the target on each file named, or on stdin, as AFL drives it. */
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc || i == 1; ++i) {
+        FILE* file = i < argc ? fopen(argv[i], "rb") : stdin;
+        if (file == 0) {
+            fprintf(stderr, "cannot open %s\n", argv[i]);
+            return 1;
+        }
+        std::vector<uint8_t> input;
+        uint8_t buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            input.insert(input.end(), buffer, buffer + n);
+        }
+        if (file != stdin) fclose(file);
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,200 @@
+/*!
+ * @file jsonAsync.cpp
+ * @brief Asynchronous parsing and serialisation of JsonSerializer documents.
+ * Details. See jsonAsync.h.
+ * $Id$
+ * */
+
+#include "jsonAsync.h"
+#include "jsonThreadPool.h"
+
+#include <vector>
+
+namespace {
+
+/*
+ * Counts the nodes of a tree, stopping once limit is reached.
+ * @return bool. True if the tree has fewer than limit nodes.
+ * */
+bool HasFewerNodes(json_t* json, size_t limit) {
+    std::vector<json_t*> pending(1, json);
+    size_t count = 0;
+    while (!pending.empty()) {
+        json_t* node = pending.back();
+        pending.pop_back();
+        if (++count >= limit) return false;
+
+        if (json_is_object(node)) {
+            const char* key;
+            json_t* value;
+            json_object_foreach(node, key, value) { pending.push_back(value); }
+        } else if (json_is_array(node)) {
+            for (size_t i = 0; i < json_array_size(node); ++i) {
+                pending.push_back(json_array_get(node, i));
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Hands a result to the completion, then to the future, on the executor if
+ * there is one.
+ * */
+template <typename Result, typename Completion>
+void Deliver(const std::shared_ptr<std::promise<Result> >& promise,
+             const std::shared_ptr<Result>& result,
+             const Completion& completion, const JsonExecutor& executor) {
+    std::function<void()> task = [promise, result, completion]() {
+        if (completion) completion(*result);
+        promise->set_value(std::move(*result));
+    };
+
+    if (executor)
+        executor(task);
+    else
+        task();
+}
+
+}  // namespace
+
+/*!
+ * default no param constructor. A new flag, not cancelled.
+ * */
+JsonCancellation::JsonCancellation()
+    : m_Cancelled(std::make_shared<std::atomic<bool> >(false)) {}
+
+/*!
+ * Cancel function. Asks the jobs started with this flag to stop. A job that
+ * has already finished is not affected.
+ * */
+void JsonCancellation::Cancel() { *m_Cancelled = true; }
+
+/*!
+ * Cancelled function.
+ * @return bool. True once Cancel was called on this flag or a copy of it.
+ * */
+bool JsonCancellation::Cancelled() const { return *m_Cancelled; }
+
+/*!
+ * default no param constructor. No executor, a fresh cancellation flag and
+ * the default inline thresholds.
+ * */
+JsonAsyncOptions::JsonAsyncOptions()
+    : inlineMaxSize(ASYNC_INLINE_MAX_SIZE),
+      inlineMaxNodes(ASYNC_INLINE_MAX_NODES),
+      threads(0),
+      shortestReals(false) {}
+
+/*!
+ * ParseAsync function. Parses a json formatted data stream on the library's
+ * thread pool. A large top-level array is parsed with ParseParallel, whose
+ * helpers come from the same pool. Inputs shorter than inlineMaxSize are
+ * parsed on the calling thread before this returns.
+ * Cancellation is checked before the parse starts and between the chunks of
+ * a parallel parse; a parse that finishes anyway is discarded and reported
+ * as cancelled.
+ * NOTE: with an executor the future is only fulfilled once the executor has
+ * run the completion, so do not wait on it from the executor's own thread.
+ * @param string instr. The json formatted data stream; moved from, if the
+ * caller passes an rvalue.
+ * @param const reference to the options.
+ * @param const reference to the completion, called with the result. May be
+ * empty.
+ * @return future of the result.
+ * */
+std::future<JsonParseResult> JsonAsync::ParseAsync(
+    std::string instr, const JsonAsyncOptions& options,
+    const ParseCompletion& completion) {
+    std::shared_ptr<std::promise<JsonParseResult> > promise =
+        std::make_shared<std::promise<JsonParseResult> >();
+    std::future<JsonParseResult> future = promise->get_future();
+    std::shared_ptr<JsonParseResult> result =
+        std::make_shared<JsonParseResult>();
+
+    if (instr.size() < options.inlineMaxSize) {
+        RunParse(instr, options, *result);
+        Deliver(promise, result, completion, options.executor);
+        return future;
+    }
+
+    std::shared_ptr<std::string> input =
+        std::make_shared<std::string>(std::move(instr));
+    JsonThreadPool::Instance().Submit(
+        [promise, result, input, options, completion]() {
+            RunParse(*input, options, *result);
+            Deliver(promise, result, completion, options.executor);
+        });
+    return future;
+}
+
+/*!
+ * StreamAsync function. Async form of StreamJsonToBuffer. The document is
+ * serialised on the library's thread pool from a copy-on-write clone taken
+ * on the calling thread, see DeepClone, so the caller may go on modifying it
+ * in the meantime through json or any other handle into the document. A
+ * handle into its nodes taken from another document, e.g. one a subtree was
+ * put into with PutObject, must not modify them until the result is in.
+ * Documents with fewer than inlineMaxNodes nodes are serialised on the
+ * calling thread before this returns.
+ * NOTE: with an executor the future is only fulfilled once the executor has
+ * run the completion, so do not wait on it from the executor's own thread.
+ * @param const reference to the serializer holding the document.
+ * @param const reference to the options.
+ * @param const reference to the completion, called with the result. May be
+ * empty.
+ * @return future of the result. Not ok if json is empty.
+ * */
+std::future<JsonStreamResult> JsonAsync::StreamAsync(
+    const JsonSerializer& json, const JsonAsyncOptions& options,
+    const StreamCompletion& completion) {
+    std::shared_ptr<std::promise<JsonStreamResult> > promise =
+        std::make_shared<std::promise<JsonStreamResult> >();
+    std::future<JsonStreamResult> future = promise->get_future();
+    std::shared_ptr<JsonStreamResult> result =
+        std::make_shared<JsonStreamResult>();
+
+    json.Sync();
+    if (!json.m_Json || HasFewerNodes(json.m_Json, options.inlineMaxNodes)) {
+        RunStream(json, options, *result);
+        Deliver(promise, result, completion, options.executor);
+        return future;
+    }
+
+    JsonSerializer snapshot = json.DeepClone(true);
+    JsonThreadPool::Instance().Submit(
+        [promise, result, snapshot, options, completion]() {
+            RunStream(snapshot, options, *result);
+            Deliver(promise, result, completion, options.executor);
+        });
+    return future;
+}
+
+void JsonAsync::RunParse(const std::string& instr,
+                         const JsonAsyncOptions& options,
+                         JsonParseResult& result) {
+    const std::atomic<bool>* cancelled =
+        options.cancellation.m_Cancelled.get();
+    if (!*cancelled) {
+        result.ok = result.json.ParseParallel(instr, options.threads,
+                                              cancelled);
+    }
+    if (*cancelled) {
+        result.ok = false;
+        result.cancelled = true;
+        result.json.Clear();
+    }
+}
+
+void JsonAsync::RunStream(const JsonSerializer& json,
+                          const JsonAsyncOptions& options,
+                          JsonStreamResult& result) {
+    if (!options.cancellation.Cancelled()) {
+        result.ok = json.Dump(result.text, options.shortestReals);
+    }
+    if (options.cancellation.Cancelled()) {
+        result.ok = false;
+        result.cancelled = true;
+        result.text.clear();
+    }
+}
@@ -0,0 +1,110 @@
+/*!
+ * @file jsonAsync.h
+ * @brief Asynchronous parsing and serialisation of JsonSerializer documents.
+ * Details. The work runs on the library's own thread pool, see
+ * jsonThreadPool.h, and its result is handed over through a std::future
+ * and, if one is given, a completion callback. Small jobs are not worth the
+ * hop to another thread and are done on the calling thread. A completion can
+ * be sent back to the caller's own event loop through an executor.
+ * $Id$
+ * */
+
+#ifndef JSONASYNC_H
+#define JSONASYNC_H
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "public/JSonSerializer.h"
+
+/* Inputs shorter than this are parsed on the calling thread. */
+#define ASYNC_INLINE_MAX_SIZE (64 * 1024)
+
+/* Documents with fewer nodes than this are serialised on the calling
+ * thread. */
+#define ASYNC_INLINE_MAX_NODES 4096
+
+/* Runs a task on the caller's event loop, e.g. by posting it to the loop's
+ * queue. It must run every task it is given exactly once. */
+typedef std::function<void(const std::function<void()>& task)> JsonExecutor;
+
+/* Cancellation flag shared by all copies; cancel one, cancel them all. */
+class JsonCancellation {
+   public:
+    JsonCancellation();
+    void Cancel();
+    bool Cancelled() const;
+
+   private:
+    friend class JsonAsync;
+
+    /* members */
+    std::shared_ptr<std::atomic<bool> > m_Cancelled;
+};
+
+struct JsonAsyncOptions {
+    JsonAsyncOptions();
+
+    /* runs the completion and fulfils the future. Empty to do both on the
+     * thread that did the work. */
+    JsonExecutor executor;
+    JsonCancellation cancellation;
+    size_t inlineMaxSize;
+    size_t inlineMaxNodes;
+    /* threads for a parse that ParseParallel can split, 0 for one per
+     * core. */
+    unsigned int threads;
+    /* see JsonSerializer::StreamJsonToBuffer. */
+    bool shortestReals;
+};
+
+struct JsonParseResult {
+    JsonParseResult() : ok(false), cancelled(false) {}
+
+    /* true if json holds the parsed document. */
+    bool ok;
+    /* true if the parse was cancelled before it finished. */
+    bool cancelled;
+    JsonSerializer json;
+};
+
+struct JsonStreamResult {
+    JsonStreamResult() : ok(false), cancelled(false) {}
+
+    /* true if text holds the serialised document. */
+    bool ok;
+    /* true if the serialisation was cancelled before it finished. */
+    bool cancelled;
+    std::string text;
+};
+
+class JsonAsync {
+   public:
+    typedef std::function<void(const JsonParseResult& result)>
+        ParseCompletion;
+    typedef std::function<void(const JsonStreamResult& result)>
+        StreamCompletion;
+
+    static std::future<JsonParseResult> ParseAsync(
+        std::string instr, const JsonAsyncOptions& options = JsonAsyncOptions(),
+        const ParseCompletion& completion = ParseCompletion());
+    static std::future<JsonStreamResult> StreamAsync(
+        const JsonSerializer& json,
+        const JsonAsyncOptions& options = JsonAsyncOptions(),
+        const StreamCompletion& completion = StreamCompletion());
+
+   private:
+    JsonAsync();
+
+    static void RunParse(const std::string& instr,
+                         const JsonAsyncOptions& options,
+                         JsonParseResult& result);
+    static void RunStream(const JsonSerializer& json,
+                          const JsonAsyncOptions& options,
+                          JsonStreamResult& result);
+};
+
+#endif  // JSONASYNC_H
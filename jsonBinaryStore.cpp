@@ -0,0 +1,705 @@
+/*!
+ * @file jsonBinaryStore.cpp
+ * @brief Binary, memory mapped form of a JsonSerializer document.
+ * Details. File layout, every offset counted from the start of the file and
+ * every node starting at a multiple of 8:
+ *   header  magic "JSNB", byte order mark, version, 0, file size, root offset
+ *   node    uint32 type, uint32 0, then by type:
+ *           integer  int64 value
+ *           real     double value
+ *           string   uint64 length, the bytes, a NUL
+ *           array    uint64 count, count uint64 element offsets
+ *           object   uint64 count, count pairs of uint64 key and value
+ *                    offsets in document order, then count uint64 member
+ *                    indexes in key order
+ *           null, true and false have no payload.
+ * Keys are strings stored once per distinct key; null, true and false are
+ * stored once per file. Every node is written after the nodes it refers
+ * to, so each offset in a node is below the node's own, and no array or
+ * object is referred to twice. A reader rejects offsets that break the
+ * first rule and stops after as many nodes as the file has room for, so a
+ * damaged file cannot make it loop or expand shared nodes without bound.
+ * $Id$
+ * */
+
+#include "jsonBinaryStore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
+
+#define BINARY_STORE_MAGIC "JSNB"
+#define BINARY_STORE_BYTE_ORDER 0x01020304u
+#define BINARY_STORE_VERSION 1
+
+/* Nesting deeper than this is not materialised, as jansson would not parse
+ * it either. */
+#define BINARY_STORE_MAX_DEPTH 2048
+
+namespace {
+
+enum NodeType {
+    kInvalid = 0,
+    kNull,
+    kTrue,
+    kFalse,
+    kInteger,
+    kReal,
+    kString,
+    kArray,
+    kObject
+};
+
+struct BinaryHeader {
+    char magic[4];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t root;
+};
+
+const uint64_t kNodeHeader = 8;
+
+inline uint64_t Load64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t Load32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/* Builds the file image, children before their parents. */
+class BinaryWriter {
+   public:
+    BinaryWriter() : m_Null(0), m_True(0), m_False(0) {
+        m_Out.assign(sizeof(BinaryHeader), '\0');
+    }
+
+    bool Finish(json_t* root, std::string& out) {
+        uint64_t offset = Write(root);
+        if (offset == 0) return false;
+
+        BinaryHeader header;
+        memcpy(header.magic, BINARY_STORE_MAGIC, 4);
+        header.byteOrder = BINARY_STORE_BYTE_ORDER;
+        header.version = BINARY_STORE_VERSION;
+        header.reserved = 0;
+        header.size = m_Out.size();
+        header.root = offset;
+        memcpy(&m_Out[0], &header, sizeof(header));
+        out.swap(m_Out);
+        return true;
+    }
+
+   private:
+    uint64_t Begin(NodeType type) {
+        m_Out.append((8 - m_Out.size() % 8) % 8, '\0');
+        uint64_t offset = m_Out.size();
+        uint32_t word[2] = {(uint32_t)type, 0};
+        m_Out.append((const char*)word, sizeof(word));
+        return offset;
+    }
+
+    void Put64(uint64_t value) {
+        m_Out.append((const char*)&value, sizeof(value));
+    }
+
+    uint64_t String(const char* data, size_t len) {
+        uint64_t offset = Begin(kString);
+        Put64(len);
+        m_Out.append(data, len);
+        m_Out.push_back('\0');
+        return offset;
+    }
+
+    uint64_t Key(const char* key) {
+        std::map<std::string, uint64_t>::iterator it = m_Keys.find(key);
+        if (it != m_Keys.end()) return it->second;
+        uint64_t offset = String(key, strlen(key));
+        m_Keys[key] = offset;
+        return offset;
+    }
+
+    uint64_t Shared(NodeType type, uint64_t& offset) {
+        if (offset == 0) offset = Begin(type);
+        return offset;
+    }
+
+    uint64_t Write(json_t* json) {
+        switch (json_typeof(json)) {
+            case JSON_NULL:
+                return Shared(kNull, m_Null);
+            case JSON_TRUE:
+                return Shared(kTrue, m_True);
+            case JSON_FALSE:
+                return Shared(kFalse, m_False);
+            case JSON_INTEGER: {
+                uint64_t offset = Begin(kInteger);
+                int64_t value = json_integer_value(json);
+                m_Out.append((const char*)&value, sizeof(value));
+                return offset;
+            }
+            case JSON_REAL: {
+                uint64_t offset = Begin(kReal);
+                double value = json_real_value(json);
+                m_Out.append((const char*)&value, sizeof(value));
+                return offset;
+            }
+            case JSON_STRING:
+                return String(json_string_value(json),
+                              json_string_length(json));
+            case JSON_ARRAY:
+                return Array(json);
+            case JSON_OBJECT:
+                return Object(json);
+        }
+        return 0;
+    }
+
+    uint64_t Array(json_t* json) {
+        std::vector<uint64_t> items(json_array_size(json));
+        for (size_t i = 0; i < items.size(); ++i) {
+            items[i] = Write(json_array_get(json, i));
+            if (items[i] == 0) return 0;
+        }
+
+        uint64_t offset = Begin(kArray);
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (items[i] >= offset) return 0;
+        }
+        Put64(items.size());
+        for (size_t i = 0; i < items.size(); ++i) Put64(items[i]);
+        return offset;
+    }
+
+    struct Member {
+        const char* key;
+        uint64_t keyOffset;
+        uint64_t valueOffset;
+    };
+
+    struct KeyOrder {
+        explicit KeyOrder(const std::vector<Member>& m) : members(m) {}
+        bool operator()(uint64_t a, uint64_t b) const {
+            return strcmp(members[a].key, members[b].key) < 0;
+        }
+        const std::vector<Member>& members;
+    };
+
+    uint64_t Object(json_t* json) {
+        std::vector<Member> members;
+        const char* key;
+        json_t* value;
+        json_object_foreach(json, key, value) {
+            Member member;
+            member.key = key;
+            member.keyOffset = Key(key);
+            member.valueOffset = Write(value);
+            if (member.valueOffset == 0) return 0;
+            members.push_back(member);
+        }
+
+        std::vector<uint64_t> order(members.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), KeyOrder(members));
+
+        uint64_t offset = Begin(kObject);
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].keyOffset >= offset ||
+                members[i].valueOffset >= offset) {
+                return 0;
+            }
+        }
+        Put64(members.size());
+        for (size_t i = 0; i < members.size(); ++i) {
+            Put64(members[i].keyOffset);
+            Put64(members[i].valueOffset);
+        }
+        for (size_t i = 0; i < order.size(); ++i) Put64(order[i]);
+        return offset;
+    }
+
+    /* members */
+    std::string m_Out;
+    std::map<std::string, uint64_t> m_Keys;
+    uint64_t m_Null, m_True, m_False;
+};
+
+bool WriteFile(const std::string& path, const std::string& image) {
+    /* written next to the target and renamed over it, so that processes
+     * that have the old file mapped keep reading it unchanged. The temporary
+     * name is unique per process, thread and call, and the data is synced
+     * before the rename, so that a crash never leaves a short file under
+     * the target's name. */
+    static std::atomic<unsigned long> counter(0);
+    char suffix[80];
+    snprintf(suffix, sizeof(suffix), ".tmp%ld.%zx.%lu", (long)getpid(),
+             std::hash<std::thread::id>()(std::this_thread::get_id()),
+             counter++);
+    std::string temp = path + suffix;
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd == -1) return false;
+    bool ok = true;
+    for (size_t done = 0; ok && done < image.size();) {
+        ssize_t written =
+            write(fd, image.data() + done, image.size() - done);
+        if (written > 0) {
+            done += written;
+        } else if (written == 0 || errno != EINTR) {
+            ok = false;
+        }
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(temp.c_str(), path.c_str()) == 0) return true;
+    unlink(temp.c_str());
+    return false;
+}
+
+}  // namespace
+
+/* One mapped file, unmapped with its last view. */
+struct JsonBinaryView::Mapping {
+    Mapping() : data(0), size(0) {}
+    ~Mapping() {
+        if (data) munmap((void*)data, size);
+    }
+
+    /* The bytes [offset, offset + bytes) of a node, or null if they are not
+     * all inside the file or the offset is not a node offset. */
+    const char* At(uint64_t offset, uint64_t bytes) const {
+        if (offset < sizeof(BinaryHeader) || offset % 8 != 0 ||
+            offset > size || bytes > size - offset) {
+            return 0;
+        }
+        return data + offset;
+    }
+
+    uint32_t Type(uint64_t offset) const {
+        const char* node = At(offset, kNodeHeader);
+        return node ? Load32(node) : (uint32_t)kInvalid;
+    }
+
+    /* Start and count of the entries of an array or object node, each
+     * taking entry bytes; 24 for objects, whose member pairs are followed by
+     * the index. */
+    const char* Entries(uint64_t offset, uint32_t type, uint64_t entry,
+                        uint64_t& count) const {
+        const char* node = At(offset, kNodeHeader + 8);
+        if (node == 0 || Load32(node) != type) return 0;
+        count = Load64(node + kNodeHeader);
+        if (count > (size - offset - kNodeHeader - 8) / entry) return 0;
+        return node + kNodeHeader + 8;
+    }
+
+    /* Bytes and length of a string node, null if it is not one. */
+    const char* String(uint64_t offset, uint64_t& length) const {
+        const char* node = At(offset, kNodeHeader + 8);
+        if (node == 0 || Load32(node) != kString) return 0;
+        length = Load64(node + kNodeHeader);
+        if (length >= size - offset - kNodeHeader - 8) return 0;
+        const char* bytes = node + kNodeHeader + 8;
+        return bytes[length] == '\0' ? bytes : 0;
+    }
+
+    const char* data;
+    size_t size;
+};
+
+/*!
+ * default no param constructor. An empty view; every getter fails.
+ * */
+JsonBinaryView::JsonBinaryView() : m_Offset(0) {}
+
+JsonBinaryView::JsonBinaryView(const std::shared_ptr<const Mapping>& mapping,
+                               uint64_t offset)
+    : m_Mapping(mapping), m_Offset(offset) {}
+
+/*
+ * Offset of the value stored under key, found by binary search of the key
+ * ordered index of the object node.
+ * */
+bool JsonBinaryView::Find(const std::string& key, uint64_t& offset) const {
+    if (!m_Mapping) return false;
+    const Mapping& mapping = *m_Mapping;
+    uint64_t count;
+    const char* members = mapping.Entries(m_Offset, kObject, 24, count);
+    if (members == 0) return false;
+    const char* order = members + count * 16;
+
+    const char* wanted = key.c_str();
+    size_t wantedLen = strlen(wanted);
+    uint64_t low = 0, high = count;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        uint64_t index = Load64(order + mid * 8);
+        if (index >= count) return false;
+        const char* member = members + index * 16;
+
+        uint64_t length;
+        const char* name = mapping.String(Load64(member), length);
+        if (name == 0) return false;
+        int cmp = memcmp(name, wanted, std::min<uint64_t>(length, wantedLen));
+        if (cmp == 0 && length != wantedLen) cmp = length < wantedLen ? -1 : 1;
+
+        if (cmp == 0) {
+            offset = Load64(member + 8);
+            return mapping.Type(offset) != kInvalid;
+        }
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return false;
+}
+
+/*
+ * Offset and size of the array under key, or of this node for "", as
+ * JsonSerializer::GetCollection finds it.
+ * */
+bool JsonBinaryView::FindArray(const std::string& key, uint64_t& offset,
+                               uint64_t& count) const {
+    if (!m_Mapping) return false;
+    offset = m_Offset;
+    if (!key.empty() && !Find(key, offset)) return false;
+    return m_Mapping->Entries(offset, kArray, 8, count) != 0;
+}
+
+/*!
+ * GetValue function. Given a string key, this looks through the mapped
+ * object and returns a string value if found.
+ * @param const reference to string which is the key to look for in the
+ * current node.
+ * @param reference to string. The value found is returned in this variable.
+ * @return bool. True if the key exists and holds a string. Otherwise false.
+ * */
+bool JsonBinaryView::GetValue(const std::string& key,
+                              std::string& value) const {
+    uint64_t offset, length;
+    if (!Find(key, offset)) return false;
+    const char* bytes = m_Mapping->String(offset, length);
+    if (bytes == 0) return false;
+    value.assign(bytes);
+    return true;
+}
+
+/*!
+ * GetObject function. Given a string key, this retrieves a view of the node
+ * that is nested under this key.
+ * @param const reference to string which is the key to look for in the
+ * current node.
+ * @param reference to JsonBinaryView. The nested node is passed on to this
+ * variable.
+ * @return bool. True if the value exists. Otherwise false.
+ * */
+bool JsonBinaryView::GetObject(const std::string& key,
+                               JsonBinaryView& view) const {
+    uint64_t offset;
+    if (!Find(key, offset)) return false;
+    view = JsonBinaryView(m_Mapping, offset);
+    return true;
+}
+
+/*!
+ * GetCollection function. Given a string key, this retrieves a view of
+ * every element of the array nested under this key.
+ * @param const reference to string which is the key to look for in the
+ * current node, "" for the node itself.
+ * @param reference to a vector of views the elements are added to.
+ * @return bool. True if the key exists and holds an array. Otherwise false.
+ * */
+bool JsonBinaryView::GetCollection(const std::string& key,
+                                   std::vector<JsonBinaryView>& vec) const {
+    uint64_t offset, count;
+    if (!FindArray(key, offset, count)) return false;
+    const char* items = m_Mapping->Entries(offset, kArray, 8, count);
+
+    vec.reserve(vec.size() + count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t item = Load64(items + i * 8);
+        if (m_Mapping->Type(item) == kInvalid) return false;
+        vec.push_back(JsonBinaryView(m_Mapping, item));
+    }
+    return true;
+}
+
+/*!
+ * GetStringCollection function. Given a string key, this retrieves the array
+ * of strings nested under this key, as JsonSerializer::GetStringCollection
+ * does.
+ * @param const reference to string which is the key to look for in the
+ * current node, "" for the node itself.
+ * @param reference to a set of strings the strings are added to.
+ * @param int limit. After getting upto the limit, no more will be pulled out.
+ * @return bool. True if the key exists and holds an array of strings.
+ * Otherwise false.
+ * */
+bool JsonBinaryView::GetStringCollection(const std::string& key,
+                                         std::set<std::string>& collection,
+                                         int limit) const {
+    uint64_t offset, count;
+    if (!FindArray(key, offset, count)) return false;
+    const char* items = m_Mapping->Entries(offset, kArray, 8, count);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (limit != DEFAULT_LIMIT_GET_COLLECTION &&
+            i == (uint64_t)(limit - 1)) {
+            break;
+        }
+        uint64_t length;
+        const char* bytes = m_Mapping->String(Load64(items + i * 8), length);
+        if (bytes == 0) return false;
+        collection.insert(bytes);
+    }
+    return true;
+}
+
+/*!
+ * Materialize function. Copies the node and everything below it into a new
+ * jansson document, e.g. to modify it or to stream it.
+ * @param reference to the serializer that gets the copy.
+ * @return bool. True if the node could be copied. Otherwise false.
+ * */
+bool JsonBinaryView::Materialize(JsonSerializer& serializer) const {
+    serializer.Clear();
+    if (m_Mapping == 0) return false;
+    uint64_t budget = m_Mapping->size / kNodeHeader;
+    json_t* json = Build(m_Offset, 0, budget);
+    if (json == 0) return false;
+    return serializer.Attach(json);
+}
+
+/* Every node built counts against budget, at most one per 8 bytes of the
+ * file, and a container's entries must lie below it, so a damaged file
+ * that refers to a node twice or back up the tree is refused. */
+json_t* JsonBinaryView::Build(uint64_t offset, int depth,
+                              uint64_t& budget) const {
+    const Mapping& mapping = *m_Mapping;
+    if (budget == 0) return 0;
+    --budget;
+    switch (mapping.Type(offset)) {
+        case kNull:
+            return json_null();
+        case kTrue:
+            return json_true();
+        case kFalse:
+            return json_false();
+        case kInteger: {
+            const char* node = mapping.At(offset, kNodeHeader + 8);
+            return node ? json_integer((json_int_t)(int64_t)Load64(
+                              node + kNodeHeader))
+                        : 0;
+        }
+        case kReal: {
+            const char* node = mapping.At(offset, kNodeHeader + 8);
+            if (node == 0) return 0;
+            double value;
+            memcpy(&value, node + kNodeHeader, sizeof(value));
+            return json_real(value);
+        }
+        case kString: {
+            uint64_t length;
+            const char* bytes = mapping.String(offset, length);
+            return bytes ? json_stringn(bytes, length) : 0;
+        }
+        default:
+            break;
+    }
+
+    if (++depth > BINARY_STORE_MAX_DEPTH) return 0;
+
+    uint64_t count;
+    const char* items = mapping.Entries(offset, kArray, 8, count);
+    if (items) {
+        json_t* array = json_array();
+        for (uint64_t i = 0; array && i < count; ++i) {
+            uint64_t child = Load64(items + i * 8);
+            json_t* item =
+                child < offset ? Build(child, depth, budget) : 0;
+            if (item == 0 || json_array_append_new(array, item) == -1) {
+                json_decref(array);
+                array = 0;
+            }
+        }
+        return array;
+    }
+
+    const char* members = mapping.Entries(offset, kObject, 24, count);
+    if (members == 0) return 0;
+    json_t* object = json_object();
+    for (uint64_t i = 0; object && i < count; ++i) {
+        uint64_t length;
+        uint64_t keyOffset = Load64(members + i * 16);
+        uint64_t child = Load64(members + i * 16 + 8);
+        const char* key =
+            keyOffset < offset ? mapping.String(keyOffset, length) : 0;
+        json_t* value =
+            key && child < offset ? Build(child, depth, budget) : 0;
+        if (value == 0 || json_object_set_new(object, key, value) == -1) {
+            json_decref(object);
+            object = 0;
+        }
+    }
+    return object;
+}
+
+/* A node whose payload is not inside the file is treated as none. */
+JsonBinaryView::Item::Item(const JsonBinaryView& view, uint64_t offset)
+    : m_View(view), m_Offset(offset), m_Type(view.m_Mapping->Type(offset)) {
+    uint64_t length;
+    if (m_Type == kInteger || m_Type == kReal) {
+        if (!view.m_Mapping->At(offset, kNodeHeader + 8)) m_Type = kInvalid;
+    } else if (m_Type == kString) {
+        if (!view.m_Mapping->String(offset, length)) m_Type = kInvalid;
+    }
+}
+
+bool JsonBinaryView::Item::IsInteger() const { return m_Type == kInteger; }
+
+bool JsonBinaryView::Item::IsReal() const { return m_Type == kReal; }
+
+bool JsonBinaryView::Item::IsString() const { return m_Type == kString; }
+
+bool JsonBinaryView::Item::IsBoolean() const {
+    return m_Type == kTrue || m_Type == kFalse;
+}
+
+long long JsonBinaryView::Item::Integer() const {
+    const char* node = m_View.m_Mapping->At(m_Offset, kNodeHeader + 8);
+    return (long long)(int64_t)Load64(node + kNodeHeader);
+}
+
+double JsonBinaryView::Item::Real() const {
+    const char* node = m_View.m_Mapping->At(m_Offset, kNodeHeader + 8);
+    double value;
+    memcpy(&value, node + kNodeHeader, sizeof(value));
+    return value;
+}
+
+const char* JsonBinaryView::Item::String() const {
+    uint64_t length;
+    const char* bytes = m_View.m_Mapping->String(m_Offset, length);
+    return bytes ? bytes : "";
+}
+
+size_t JsonBinaryView::Item::Length() const {
+    uint64_t length = 0;
+    m_View.m_Mapping->String(m_Offset, length);
+    return length;
+}
+
+int JsonBinaryView::Item::Boolean() const { return m_Type == kTrue; }
+
+bool JsonBinaryView::Item::Dump(std::string& out) const {
+    uint64_t budget = m_View.m_Mapping->size / kNodeHeader;
+    json_t* json = m_View.Build(m_Offset, 0, budget);
+    if (json == 0) return false;
+    bool ok = JsonNodeItem(json).Dump(out);
+    json_decref(json);
+    return ok;
+}
+
+/*!
+ * default no param constructor
+ * */
+JsonBinaryStore::JsonBinaryStore() : m_Root(0) {}
+
+/*!
+ * Destructor. Views taken from the store keep the file mapped.
+ * */
+JsonBinaryStore::~JsonBinaryStore() { Close(); }
+
+/*!
+ * Compile function. Writes the json of a serializer to a binary store file.
+ * An existing file is replaced atomically.
+ * @param const reference to the serializer.
+ * @param const reference to the path of the file.
+ * @return bool. True if the serializer holds json and the file was written.
+ * Otherwise false.
+ * */
+bool JsonBinaryStore::Compile(const JsonSerializer& json,
+                              const std::string& path) {
+    json.Sync();
+    if (!json.m_Json) return false;
+
+    BinaryWriter writer;
+    std::string image;
+    return writer.Finish(json.m_Json, image) && WriteFile(path, image);
+}
+
+/*!
+ * Open function. Maps a binary store file read-only. Nothing but the header
+ * is read.
+ * @param const reference to the path of the file.
+ * @return bool. True if the file is a binary store of this machine's byte
+ * order and could be mapped. Otherwise false.
+ * */
+bool JsonBinaryStore::Open(const std::string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(BinaryHeader)) {
+        close(fd);
+        return false;
+    }
+
+    std::shared_ptr<JsonBinaryView::Mapping> mapping =
+        std::make_shared<JsonBinaryView::Mapping>();
+    void* data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    mapping->data = (const char*)data;
+    mapping->size = info.st_size;
+
+    BinaryHeader header;
+    memcpy(&header, mapping->data, sizeof(header));
+    if (memcmp(header.magic, BINARY_STORE_MAGIC, 4) != 0 ||
+        header.byteOrder != BINARY_STORE_BYTE_ORDER ||
+        header.version != BINARY_STORE_VERSION ||
+        header.size != mapping->size ||
+        mapping->Type(header.root) == kInvalid) {
+        return false;
+    }
+
+    m_Mapping = mapping;
+    m_Root = header.root;
+    return true;
+}
+
+/*!
+ * Close function. Releases the store's hold on the mapping.
+ * */
+void JsonBinaryStore::Close() {
+    m_Mapping.reset();
+    m_Root = 0;
+}
+
+/*!
+ * Root function.
+ * @param reference to the view that gets the root node.
+ * @return bool. True if a store is open. Otherwise false.
+ * */
+bool JsonBinaryStore::Root(JsonBinaryView& view) const {
+    if (!m_Mapping) return false;
+    view = JsonBinaryView(m_Mapping, m_Root);
+    return true;
+}
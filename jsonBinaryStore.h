@@ -0,0 +1,124 @@
+/*!
+ * @file jsonBinaryStore.h
+ * @brief This contains the classes that compile the json of a JsonSerializer
+ * into a binary file and read it back through a read-only memory mapping.
+ * Details. Large reference documents that are loaded at every start can be
+ * compiled once with JsonBinaryStore::Compile. Opening the file maps it
+ * without reading or parsing it; nodes are found by following offsets and
+ * read in place, so pages are only touched when a value on them is asked for
+ * and the mapping is shared through the page cache by every process that
+ * opens the same file. JsonBinaryView offers the read side of the
+ * JsonSerializer API on the mapped nodes.
+ * Every offset is checked against the size of the file before it is
+ * followed, so a damaged file makes getters fail rather than read outside
+ * the mapping. Files are written in the byte order of the machine compiling
+ * them and are refused on a machine with the other byte order.
+ * $Id$
+ * */
+
+#ifndef JSONBINARYSTORE_H
+#define JSONBINARYSTORE_H
+
+#include <stdint.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "public/JSonSerializer.h"
+
+/* Read-only handle to one node of an opened JsonBinaryStore. The mapping
+ * stays valid as long as any view of it exists. */
+class JsonBinaryView {
+   public:
+    JsonBinaryView();
+
+    bool GetValue(const std::string& key, std::string& value) const;
+    bool GetObject(const std::string& key, JsonBinaryView& view) const;
+    bool GetCollection(const std::string& key,
+                       std::vector<JsonBinaryView>& vec) const;
+    bool GetStringCollection(const std::string& key,
+                             std::set<std::string>& collection,
+                             int limit = DEFAULT_LIMIT_GET_COLLECTION) const;
+    bool Materialize(JsonSerializer& serializer) const;
+
+    /*!
+     * GetValue is a template function that gets the value out of the mapped
+     * node and converts it to the right type, exactly as
+     * JsonSerializer::GetValue does.
+     * @param const reference to string which is the key to look for in the
+     * current node.
+     * @param reference to value of the required type. The value found is
+     * returned in this variable.
+     * @param reference to function pointer which is used by istringstream to
+     * convert the string value to correct type.
+     * @return bool. True if the value exists and can be converted to the type
+     * desired. Otherwise false.
+     * */
+    template <typename T>
+    bool GetValue(const std::string& key, T& value,
+                  std::ios_base& (*f)(std::ios_base&) = std::dec) const {
+        uint64_t offset;
+        if (!Find(key, offset)) return false;
+        return JsonSerializer::ConvertValue(Item(*this, offset), value, f);
+    }
+
+   private:
+    friend class JsonBinaryStore;
+
+    struct Mapping;
+
+    /* Read access to one mapped node, for the conversions of GetValue. */
+    class Item {
+       public:
+        Item(const JsonBinaryView& view, uint64_t offset);
+
+        bool IsInteger() const;
+        bool IsReal() const;
+        bool IsString() const;
+        bool IsBoolean() const;
+        long long Integer() const;
+        double Real() const;
+        const char* String() const;
+        size_t Length() const;
+        int Boolean() const;
+        bool Dump(std::string& out) const;
+
+       private:
+        const JsonBinaryView& m_View;
+        uint64_t m_Offset;
+        uint32_t m_Type;
+    };
+
+    JsonBinaryView(const std::shared_ptr<const Mapping>& mapping,
+                   uint64_t offset);
+    bool Find(const std::string& key, uint64_t& offset) const;
+    bool FindArray(const std::string& key, uint64_t& offset,
+                   uint64_t& count) const;
+    json_t* Build(uint64_t offset, int depth, uint64_t& budget) const;
+
+    /* members */
+    std::shared_ptr<const Mapping> m_Mapping;
+    uint64_t m_Offset;
+};
+
+class JsonBinaryStore {
+   public:
+    JsonBinaryStore();
+    ~JsonBinaryStore();
+
+    static bool Compile(const JsonSerializer& json, const std::string& path);
+    bool Open(const std::string& path);
+    void Close();
+    bool Root(JsonBinaryView& view) const;
+
+   private:
+    JsonBinaryStore(const JsonBinaryStore&);
+    JsonBinaryStore& operator=(const JsonBinaryStore&);
+
+    /* members */
+    std::shared_ptr<const JsonBinaryView::Mapping> m_Mapping;
+    uint64_t m_Root;
+};
+
+#endif  // JSONBINARYSTORE_H
@@ -0,0 +1,208 @@
+/*!
+ * @file jsonDocumentCache.cpp
+ * @brief This contains the cache of parsed documents that can be put in
+ * front of JsonSerializer::Parse.
+ * Details. See jsonDocumentCache.h. Parsing happens outside the shard lock,
+ * so one slow parse does not hold up hits on other documents of the shard.
+ * $Id$
+ * */
+
+#include "jsonDocumentCache.h"
+#include "jsonNodeCache.h"
+
+#include <string.h>
+
+namespace {
+
+const uint64_t kSeedDocument = 0x646F63756D656E74ULL;
+
+}  // namespace
+
+/*!
+ * Constructor.
+ * @param size_t capacity. Most documents kept at once, spread over the
+ * shards. 0 disables caching; every Parse then parses.
+ * @param unsigned int shards. Number of independently locked shards, 0 for
+ * DOCUMENT_CACHE_SHARDS.
+ * */
+JsonDocumentCache::JsonDocumentCache(size_t capacity, unsigned int shards) {
+    if (shards == 0) shards = DOCUMENT_CACHE_SHARDS;
+    if (capacity != 0 && shards > capacity) shards = capacity;
+    m_ShardCapacity = (capacity + shards - 1) / shards;
+    for (unsigned int i = 0; i < shards; ++i) {
+        m_Shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+/*!
+ * Destructor. Handles given out stay valid.
+ * */
+JsonDocumentCache::~JsonDocumentCache() {}
+
+/*!
+ * Parse function. Same as JsonSerializer::Parse, but an input seen before
+ * with the same flags and options is not parsed again.
+ * @param const reference to a string which contains the json formatted data
+ * stream.
+ * @param reference to the serializer that receives a copy-on-write clone of
+ * the document.
+ * @param size_t flags. jansson decode flags, e.g. JSON_DECODE_ANY.
+ * @param int options. JsonSerializer::ParseOptions combined with |. Of the
+ * flags, only JSON_REJECT_DUPLICATES and JSON_DECODE_ANY can be combined
+ * with options; they are taken as kRejectDuplicates and kDecodeAny.
+ * @return bool. True if the data is in correct format and we could create a
+ * json object from it. False otherwise
+ * */
+bool JsonDocumentCache::Parse(const std::string& instr,
+                              JsonSerializer& serializer, size_t flags,
+                              int options) {
+    /* like json_loads, the input ends at its first null character. */
+    return Parse(instr.c_str(), strlen(instr.c_str()), serializer, flags,
+                 options);
+}
+
+/*!
+ * Parse function. Same as above, for a byte range.
+ * @param const pointer to the json formatted data stream.
+ * @param size_t length of the data stream.
+ * @param reference to the serializer that receives a copy-on-write clone of
+ * the document.
+ * @param size_t flags. jansson decode flags, e.g. JSON_DECODE_ANY.
+ * @param int options. As above.
+ * @return bool. True if the data is in correct format and we could create a
+ * json object from it. False otherwise
+ * */
+bool JsonDocumentCache::Parse(const char* data, size_t len,
+                              JsonSerializer& serializer, size_t flags,
+                              int options) {
+    serializer.Clear();
+    if (data == 0) return false;
+    if (options) {
+        if (flags & ~(size_t)(JSON_REJECT_DUPLICATES | JSON_DECODE_ANY)) {
+            return false;
+        }
+        if (flags & JSON_REJECT_DUPLICATES) {
+            options |= JsonSerializer::kRejectDuplicates;
+        }
+        if (flags & JSON_DECODE_ANY) options |= JsonSerializer::kDecodeAny;
+        flags = 0;
+    }
+
+    uint64_t key = JsonNodeCache::HashBytes(
+        data, len, kSeedDocument ^ flags ^ ((uint64_t)options << 32));
+    Shard& shard = *m_Shards[key % m_Shards.size()];
+    if (Lookup(shard, key, data, len, flags, options, serializer)) return true;
+
+    JsonSerializer document;
+    if (options) {
+        /* the source text the options keep is seeded into the document's
+         * cache, which every clone handed out shares. */
+        if (!document.Parse(std::string(data, len), options)) return false;
+    } else {
+        json_t* json = json_loadb(data, len, flags, NULL);
+        if (json == 0) return false;
+        document.Attach(json);
+    }
+    serializer = document.DeepClone(true);
+    if (m_ShardCapacity == 0) return true;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+        shard.index.find(key);
+    if (it != shard.index.end()) {
+        /* another thread parsed the same input meanwhile, or a different
+         * input hashed alike; the newer one takes the slot. */
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+    }
+
+    shard.entries.push_front(Entry());
+    Entry& entry = shard.entries.front();
+    entry.key = key;
+    entry.flags = flags;
+    entry.options = options;
+    entry.bytes.assign(data, len);
+    entry.document = document;
+    shard.index[key] = shard.entries.begin();
+
+    while (shard.entries.size() > m_ShardCapacity) {
+        shard.index.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+        ++shard.evictions;
+    }
+    return true;
+}
+
+/*
+ * Hands out the cached document for the input, if there is one, and counts
+ * the hit or miss.
+ * */
+bool JsonDocumentCache::Lookup(Shard& shard, uint64_t key, const char* data,
+                               size_t len, size_t flags, int options,
+                               JsonSerializer& serializer) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+        shard.index.find(key);
+    if (it != shard.index.end()) {
+        Entry& entry = *it->second;
+        if (entry.flags == flags && entry.options == options &&
+            entry.bytes.size() == len &&
+            memcmp(entry.bytes.data(), data, len) == 0) {
+            shard.entries.splice(shard.entries.begin(), shard.entries,
+                                 it->second);
+            serializer = entry.document.DeepClone(true);
+            ++shard.hits;
+            return true;
+        }
+    }
+    ++shard.misses;
+    return false;
+}
+
+/*!
+ * Stats function. Counters summed over all shards since construction.
+ * @return JsonDocumentCacheStats.
+ * */
+JsonDocumentCacheStats JsonDocumentCache::Stats() const {
+    JsonDocumentCacheStats stats = {0, 0, 0, 0};
+    for (size_t i = 0; i < m_Shards.size(); ++i) {
+        Shard& shard = *m_Shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.entries.size();
+    }
+    return stats;
+}
+
+/*!
+ * Clear function. Drops every cached document. Handles given out stay valid
+ * and the counters are kept.
+ * */
+void JsonDocumentCache::Clear() {
+    for (size_t i = 0; i < m_Shards.size(); ++i) {
+        Shard& shard = *m_Shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.index.clear();
+        shard.entries.clear();
+    }
+}
+
+/*!
+ * function Parse. Same as Parse, through a cache of parsed documents. The
+ * serializer receives a copy-on-write clone of a document it may share with
+ * other callers; modifying it, or any handle taken from it, copies the tree
+ * first.
+ * @param const reference to a string which contains the json formatted data
+ * stream.
+ * @param reference to the cache to look the data up in.
+ * @param int options. ParseOptions combined with |, as for Parse. Parses with
+ * different options are cached apart.
+ * @return bool. True if the data is in correct format and we could create a
+ * json object from it.False otherwise
+ * */
+bool JsonSerializer::Parse(const std::string& instr, JsonDocumentCache& cache,
+                           int options) {
+    return cache.Parse(instr, *this, 0, options);
+}
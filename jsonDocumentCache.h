@@ -0,0 +1,85 @@
+/*!
+ * @file jsonDocumentCache.h
+ * @brief This contains the cache of parsed documents that can be put in
+ * front of JsonSerializer::Parse.
+ * Details. Services that receive the same json again and again (config
+ * polls, heartbeats, repeated requests) can parse through a JsonDocumentCache
+ * instead. Inputs are keyed by a content hash of their bytes and the parse
+ * flags and options; a repeated input is answered with a copy-on-write clone
+ * of the document parsed the first time, so readers share its nodes and a
+ * clone that is modified copies them first. The cache is split into shards,
+ * each with its own lock and least recently used list.
+ * NOTE: handles to one document used from several threads change the
+ * reference counts of shared jansson nodes concurrently, which needs a
+ * jansson built with atomic reference counting (2.11 or later).
+ * $Id$
+ * */
+
+#ifndef JSONDOCUMENTCACHE_H
+#define JSONDOCUMENTCACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "public/JSonSerializer.h"
+
+/* Shards used when the constructor is not told how many. */
+#define DOCUMENT_CACHE_SHARDS 16
+
+/* Counters reported by JsonDocumentCache::Stats. */
+struct JsonDocumentCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+};
+
+class JsonDocumentCache {
+   public:
+    explicit JsonDocumentCache(size_t capacity, unsigned int shards = 0);
+    ~JsonDocumentCache();
+
+    bool Parse(const std::string& instr, JsonSerializer& serializer,
+               size_t flags = 0, int options = 0);
+    bool Parse(const char* data, size_t len, JsonSerializer& serializer,
+               size_t flags = 0, int options = 0);
+    JsonDocumentCacheStats Stats() const;
+    void Clear();
+
+   private:
+    JsonDocumentCache(const JsonDocumentCache&);
+    JsonDocumentCache& operator=(const JsonDocumentCache&);
+
+    struct Entry {
+        uint64_t key;
+        size_t flags;
+        int options;
+        std::string bytes;
+        JsonSerializer document;
+    };
+
+    struct Shard {
+        Shard() : hits(0), misses(0), evictions(0) {}
+
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    bool Lookup(Shard& shard, uint64_t key, const char* data, size_t len,
+                size_t flags, int options, JsonSerializer& serializer);
+
+    /* members */
+    size_t m_ShardCapacity;
+    std::vector<std::unique_ptr<Shard> > m_Shards;
+};
+
+#endif  // JSONDOCUMENTCACHE_H
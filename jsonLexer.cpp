@@ -0,0 +1,113 @@
+/*!
+ * @file jsonLexer.cpp
+ * @brief Token level scanner of json text.
+ * Details. See jsonLexer.h.
+ * $Id$
+ * */
+
+#include "jsonLexer.h"
+
+#include <string.h>
+
+#include <jansson.h>
+
+namespace {
+
+inline bool IsHexDigit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+           (c >= 'A' && c <= 'F');
+}
+
+inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+}  // namespace
+
+/*
+ * Steps over a string token. escaped is set if it holds any escape, i.e. if
+ * its raw bytes are not its value.
+ * */
+bool JsonLexer::SkipString(bool& escaped) {
+    escaped = false;
+    if (m_Pos == m_Len || m_Data[m_Pos] != '"') return false;
+    for (++m_Pos; m_Pos < m_Len; ++m_Pos) {
+        unsigned char c = m_Data[m_Pos];
+        if (c == '"') {
+            ++m_Pos;
+            return true;
+        }
+        if (c < 0x20) return false;
+        if (c != '\\') continue;
+
+        escaped = true;
+        if (++m_Pos == m_Len) return false;
+        c = m_Data[m_Pos];
+        if (c == 'u') {
+            if (m_Len - m_Pos < 5) return false;
+            for (int i = 1; i <= 4; ++i) {
+                if (!IsHexDigit(m_Data[m_Pos + i])) return false;
+            }
+            m_Pos += 4;
+        } else if (!strchr("\"\\/bfnrt", c) || c == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool JsonLexer::SkipDigits() {
+    size_t begin = m_Pos;
+    while (m_Pos < m_Len && IsDigit(m_Data[m_Pos])) ++m_Pos;
+    return m_Pos != begin;
+}
+
+bool JsonLexer::SkipNumber() {
+    if (m_Pos < m_Len && m_Data[m_Pos] == '-') ++m_Pos;
+    if (m_Pos < m_Len && m_Data[m_Pos] == '0') {
+        ++m_Pos;
+    } else if (!SkipDigits()) {
+        return false;
+    }
+    if (m_Pos < m_Len && m_Data[m_Pos] == '.') {
+        ++m_Pos;
+        if (!SkipDigits()) return false;
+    }
+    if (m_Pos < m_Len && (m_Data[m_Pos] == 'e' || m_Data[m_Pos] == 'E')) {
+        ++m_Pos;
+        if (m_Pos < m_Len && (m_Data[m_Pos] == '+' || m_Data[m_Pos] == '-')) {
+            ++m_Pos;
+        }
+        if (!SkipDigits()) return false;
+    }
+    return true;
+}
+
+bool JsonLexer::SkipLiteral(const char* literal) {
+    size_t n = strlen(literal);
+    if (m_Len - m_Pos < n || memcmp(m_Data + m_Pos, literal, n) != 0) {
+        return false;
+    }
+    m_Pos += n;
+    return true;
+}
+
+/*
+ * Reads an object key. Keys without escapes, by far the common case, are
+ * copied as they are; the others are decoded by jansson.
+ * */
+bool JsonLexer::ReadKey(std::string& key) {
+    SkipSpace();
+    size_t begin = m_Pos;
+    bool escaped;
+    if (!SkipString(escaped)) return false;
+    if (!escaped) {
+        key.assign(m_Data + begin + 1, m_Pos - begin - 2);
+        return true;
+    }
+
+    json_t* json =
+        json_loadb(m_Data + begin, m_Pos - begin, JSON_DECODE_ANY, NULL);
+    if (json == 0) return false;
+    key.assign(json_string_value(json), json_string_length(json));
+    json_decref(json);
+    return true;
+}
@@ -0,0 +1,53 @@
+/*!
+ * @file jsonLexer.h
+ * @brief Token level scanner of json text used by the parsers that do not go
+ * through json_loads.
+ * Details. Tokens are checked against the JSON grammar and stepped over
+ * without allocating anything. Strings are not checked for valid UTF-8 and
+ * escapes are not decoded; that is left to jansson for the values that are
+ * kept.
+ * $Id$
+ * */
+
+#ifndef JSONLEXER_H
+#define JSONLEXER_H
+
+#include <stddef.h>
+#include <string>
+
+class JsonLexer {
+   public:
+    JsonLexer(const char* data, size_t len)
+        : m_Data(data), m_Len(len), m_Pos(0) {}
+
+   protected:
+    void SkipSpace() {
+        while (m_Pos < m_Len) {
+            char c = m_Data[m_Pos];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+            ++m_Pos;
+        }
+    }
+
+    bool Expect(char c) {
+        SkipSpace();
+        if (m_Pos == m_Len || m_Data[m_Pos] != c) return false;
+        ++m_Pos;
+        return true;
+    }
+
+    bool SkipString(bool& escaped);
+    bool SkipNumber();
+    bool SkipLiteral(const char* literal);
+    bool ReadKey(std::string& key);
+
+    /* members */
+    const char* m_Data;
+    size_t m_Len;
+    size_t m_Pos;
+
+   private:
+    bool SkipDigits();
+};
+
+#endif  // JSONLEXER_H
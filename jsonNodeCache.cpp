@@ -0,0 +1,699 @@
+/*!
+ * @file jsonNodeCache.cpp
+ * @brief Per document cache of values derived from jansson nodes.
+ * Details. See jsonNodeCache.h. Hashes are memoised for containers only;
+ * scalars are cheaper to hash again than to look up. Dump produces exactly
+ * what json_dumps(JSON_COMPACT | JSON_ENCODE_ANY) does, unless asked for
+ * shortest reals. Merged caches form a
+ * union-find forest; every operation runs on the root of its tree.
+ * $Id$
+ * */
+
+#include "jsonNodeCache.h"
+#include "jsonNumber.h"
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const uint64_t kHashMul = 0x9E3779B97F4A7C15ULL;
+
+/* Seeds keep values of different json types apart, e.g. 1 and "1". */
+const uint64_t kSeedNull = 0x6E756C6C00000001ULL;
+const uint64_t kSeedTrue = 0x7472756500000002ULL;
+const uint64_t kSeedFalse = 0x66616C7300000003ULL;
+const uint64_t kSeedInteger = 0x696E746500000004ULL;
+const uint64_t kSeedReal = 0x7265616C00000005ULL;
+const uint64_t kSeedString = 0x7374726900000006ULL;
+const uint64_t kSeedArray = 0x6172726100000007ULL;
+const uint64_t kSeedObject = 0x6F626A6500000008ULL;
+const uint64_t kSeedKey = 0x6B65790000000009ULL;
+
+inline uint64_t Rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+/* 64 bit finaliser from MurmurHash3. */
+inline uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Little endian load, so that hashes do not depend on the host byte order. */
+inline uint64_t Load64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+inline bool IsContainer(const json_t* json) {
+    return json_is_object(json) || json_is_array(json);
+}
+
+/* String escaping of jansson's dump without JSON_ENSURE_ASCII. */
+void EncodeString(const char* s, size_t len, std::string& out) {
+    static const char kHex[] = "0123456789ABCDEF";
+    out += '"';
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        out.append(s + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\b':
+                out += "\\b";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                out += "\\u00";
+                out += kHex[c >> 4];
+                out += kHex[c & 0xF];
+                break;
+        }
+    }
+    out.append(s + run, len - run);
+    out += '"';
+}
+
+void EncodeScalar(const json_t* json, bool shortest, std::string& out) {
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            out += "null";
+            break;
+        case JSON_TRUE:
+            out += "true";
+            break;
+        case JSON_FALSE:
+            out += "false";
+            break;
+        case JSON_INTEGER: {
+            char buffer[JSON_NUMBER_BUFFER_SIZE];
+            out.append(buffer,
+                       FormatJsonInteger(json_integer_value(json), buffer));
+            break;
+        }
+        case JSON_REAL: {
+            char buffer[JSON_NUMBER_BUFFER_SIZE];
+            out.append(buffer, FormatJsonReal(json_real_value(json), shortest,
+                                              buffer));
+            break;
+        }
+        case JSON_STRING:
+            EncodeString(json_string_value(json), json_string_length(json),
+                         out);
+            break;
+        default:
+            break;
+    }
+}
+
+}  // namespace
+
+/*!
+ * Constructor. The cache keeps a reference to the root of its document so
+ * that no node it has memoised can be freed, and its address reused, while
+ * the cache is alive.
+ * @param pointer to the root of the document. May be null.
+ * @param bool memoise. False for a document whose handles may not all share
+ * this cache, see the note in jsonNodeCache.h.
+ * */
+JsonNodeCache::JsonNodeCache(json_t* root, bool memoise)
+    : m_PrunedRoots(0),
+      m_ShortestReals(false),
+      m_Memoise(memoise),
+      m_DetachedNumbers(0),
+      m_HasNumbers(false) {
+    if (root) m_Roots.push_back(json_incref(root));
+}
+
+/*!
+ * Destructor
+ * */
+JsonNodeCache::~JsonNodeCache() {
+    for (size_t i = 0; i < m_Roots.size(); ++i) json_decref(m_Roots[i]);
+    for (std::unordered_map<const json_t*, std::string>::iterator it =
+             m_Numbers.begin();
+         it != m_Numbers.end(); ++it) {
+        json_decref(const_cast<json_t*>(it->first));
+    }
+}
+
+/*!
+ * HashBytes function. Word at a time hash of a byte range.
+ * @param pointer to the data.
+ * @param size_t length of the data.
+ * @param uint64_t seed.
+ * @return uint64_t. The hash, stable across runs and platforms.
+ * */
+uint64_t JsonNodeCache::HashBytes(const void* data, size_t len,
+                                  uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (len * kHashMul);
+
+    for (; len >= 8; len -= 8, p += 8) {
+        h = Rotl((h ^ Load64(p)) * kHashMul, 31);
+    }
+
+    uint64_t tail = 0;
+    for (size_t i = len; i > 0; --i) tail = (tail << 8) | p[i - 1];
+    return Mix(h ^ tail);
+}
+
+std::shared_ptr<JsonNodeCache> JsonNodeCache::Resolve(
+    std::shared_ptr<JsonNodeCache> cache) {
+    for (;;) {
+        std::shared_ptr<JsonNodeCache> next =
+            std::atomic_load(&cache->m_Merged);
+        if (!next) return cache;
+        cache = next;
+    }
+}
+
+JsonNodeCache* JsonNodeCache::Resolve() {
+    /* each cache in the chain is owned by the m_Merged of the one before. */
+    JsonNodeCache* cache = this;
+    for (;;) {
+        std::shared_ptr<JsonNodeCache> next =
+            std::atomic_load(&cache->m_Merged);
+        if (!next) return cache;
+        cache = next.get();
+    }
+}
+
+/*!
+ * Hash function. Content hash of a node. Equal values (in the json_equal
+ * sense) hash equally: object members are combined independent of their
+ * order. Container hashes are memoised until the container is invalidated.
+ * @param pointer to a node of this document.
+ * @return uint64_t. The hash.
+ * */
+uint64_t JsonNodeCache::Hash(const json_t* json) {
+    JsonNodeCache* cache = Resolve();
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    return cache->HashNode(json);
+}
+
+/*!
+ * PeekHash function. Looks up a memoised hash without computing it.
+ * @param pointer to a node of this document.
+ * @param reference to uint64_t. The hash is returned in this variable.
+ * @return bool. True if the hash of the node was memoised.
+ * */
+bool JsonNodeCache::PeekHash(const json_t* json, uint64_t& hash) {
+    JsonNodeCache* cache = Resolve();
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    std::unordered_map<const json_t*, uint64_t>::const_iterator it =
+        cache->m_Hashes.find(json);
+    if (it == cache->m_Hashes.end()) return false;
+    hash = it->second;
+    return true;
+}
+
+uint64_t JsonNodeCache::HashNode(const json_t* json) {
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            return Mix(kSeedNull);
+        case JSON_TRUE:
+            return Mix(kSeedTrue);
+        case JSON_FALSE:
+            return Mix(kSeedFalse);
+        case JSON_INTEGER:
+            return Mix(kSeedInteger ^ (uint64_t)json_integer_value(json));
+        case JSON_REAL: {
+            /* 0.0 and -0.0 compare equal. */
+            double value = json_real_value(json) + 0.0;
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return Mix(kSeedReal ^ bits);
+        }
+        case JSON_STRING:
+            return HashBytes(json_string_value(json), json_string_length(json),
+                             kSeedString);
+        default:
+            break;
+    }
+
+    std::unordered_map<const json_t*, uint64_t>::const_iterator it =
+        m_Hashes.find(json);
+    if (it != m_Hashes.end()) return it->second;
+
+    json_t* node = const_cast<json_t*>(json);
+    uint64_t h;
+    if (json_is_array(json)) {
+        size_t sz = json_array_size(json);
+        h = kSeedArray ^ sz;
+        for (size_t i = 0; i < sz; ++i) {
+            json_t* child = json_array_get(json, i);
+            if (IsContainer(child)) Link(child, json);
+            h = Rotl((h ^ HashNode(child)) * kHashMul, 29);
+        }
+    } else {
+        /* sum of per member hashes, so member order does not matter. */
+        uint64_t sum = 0;
+        for (void* iter = json_object_iter(node); iter;
+             iter = json_object_iter_next(node, iter)) {
+            const char* key = json_object_iter_key(iter);
+            json_t* child = json_object_iter_value(iter);
+            if (IsContainer(child)) Link(child, json);
+            sum += Mix(HashBytes(key, strlen(key), kSeedKey) ^
+                       Rotl(HashNode(child), 17));
+        }
+        h = kSeedObject ^ json_object_size(json) ^ sum;
+    }
+
+    h = Mix(h);
+    if (m_Memoise) m_Hashes[json] = h;
+    return h;
+}
+
+void JsonNodeCache::Link(const json_t* child, const json_t* parent) {
+    if (!m_Memoise) return;
+    std::vector<const json_t*>& parents = m_Parents[child];
+    if (std::find(parents.begin(), parents.end(), parent) == parents.end()) {
+        parents.push_back(parent);
+    }
+}
+
+/*!
+ * Invalidate function. Drops the memoised values of a node that is about to
+ * change, and of every container that holds it.
+ * @param pointer to the node being modified.
+ * */
+void JsonNodeCache::Invalidate(const json_t* json) {
+    JsonNodeCache* cache = Resolve();
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    cache->InvalidateLocked(json);
+}
+
+void JsonNodeCache::InvalidateLocked(const json_t* json) {
+    if (m_Hashes.empty() && m_Dumps.empty()) return;
+
+    /* a node may sit in more than one container, so the walk goes up every
+     * recorded parent and not only until the first unmemoised one. */
+    std::vector<const json_t*> pending(1, json);
+    std::vector<const json_t*> seen;
+    while (!pending.empty()) {
+        const json_t* node = pending.back();
+        pending.pop_back();
+        if (std::find(seen.begin(), seen.end(), node) != seen.end()) continue;
+        seen.push_back(node);
+
+        m_Hashes.erase(node);
+        m_Dumps.erase(node);
+        std::unordered_map<const json_t*,
+                           std::vector<const json_t*> >::const_iterator it =
+            m_Parents.find(node);
+        if (it != m_Parents.end()) {
+            pending.insert(pending.end(), it->second.begin(), it->second.end());
+        }
+    }
+}
+
+/*!
+ * Purge function. Forgets a subtree that is about to be detached from its
+ * container, so a node later allocated at the same address is never mistaken
+ * for it.
+ * @param pointer to the root of the subtree being detached.
+ * */
+void JsonNodeCache::Purge(const json_t* json) {
+    if (!IsContainer(json) && !json_is_number(json)) return;
+    JsonNodeCache* cache = Resolve();
+    if (!IsContainer(json) && !cache->m_HasNumbers) return;
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    cache->PurgeLocked(json);
+}
+
+/* Nodes the cache may hold something for. */
+bool JsonNodeCache::Tracked(const json_t* json) const {
+    return IsContainer(json) || (json_is_number(json) && !m_Numbers.empty());
+}
+
+void JsonNodeCache::PurgeLocked(const json_t* json) {
+    if (m_Hashes.empty() && m_Dumps.empty() && m_Parents.empty() &&
+        m_Numbers.empty()) {
+        return;
+    }
+
+    /* each node with whether the subtree owns it and every node above it. */
+    std::vector<std::pair<const json_t*, bool> > pending;
+    pending.push_back(std::make_pair(json, true));
+    while (!pending.empty()) {
+        const json_t* node = pending.back().first;
+        bool owned = pending.back().second;
+        pending.pop_back();
+        if (!IsContainer(node)) {
+            PurgeNumberLocked(node, owned);
+            continue;
+        }
+        m_Hashes.erase(node);
+        m_Dumps.erase(node);
+
+        /* the parent links of nodes only this subtree owns die with it;
+         * shared nodes keep theirs since they stay valid elsewhere. */
+        owned = owned && node->refcount == 1;
+        if (owned) m_Parents.erase(node);
+
+        json_t* parent = const_cast<json_t*>(node);
+        if (json_is_array(parent)) {
+            for (size_t i = 0; i < json_array_size(parent); ++i) {
+                json_t* child = json_array_get(parent, i);
+                if (Tracked(child)) {
+                    pending.push_back(std::make_pair(child, owned));
+                }
+            }
+        } else {
+            for (void* iter = json_object_iter(parent); iter;
+                 iter = json_object_iter_next(parent, iter)) {
+                json_t* child = json_object_iter_value(iter);
+                if (Tracked(child)) {
+                    pending.push_back(std::make_pair(child, owned));
+                }
+            }
+        }
+    }
+    PruneNumbersLocked();
+}
+
+/*
+ * The text of a number is dropped with the number. A number still referenced
+ * elsewhere, e.g. by an undo log that may put it back, keeps its text; the
+ * reference of its entry stops a new number taking its address meanwhile.
+ * */
+void JsonNodeCache::PurgeNumberLocked(const json_t* json, bool owned) {
+    std::unordered_map<const json_t*, std::string>::iterator it =
+        m_Numbers.find(json);
+    if (it == m_Numbers.end()) return;
+    /* one reference from the container, one from the entry. */
+    if (!owned || json->refcount > 2) {
+        ++m_DetachedNumbers;
+        return;
+    }
+    m_Numbers.erase(it);
+    json_decref(const_cast<json_t*>(json));
+}
+
+/*!
+ * Dump function. Appends the compact serialisation of a node. Containers
+ * whose serialisation is cached are copied rather than encoded again.
+ * @param pointer to a node of this document.
+ * @param reference to the string the serialisation is appended to.
+ * @param bool shortestReals. If true reals are written with the fewest
+ * digits that read back exactly, instead of the 17 json_dumps uses. Cached
+ * serialisations are kept for one of the two forms at a time.
+ * */
+void JsonNodeCache::Dump(const json_t* json, std::string& out,
+                         bool shortestReals) {
+    JsonNodeCache* cache = Resolve();
+    if (!IsContainer(json) && !(json_is_number(json) && cache->m_HasNumbers)) {
+        EncodeScalar(json, shortestReals, out);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    if (cache->m_ShortestReals != shortestReals) {
+        cache->m_Dumps.clear();
+        cache->m_ShortestReals = shortestReals;
+    }
+    if (IsContainer(json))
+        cache->Emit(json, out);
+    else
+        cache->EncodeNumber(json, out);
+}
+
+/*!
+ * Seed function. Takes over what a parse that kept the source recorded, so
+ * that the document dumps as it was read. The source text of containers is
+ * kept for the default form of reals only.
+ * @param reference to the record. Its contents are moved out.
+ * */
+void JsonNodeCache::Seed(Source& source) {
+    JsonNodeCache* cache = Resolve();
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    if (cache->m_ShortestReals) {
+        cache->m_Dumps.clear();
+        cache->m_ShortestReals = false;
+    }
+
+    for (size_t i = 0; i < source.links.size(); ++i) {
+        cache->Link(source.links[i].first, source.links[i].second);
+    }
+    for (size_t i = 0; i < source.dumps.size(); ++i) {
+        DumpEntry& entry = cache->m_Dumps[source.dumps[i].first];
+        entry.text.swap(source.dumps[i].second.text);
+        entry.splices.swap(source.dumps[i].second.splices);
+    }
+    for (size_t i = 0; i < source.numbers.size(); ++i) {
+        json_t* number = const_cast<json_t*>(source.numbers[i].first);
+        std::pair<std::unordered_map<const json_t*, std::string>::iterator,
+                  bool>
+            inserted = cache->m_Numbers.insert(
+                std::make_pair(number, std::string()));
+        if (inserted.second) json_incref(number);
+        inserted.first->second.swap(source.numbers[i].second);
+    }
+    if (!cache->m_Numbers.empty()) cache->m_HasNumbers = true;
+    source = Source();
+}
+
+/*!
+ * RawNumber function. Looks up the source text of a number.
+ * @param pointer to a number node of this document.
+ * @param reference to string. The text is returned in this variable.
+ * @return bool. True if the number was parsed with its text kept and that
+ * text differs from how the number dumps.
+ * */
+bool JsonNodeCache::RawNumber(const json_t* json, std::string& text) {
+    JsonNodeCache* cache = Resolve();
+    if (!cache->m_HasNumbers) return false;
+
+    std::lock_guard<std::mutex> lock(cache->m_Mutex);
+    std::unordered_map<const json_t*, std::string>::const_iterator it =
+        cache->m_Numbers.find(json);
+    if (it == cache->m_Numbers.end()) return false;
+    text = it->second;
+    return true;
+}
+
+void JsonNodeCache::Emit(const json_t* json, std::string& out) {
+    if (!m_Memoise) {
+        /* children are all inlined, so there is nothing to splice. */
+        DumpEntry entry;
+        EncodeContainer(json, entry);
+        out += entry.text;
+        return;
+    }
+
+    const DumpEntry& entry = DumpNode(json);
+    size_t done = 0;
+    for (size_t i = 0; i < entry.splices.size(); ++i) {
+        size_t offset = entry.splices[i].first;
+        out.append(entry.text, done, offset - done);
+        Emit(entry.splices[i].second, out);
+        done = offset;
+    }
+    out.append(entry.text, done, std::string::npos);
+}
+
+/* Cached entry of a container, encoded first if need be. Entries are never
+ * erased during a dump, so the reference stays valid. */
+const JsonNodeCache::DumpEntry& JsonNodeCache::DumpNode(const json_t* json) {
+    std::unordered_map<const json_t*, DumpEntry>::const_iterator it =
+        m_Dumps.find(json);
+    if (it != m_Dumps.end()) return it->second;
+
+    DumpEntry entry;
+    EncodeContainer(json, entry);
+    DumpEntry& stored = m_Dumps[json];
+    stored.text.swap(entry.text);
+    stored.splices.swap(entry.splices);
+    return stored;
+}
+
+void JsonNodeCache::EncodeContainer(const json_t* json, DumpEntry& entry) {
+    json_t* node = const_cast<json_t*>(json);
+    if (json_is_array(json)) {
+        entry.text += '[';
+        for (size_t i = 0; i < json_array_size(json); ++i) {
+            if (i) entry.text += ',';
+            EncodeChild(json_array_get(json, i), json, entry);
+        }
+        entry.text += ']';
+        return;
+    }
+
+    entry.text += '{';
+    bool first = true;
+    for (void* iter = json_object_iter(node); iter;
+         iter = json_object_iter_next(node, iter)) {
+        if (!first) entry.text += ',';
+        first = false;
+        const char* key = json_object_iter_key(iter);
+        EncodeString(key, strlen(key), entry.text);
+        entry.text += ':';
+        EncodeChild(json_object_iter_value(iter), json, entry);
+    }
+    entry.text += '}';
+}
+
+/*
+ * A child container that is cached, or large enough to be, is spliced in;
+ * a small one is inlined together with whatever it splices in itself.
+ * */
+void JsonNodeCache::EncodeChild(const json_t* child, const json_t* parent,
+                                DumpEntry& entry) {
+    if (!IsContainer(child)) {
+        if (json_is_number(child) && !m_Numbers.empty()) {
+            EncodeNumber(child, entry.text);
+        } else {
+            EncodeScalar(child, m_ShortestReals, entry.text);
+        }
+        return;
+    }
+
+    Link(child, parent);
+    if (m_Dumps.find(child) == m_Dumps.end()) {
+        DumpEntry inner;
+        EncodeContainer(child, inner);
+        if (inner.text.size() < DUMP_CACHE_MIN_SIZE || !m_Memoise) {
+            size_t base = entry.text.size();
+            entry.text += inner.text;
+            for (size_t i = 0; i < inner.splices.size(); ++i) {
+                entry.splices.push_back(std::make_pair(
+                    base + inner.splices[i].first, inner.splices[i].second));
+            }
+            return;
+        }
+        DumpEntry& stored = m_Dumps[child];
+        stored.text.swap(inner.text);
+        stored.splices.swap(inner.splices);
+    }
+    entry.splices.push_back(std::make_pair(entry.text.size(), child));
+}
+
+/* A number as it was written in the source, if that was kept. */
+void JsonNodeCache::EncodeNumber(const json_t* json, std::string& out) {
+    std::unordered_map<const json_t*, std::string>::const_iterator it =
+        m_Numbers.find(json);
+    if (it != m_Numbers.end()) {
+        out += it->second;
+    } else {
+        EncodeScalar(json, m_ShortestReals, out);
+    }
+}
+
+/*!
+ * Merge function. Called when a subtree of one document is put into another.
+ * From then on both documents share the cache of the receiving one, so that
+ * a change made through a handle of either invalidates both.
+ * @param const reference to the cache of the receiving document.
+ * @param const reference to the cache of the document the subtree came from.
+ * */
+void JsonNodeCache::Merge(const std::shared_ptr<JsonNodeCache>& into,
+                          const std::shared_ptr<JsonNodeCache>& from) {
+    if (!into || !from) return;
+    std::shared_ptr<JsonNodeCache> target = Resolve(into);
+    std::shared_ptr<JsonNodeCache> source = Resolve(from);
+    if (target == source) return;
+
+    /* fixed lock order so two concurrent merges cannot deadlock. */
+    JsonNodeCache* first = std::min(target.get(), source.get());
+    JsonNodeCache* second = std::max(target.get(), source.get());
+    std::lock_guard<std::mutex> lock1(first->m_Mutex);
+    std::lock_guard<std::mutex> lock2(second->m_Mutex);
+
+    target->m_Roots.insert(target->m_Roots.end(), source->m_Roots.begin(),
+                           source->m_Roots.end());
+    source->m_Roots.clear();
+    /* source texts are not derived from the tree and cannot be rebuilt. The
+     * reference of an entry both caches hold is dropped. */
+    for (std::unordered_map<const json_t*, std::string>::iterator it =
+             source->m_Numbers.begin();
+         it != source->m_Numbers.end(); ++it) {
+        if (!target->m_Numbers.insert(*it).second) {
+            json_decref(const_cast<json_t*>(it->first));
+        }
+    }
+    source->m_Numbers.clear();
+    target->m_DetachedNumbers += source->m_DetachedNumbers;
+    source->m_DetachedNumbers = 0;
+    if (!target->m_Numbers.empty()) target->m_HasNumbers = true;
+    source->m_Hashes.clear();
+    source->m_Dumps.clear();
+    source->m_Parents.clear();
+    if (!source->m_Memoise && target->m_Memoise) {
+        target->m_Memoise = false;
+        target->m_Hashes.clear();
+        target->m_Dumps.clear();
+        target->m_Parents.clear();
+    }
+    std::atomic_store(&source->m_Merged, target);
+
+    target->PruneRootsLocked();
+}
+
+/*
+ * Releases the roots nothing but this cache refers to any more, e.g. record
+ * documents whose collection was since replaced. Amortised over merges.
+ * */
+void JsonNodeCache::PruneRootsLocked() {
+    if (m_Roots.size() < 2 * m_PrunedRoots + 16) return;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_Roots.size(); ++i) {
+        json_t* root = m_Roots[i];
+        if (root->refcount == 1) {
+            PurgeLocked(root);
+            json_decref(root);
+        } else {
+            m_Roots[kept++] = root;
+        }
+    }
+    m_Roots.resize(kept);
+    m_PrunedRoots = kept;
+}
+
+/*
+ * Drops the texts of detached numbers nothing but this cache refers to any
+ * more. Amortised over the detaches that left an entry behind.
+ * */
+void JsonNodeCache::PruneNumbersLocked() {
+    if (m_DetachedNumbers < 16 || 2 * m_DetachedNumbers < m_Numbers.size()) {
+        return;
+    }
+
+    for (std::unordered_map<const json_t*, std::string>::iterator it =
+             m_Numbers.begin();
+         it != m_Numbers.end();) {
+        json_t* number = const_cast<json_t*>(it->first);
+        if (number->refcount == 1) {
+            it = m_Numbers.erase(it);
+            json_decref(number);
+        } else {
+            ++it;
+        }
+    }
+    m_DetachedNumbers = 0;
+}
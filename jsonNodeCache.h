@@ -0,0 +1,120 @@
+/*!
+ * @file jsonNodeCache.h
+ * @brief Per document cache of values derived from jansson nodes.
+ * Details. Every JsonSerializer handle into the same document shares one
+ * JsonNodeCache. It memoises the content hash of container nodes and records
+ * which container holds which, so that a Put* through any handle invalidates
+ * exactly the modified node and its ancestors. It also keeps the compact
+ * serialisation of large containers, so that dumping a document again after
+ * a small change only encodes the changed path. A document parsed with its
+ * source kept is seeded with the source text of its containers and numbers,
+ * so that it dumps byte for byte as it was read until it is modified. When a
+ * subtree of one document is put into another, the two caches are merged
+ * into one. Only changes made through JsonSerializer are seen; a tree edited
+ * with raw jansson calls must not be hashed through a cache that was
+ * populated before the edit.
+ * NOTE: handles constructed from a raw json_t* cannot find the cache of
+ * other handles to the same nodes, so such a cache memoises nothing: every
+ * Hash and Dump through it starts from scratch, and so does every cache it
+ * is merged with, e.g. by PutObject of such a handle. This also drops the
+ * source text of containers kept by Parse; that of numbers is kept.
+ * $Id$
+ * */
+
+#ifndef JSONNODECACHE_H
+#define JSONNODECACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <jansson.h>
+
+/* Containers whose own serialised bytes are at least this long keep them in
+ * the cache; smaller ones are kept inline in their parent's bytes. */
+#define DUMP_CACHE_MIN_SIZE 128
+
+class JsonNodeCache {
+   public:
+    /* Compact serialisation of a container, with the cached serialisations
+     * of large child containers left out and spliced in at dump time. */
+    struct DumpEntry {
+        std::string text;
+        std::vector<std::pair<size_t, const json_t*> > splices;
+    };
+
+    /* What a parse that kept the source recorded about the tree. */
+    struct Source {
+        /* every container below the root, with the container holding it. */
+        std::vector<std::pair<const json_t*, const json_t*> > links;
+        /* source text of the containers, as dump entries. */
+        std::vector<std::pair<const json_t*, DumpEntry> > dumps;
+        /* source text of the numbers that do not dump as written. */
+        std::vector<std::pair<const json_t*, std::string> > numbers;
+    };
+
+    explicit JsonNodeCache(json_t* root, bool memoise = true);
+    ~JsonNodeCache();
+
+    uint64_t Hash(const json_t* json);
+    bool PeekHash(const json_t* json, uint64_t& hash);
+    void Invalidate(const json_t* json);
+    void Purge(const json_t* json);
+    void Dump(const json_t* json, std::string& out, bool shortestReals);
+    void Seed(Source& source);
+    bool RawNumber(const json_t* json, std::string& text);
+
+    static void Merge(const std::shared_ptr<JsonNodeCache>& into,
+                      const std::shared_ptr<JsonNodeCache>& from);
+    static uint64_t HashBytes(const void* data, size_t len, uint64_t seed);
+
+   private:
+    JsonNodeCache(const JsonNodeCache&);
+    JsonNodeCache& operator=(const JsonNodeCache&);
+
+    static std::shared_ptr<JsonNodeCache> Resolve(
+        std::shared_ptr<JsonNodeCache> cache);
+    JsonNodeCache* Resolve();
+
+    uint64_t HashNode(const json_t* json);
+    void Link(const json_t* child, const json_t* parent);
+    const DumpEntry& DumpNode(const json_t* json);
+    void EncodeContainer(const json_t* json, DumpEntry& entry);
+    void EncodeChild(const json_t* child, const json_t* parent,
+                     DumpEntry& entry);
+    void EncodeNumber(const json_t* json, std::string& out);
+    void Emit(const json_t* json, std::string& out);
+    void InvalidateLocked(const json_t* json);
+    void PurgeLocked(const json_t* json);
+    void PurgeNumberLocked(const json_t* json, bool owned);
+    bool Tracked(const json_t* json) const;
+    void PruneRootsLocked();
+    void PruneNumbersLocked();
+
+    /* members */
+    std::mutex m_Mutex;
+    std::vector<json_t*> m_Roots;
+    size_t m_PrunedRoots;
+    std::unordered_map<const json_t*, uint64_t> m_Hashes;
+    std::unordered_map<const json_t*, DumpEntry> m_Dumps;
+    bool m_ShortestReals;
+    /* false once any handle of the document was made from a raw json_t*. */
+    bool m_Memoise;
+    /* source text of numbers, kept until the number is detached. Every entry
+     * holds a reference to its number, so that its address cannot be reused
+     * by a new number while the text is kept. */
+    std::unordered_map<const json_t*, std::string> m_Numbers;
+    /* numbers detached while still referenced elsewhere, e.g. by an undo
+     * log, since m_Numbers was last pruned. */
+    size_t m_DetachedNumbers;
+    std::atomic<bool> m_HasNumbers;
+    std::unordered_map<const json_t*, std::vector<const json_t*> > m_Parents;
+    std::shared_ptr<JsonNodeCache> m_Merged;
+};
+
+#endif  // JSONNODECACHE_H
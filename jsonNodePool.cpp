@@ -0,0 +1,257 @@
+/*!
+ * @file jsonNodePool.cpp
+ * @brief Thread local free lists for the allocations jansson makes.
+ * Details. See jsonNodePool.h. Every block starts with a header holding its
+ * size class, since jansson's free function is not told the size. A block
+ * on a free list holds the link to the next one.
+ * $Id$
+ * */
+
+#include "jsonNodePool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include <jansson.h>
+
+namespace {
+
+/* 16 bytes keep the payload as aligned as malloc's. */
+const size_t kHeaderSize = 16;
+const uint32_t kLarge = 0xFFFFFFFF;
+
+const size_t kClassSizes[] = {16, 32, 48, 64, 96, 128, 192, 256};
+const size_t kClasses = sizeof(kClassSizes) / sizeof(kClassSizes[0]);
+
+/* Size class of a request, indexed by (size + 15) / 16. */
+const unsigned char kClassOf[] = {0, 0, 1, 2, 3, 4, 4, 5, 5,
+                                  6, 6, 6, 6, 7, 7, 7, 7};
+
+struct Block {
+    Block* next;
+};
+
+struct FreeList {
+    Block* head;
+    size_t count;
+};
+
+struct Depot {
+    std::mutex mutex[kClasses];
+    std::vector<FreeList> batches[kClasses];
+};
+
+/* Never destroyed, so that threads still exiting during static destruction
+ * can hand their blocks over. */
+Depot& TheDepot() {
+    static Depot* depot = new Depot;
+    return *depot;
+}
+
+void* NewBlock(size_t size, uint32_t cls) {
+    if (size > (size_t)-1 - kHeaderSize) return 0;
+    char* block = static_cast<char*>(malloc(kHeaderSize + size));
+    if (block == 0) return 0;
+    memcpy(block, &cls, sizeof(cls));
+    return block + kHeaderSize;
+}
+
+void Release(Block* head) {
+    while (head) {
+        Block* next = head->next;
+        free(reinterpret_cast<char*>(head) - kHeaderSize);
+        head = next;
+    }
+}
+
+/* Hands a list to the depot, or back to malloc if the depot is full. */
+void Deposit(size_t cls, const FreeList& list) {
+    if (list.head == 0) return;
+    Depot& depot = TheDepot();
+    {
+        std::lock_guard<std::mutex> lock(depot.mutex[cls]);
+        if (depot.batches[cls].size() < NODE_POOL_DEPOT_BATCHES) {
+            depot.batches[cls].push_back(list);
+            return;
+        }
+    }
+    Release(list.head);
+}
+
+bool Withdraw(size_t cls, FreeList& list) {
+    Depot& depot = TheDepot();
+    std::lock_guard<std::mutex> lock(depot.mutex[cls]);
+    if (depot.batches[cls].empty()) return false;
+    list = depot.batches[cls].back();
+    depot.batches[cls].pop_back();
+    return true;
+}
+
+class ThreadCache;
+
+/* The calling thread's cache, kept apart from the cache itself so that the
+ * fast path does not run the thread local initialisation check. */
+thread_local ThreadCache* t_Cache = 0;
+
+/* Set once the calling thread's cache is destroyed; blocks freed after
+ * that, by other thread local destructors, go straight to malloc. */
+thread_local bool t_Exited = false;
+
+class ThreadCache {
+   public:
+    ThreadCache() {
+        for (size_t i = 0; i < kClasses; ++i) {
+            m_Lists[i].head = 0;
+            m_Lists[i].count = 0;
+        }
+    }
+
+    ~ThreadCache() {
+        t_Cache = 0;
+        t_Exited = true;
+        for (size_t i = 0; i < kClasses; ++i) Deposit(i, m_Lists[i]);
+    }
+
+    void* Allocate(size_t cls) {
+        FreeList& list = m_Lists[cls];
+        if (list.head == 0 && !Withdraw(cls, list)) return 0;
+        Block* block = list.head;
+        list.head = block->next;
+        --list.count;
+        return block;
+    }
+
+    void Free(size_t cls, Block* block) {
+        FreeList& list = m_Lists[cls];
+        block->next = list.head;
+        list.head = block;
+        if (++list.count <= NODE_POOL_THREAD_CACHE) return;
+
+        /* the surplus goes to the depot a batch at a time. */
+        FreeList batch = {list.head, NODE_POOL_BATCH};
+        Block* last = list.head;
+        for (size_t i = 1; i < NODE_POOL_BATCH; ++i) last = last->next;
+        list.head = last->next;
+        list.count -= NODE_POOL_BATCH;
+        last->next = 0;
+        Deposit(cls, batch);
+    }
+
+    void Trim() {
+        for (size_t i = 0; i < kClasses; ++i) {
+            Release(m_Lists[i].head);
+            m_Lists[i].head = 0;
+            m_Lists[i].count = 0;
+        }
+    }
+
+    size_t Cached() const {
+        size_t count = 0;
+        for (size_t i = 0; i < kClasses; ++i) count += m_Lists[i].count;
+        return count;
+    }
+
+   private:
+    FreeList m_Lists[kClasses];
+};
+
+ThreadCache* Cache() {
+    if (t_Cache || t_Exited) return t_Cache;
+    static thread_local ThreadCache cache;
+    t_Cache = &cache;
+    return t_Cache;
+}
+
+}  // namespace
+
+/*!
+ * Install function. Makes the pool jansson's allocator. Call it before the
+ * first jansson value is created, or at least while none is alive, since
+ * values allocated before must not be freed through the pool. Leave it out
+ * of AddressSanitizer builds: a pooled block is not freed as far as ASan
+ * can tell, so a use after free of it goes unnoticed.
+ * */
+void JsonNodePool::Install() { json_set_alloc_funcs(Allocate, Free); }
+
+/*!
+ * Allocate function. jansson's malloc while the pool is installed.
+ * @param size_t size of the block.
+ * @return void*. The block, null if out of memory.
+ * */
+void* JsonNodePool::Allocate(size_t size) {
+    if (size > NODE_POOL_MAX_SIZE) return NewBlock(size, kLarge);
+
+    size_t cls = kClassOf[(size + 15) / 16];
+    ThreadCache* cache = Cache();
+    if (cache) {
+        void* block = cache->Allocate(cls);
+        if (block) return block;
+    }
+    return NewBlock(kClassSizes[cls], (uint32_t)cls);
+}
+
+/*!
+ * Free function. jansson's free while the pool is installed. Takes blocks
+ * from any thread.
+ * @param pointer to a block from Allocate. May be null.
+ * */
+void JsonNodePool::Free(void* ptr) {
+    if (ptr == 0) return;
+    char* block = static_cast<char*>(ptr) - kHeaderSize;
+    uint32_t cls;
+    memcpy(&cls, block, sizeof(cls));
+
+    ThreadCache* cache = cls == kLarge ? 0 : Cache();
+    if (cache) {
+        cache->Free(cls, static_cast<Block*>(ptr));
+    } else {
+        free(block);
+    }
+}
+
+/*!
+ * Trim function. Gives the blocks cached by the calling thread and by the
+ * depot back to malloc, e.g. after a burst of work that will not recur.
+ * */
+void JsonNodePool::Trim() {
+    ThreadCache* cache = Cache();
+    if (cache) cache->Trim();
+
+    Depot& depot = TheDepot();
+    for (size_t i = 0; i < kClasses; ++i) {
+        std::vector<FreeList> batches;
+        {
+            std::lock_guard<std::mutex> lock(depot.mutex[i]);
+            batches.swap(depot.batches[i]);
+        }
+        for (size_t b = 0; b < batches.size(); ++b) Release(batches[b].head);
+    }
+}
+
+/*!
+ * CachedBlocks function.
+ * @return size_t. Blocks on the free lists of the calling thread.
+ * */
+size_t JsonNodePool::CachedBlocks() {
+    ThreadCache* cache = Cache();
+    return cache ? cache->Cached() : 0;
+}
+
+/*!
+ * DepotBlocks function.
+ * @return size_t. Blocks in the depot shared by all threads.
+ * */
+size_t JsonNodePool::DepotBlocks() {
+    Depot& depot = TheDepot();
+    size_t count = 0;
+    for (size_t i = 0; i < kClasses; ++i) {
+        std::lock_guard<std::mutex> lock(depot.mutex[i]);
+        for (size_t b = 0; b < depot.batches[i].size(); ++b) {
+            count += depot.batches[i][b].count;
+        }
+    }
+    return count;
+}
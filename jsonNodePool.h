@@ -0,0 +1,48 @@
+/*!
+ * @file jsonNodePool.h
+ * @brief Thread local free lists for the allocations jansson makes.
+ * Details. Once installed as jansson's allocator, small blocks (nodes,
+ * object members, hashtable buckets, short strings) are served from per
+ * thread free lists of a few size classes, so that building and freeing
+ * documents in a loop does not go to malloc and does not contend on its
+ * arenas. Every thread keeps at most NODE_POOL_THREAD_CACHE blocks per
+ * class. Surplus goes in batches to a shared depot, from where threads that
+ * run dry take it back, and whatever the depot cannot hold goes back to
+ * malloc. A block freed by another thread than the one that allocated it,
+ * e.g. a document built on one thread and released on another, simply joins
+ * the freeing thread's list. Blocks larger than NODE_POOL_MAX_SIZE come from
+ * malloc directly. The caches of a thread go to the depot when it exits.
+ * $Id$
+ * */
+
+#ifndef JSONNODEPOOL_H
+#define JSONNODEPOOL_H
+
+#include <stddef.h>
+
+/* Largest block served from the free lists. */
+#define NODE_POOL_MAX_SIZE 256
+
+/* Blocks of one size class a thread keeps. */
+#define NODE_POOL_THREAD_CACHE 512
+
+/* Blocks moved between a thread and the depot at a time. */
+#define NODE_POOL_BATCH 128
+
+/* Batches of one size class the depot keeps. */
+#define NODE_POOL_DEPOT_BATCHES 64
+
+class JsonNodePool {
+   public:
+    static void Install();
+    static void* Allocate(size_t size);
+    static void Free(void* ptr);
+    static void Trim();
+    static size_t CachedBlocks();
+    static size_t DepotBlocks();
+
+   private:
+    JsonNodePool();
+};
+
+#endif  // JSONNODEPOOL_H
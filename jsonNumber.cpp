@@ -0,0 +1,261 @@
+/*!
+ * @file jsonNumber.cpp
+ * @brief Number formatting and parsing used by JsonSerializer.
+ * Details. See jsonNumber.h. With a standard library that has floating point
+ * std::to_chars/std::from_chars these do the work without locale lookups;
+ * otherwise snprintf and strtod are used, with the same results.
+ * $Id$
+ * */
+
+#include "jsonNumber.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define JSON_NUMBER_CHARCONV 1
+#endif
+
+namespace {
+
+const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+#ifndef JSON_NUMBER_CHARCONV
+/* snprintf writes the decimal point of the current locale. */
+void FixDecimalPoint(char* buffer, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        char c = buffer[i];
+        if (c != '-' && c != '+' && c != 'e' && (c < '0' || c > '9')) {
+            buffer[i] = '.';
+        }
+    }
+}
+
+/* strtod reads the decimal point of the current locale, so texts holding
+ * a '.' are only handed to it while that is '.'. */
+bool CLocaleDecimalPoint() {
+    const char* point = localeconv()->decimal_point;
+    return point[0] == '.' && point[1] == 0;
+}
+
+double ReadBack(const char* buffer) {
+    char* end;
+    return strtod(buffer, &end);
+}
+#endif
+
+/* Plain decimal text: optional '-', digits, optional fraction and exponent.
+ * strtod and iostreams accept more (spaces, "+", hex, "inf"). */
+bool IsDecimal(const char* text, size_t len, bool integer) {
+    size_t i = 0;
+    if (i < len && text[i] == '-') ++i;
+    size_t digits = i;
+    while (i < len && text[i] >= '0' && text[i] <= '9') ++i;
+    if (i == digits) return false;
+    if (integer) return i == len;
+
+    if (i < len && text[i] == '.') {
+        size_t fraction = ++i;
+        while (i < len && text[i] >= '0' && text[i] <= '9') ++i;
+        if (i == fraction) return false;
+    }
+    if (i < len && (text[i] == 'e' || text[i] == 'E')) {
+        ++i;
+        if (i < len && (text[i] == '+' || text[i] == '-')) ++i;
+        size_t exponent = i;
+        while (i < len && text[i] >= '0' && text[i] <= '9') ++i;
+        if (i == exponent) return false;
+    }
+    return i == len;
+}
+
+}  // namespace
+
+/*!
+ * FormatJsonInteger function. Formats an integer two digits at a time.
+ * @param json_int_t value.
+ * @param pointer to a buffer of at least JSON_NUMBER_BUFFER_SIZE chars.
+ * @return size_t. Length of the null terminated text written.
+ * */
+size_t FormatJsonInteger(json_int_t value, char* buffer) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned long long u = value < 0 ? 0ULL - (unsigned long long)value
+                                     : (unsigned long long)value;
+
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, kDigitPairs + (u % 100) * 2, 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, kDigitPairs + u * 2, 2);
+    } else {
+        *--p = (char)('0' + u);
+    }
+    if (value < 0) *--p = '-';
+
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(buffer, p, length);
+    buffer[length] = 0;
+    return length;
+}
+
+/*!
+ * FormatJsonReal function. Formats a finite real the way jansson's dump does:
+ * a ".0" is added when the digits alone would read back as an integer, and
+ * the exponent loses its '+' and leading zeros.
+ * @param double value.
+ * @param bool shortest. If true a short text that reads back to exactly the
+ * same double is used: the shortest such text with std::to_chars, the first
+ * of 15, 16 or 17 digits that reads back without it. Otherwise 17
+ * significant digits, as in json_dumps.
+ * @param pointer to a buffer of at least JSON_NUMBER_BUFFER_SIZE chars.
+ * @return size_t. Length of the null terminated text written, 0 if the value
+ * is not finite.
+ * */
+size_t FormatJsonReal(double value, bool shortest, char* buffer) {
+    if (!isfinite(value)) {
+        buffer[0] = 0;
+        return 0;
+    }
+
+    size_t length;
+#ifdef JSON_NUMBER_CHARCONV
+    std::to_chars_result result =
+        shortest ? std::to_chars(buffer, buffer + JSON_NUMBER_BUFFER_SIZE - 3,
+                                 value)
+                 : std::to_chars(buffer, buffer + JSON_NUMBER_BUFFER_SIZE - 3,
+                                 value, std::chars_format::general, 17);
+    length = result.ptr - buffer;
+    buffer[length] = 0;
+#else
+    /* the first of 15, 16 and 17 digits that reads back exactly. This always
+     * round trips but is not guaranteed to be the shortest such text: %.16g
+     * rounds to nearest and can miss a 16 digit text that reads back. */
+    int precision = shortest ? 15 : 17;
+    for (;; ++precision) {
+        length = snprintf(buffer, JSON_NUMBER_BUFFER_SIZE - 3, "%.*g",
+                          precision, value);
+        FixDecimalPoint(buffer, length);
+        if (precision == 17 || ReadBack(buffer) == value) break;
+    }
+#endif
+
+    if (strchr(buffer, '.') == 0 && strchr(buffer, 'e') == 0) {
+        buffer[length++] = '.';
+        buffer[length++] = '0';
+        buffer[length] = 0;
+    }
+
+    char* start = strchr(buffer, 'e');
+    if (start) {
+        ++start;
+        char* end = start + 1;
+        if (*start == '-') ++start;
+        while (*end == '0') ++end;
+        if (end != start) {
+            memmove(start, end, length - (end - buffer) + 1);
+            length -= end - start;
+        }
+    }
+    return length;
+}
+
+/*!
+ * ParseJsonNumber functions. Convert plain decimal text, all of it, to a
+ * number.
+ * @param const pointer to the text. Need not be null terminated.
+ * @param size_t length of the text.
+ * @param reference to the number. Only written on success.
+ * @return bool. False if the text is anything but a plain decimal number,
+ * or the number is out of range.
+ * */
+bool ParseJsonNumber(const char* text, size_t len, long long& value) {
+    if (!IsDecimal(text, len, true)) return false;
+#ifdef JSON_NUMBER_CHARCONV
+    std::from_chars_result result = std::from_chars(text, text + len, value);
+    return result.ec == std::errc() && result.ptr == text + len;
+#else
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    if (len >= sizeof(buffer)) return false;
+    memcpy(buffer, text, len);
+    buffer[len] = 0;
+    errno = 0;
+    value = strtoll(buffer, 0, 10);
+    return errno == 0;
+#endif
+}
+
+bool ParseJsonNumber(const char* text, size_t len, unsigned long long& value) {
+    if (!IsDecimal(text, len, true) || text[0] == '-') return false;
+#ifdef JSON_NUMBER_CHARCONV
+    std::from_chars_result result = std::from_chars(text, text + len, value);
+    return result.ec == std::errc() && result.ptr == text + len;
+#else
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    if (len >= sizeof(buffer)) return false;
+    memcpy(buffer, text, len);
+    buffer[len] = 0;
+    errno = 0;
+    value = strtoull(buffer, 0, 10);
+    return errno == 0;
+#endif
+}
+
+bool ParseJsonNumber(const char* text, size_t len, double& value) {
+    if (!IsDecimal(text, len, false)) return false;
+#ifdef JSON_NUMBER_CHARCONV
+    std::from_chars_result result = std::from_chars(text, text + len, value);
+    return result.ec == std::errc() && result.ptr == text + len;
+#else
+    if (!CLocaleDecimalPoint() && memchr(text, '.', len)) return false;
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    if (len >= sizeof(buffer)) return false;
+    memcpy(buffer, text, len);
+    buffer[len] = 0;
+    errno = 0;
+    value = strtod(buffer, 0);
+    /* ERANGE is also reported for results that are subnormal. */
+    return errno == 0 || (value != 0 && isfinite(value));
+#endif
+}
+
+bool ParseJsonNumber(const char* text, size_t len, float& value) {
+    if (!IsDecimal(text, len, false)) return false;
+#ifdef JSON_NUMBER_CHARCONV
+    std::from_chars_result result = std::from_chars(text, text + len, value);
+    return result.ec == std::errc() && result.ptr == text + len;
+#else
+    if (!CLocaleDecimalPoint() && memchr(text, '.', len)) return false;
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    if (len >= sizeof(buffer)) return false;
+    memcpy(buffer, text, len);
+    buffer[len] = 0;
+    errno = 0;
+    value = strtof(buffer, 0);
+    return errno == 0 || (value != 0 && isfinite(value));
+#endif
+}
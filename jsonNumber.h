@@ -0,0 +1,30 @@
+/*!
+ * @file jsonNumber.h
+ * @brief Number formatting and parsing used by JsonSerializer.
+ * Details. Integers are formatted two digits at a time from a table. Reals
+ * are formatted either like jansson's dump (17 significant digits) or as a
+ * short text that reads back to the same double (the shortest one where
+ * std::to_chars is available); both forms keep a '.' or an exponent so that
+ * they read back as reals. Parsing accepts plain decimal
+ * text only and fails where the caller should fall back to iostreams.
+ * $Id$
+ * */
+
+#ifndef JSONNUMBER_H
+#define JSONNUMBER_H
+
+#include <stddef.h>
+
+#include <jansson.h>
+
+/* Large enough for any integer or real this header formats. */
+#define JSON_NUMBER_BUFFER_SIZE 40
+
+size_t FormatJsonInteger(json_int_t value, char* buffer);
+size_t FormatJsonReal(double value, bool shortest, char* buffer);
+bool ParseJsonNumber(const char* text, size_t len, long long& value);
+bool ParseJsonNumber(const char* text, size_t len, unsigned long long& value);
+bool ParseJsonNumber(const char* text, size_t len, double& value);
+bool ParseJsonNumber(const char* text, size_t len, float& value);
+
+#endif  // JSONNUMBER_H
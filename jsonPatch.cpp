@@ -0,0 +1,656 @@
+/*!
+ * @file jsonPatch.cpp
+ * @brief JSON Patch (RFC 6902), JSON Merge Patch (RFC 7396) and diff support
+ * for JsonSerializer.
+ * Details. Patches are applied in place on the jansson tree: only the
+ * containers named by a patch operation are touched, and values are copied
+ * out of the patch only where the patch adds them. Every change is recorded
+ * in an undo log so that a patch whose operations do not all succeed leaves
+ * the document as it was. Diff walks both documents together and skips every
+ * pair of subtrees whose content hashes match.
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+#include "jsonNodeCache.h"
+#include "jsonPointer.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace {
+
+/*
+ * Converts an array reference token to an index. "-" names the position
+ * after the last element, which only "add" may use.
+ * */
+bool ParseIndex(const std::string& token, size_t size, bool allowEnd,
+                size_t& index) {
+    if (token == "-") {
+        index = size;
+        return allowEnd;
+    }
+    if (!ParseJsonPointerIndex(token, index)) return false;
+    return allowEnd ? index <= size : index < size;
+}
+
+/* Appends {"op":op,"path":path[,"value":value]}, stealing value. */
+bool AppendOp(json_t* ops, const char* op, const std::string& path,
+              json_t* value) {
+    json_t* entry = json_object();
+    if (entry == 0) {
+        if (value) json_decref(value);
+        return false;
+    }
+
+    bool ok = json_object_set_new(entry, "op", json_string(op)) == 0 &&
+              json_object_set_new(entry, "path", json_string(path.c_str())) ==
+                  0;
+    if (value) ok = json_object_set_new(entry, "value", value) == 0 && ok;
+    if (!ok) {
+        json_decref(entry);
+        return false;
+    }
+    return json_array_append_new(ops, entry) == 0;
+}
+
+/*
+ * Equality of the "test" operation: that of json_equal, except that numbers
+ * compare by value (RFC 6902 4.6), so that 1 and 1.0 are equal.
+ * */
+bool TestEqual(json_t* a, json_t* b) {
+    if (json_is_number(a) && json_is_number(b)) {
+        if (json_is_integer(a) && json_is_integer(b)) {
+            return json_integer_value(a) == json_integer_value(b);
+        }
+        if (json_is_real(a) && json_is_real(b)) {
+            return json_real_value(a) == json_real_value(b);
+        }
+        json_t* integer = json_is_integer(a) ? a : b;
+        double real = json_real_value(json_is_real(a) ? a : b);
+        /* compared as integers, where a double cannot hold every value. */
+        if (!(real >= -9223372036854775808.0 && real < 9223372036854775808.0)) {
+            return false;
+        }
+        long long value = static_cast<long long>(real);
+        return static_cast<double>(value) == real &&
+               value == json_integer_value(integer);
+    }
+
+    if (json_is_array(a) && json_is_array(b)) {
+        if (json_array_size(a) != json_array_size(b)) return false;
+        for (size_t i = 0; i < json_array_size(a); ++i) {
+            if (!TestEqual(json_array_get(a, i), json_array_get(b, i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (json_is_object(a) && json_is_object(b)) {
+        if (json_object_size(a) != json_object_size(b)) return false;
+        for (void* iter = json_object_iter(a); iter;
+             iter = json_object_iter_next(a, iter)) {
+            json_t* other = json_object_get(b, json_object_iter_key(iter));
+            if (!other || !TestEqual(json_object_iter_value(iter), other)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return json_equal(a, b) != 0;
+}
+
+/*
+ * Hash based equality used by Diff. Two nodes whose 64 bit content hashes
+ * differ are unequal without being compared; a match is confirmed with
+ * json_equal, since different content may hash alike.
+ * */
+class DiffHasher {
+   public:
+    DiffHasher(JsonNodeCache& from, JsonNodeCache& to)
+        : m_From(from), m_To(to) {}
+
+    bool Same(const json_t* a, const json_t* b) {
+        if (a == b) return true;
+        if (json_typeof(a) != json_typeof(b)) return false;
+        if (m_From.Hash(a) != m_To.Hash(b)) return false;
+        return json_equal(a, b) != 0;
+    }
+
+   private:
+    JsonNodeCache& m_From;
+    JsonNodeCache& m_To;
+};
+
+bool DiffNode(DiffHasher& hasher, const json_t* a, const json_t* b,
+              std::string& path, json_t* ops);
+
+bool DiffObject(DiffHasher& hasher, json_t* a, json_t* b, std::string& path,
+                json_t* ops) {
+    size_t length = path.size();
+
+    for (void* iter = json_object_iter(a); iter;
+         iter = json_object_iter_next(a, iter)) {
+        const char* key = json_object_iter_key(iter);
+        json_t* other = json_object_get(b, key);
+        AppendJsonPointerToken(path, key);
+        bool ok = other ? DiffNode(hasher, json_object_iter_value(iter), other,
+                                   path, ops)
+                        : AppendOp(ops, "remove", path, 0);
+        path.resize(length);
+        if (!ok) return false;
+    }
+
+    for (void* iter = json_object_iter(b); iter;
+         iter = json_object_iter_next(b, iter)) {
+        const char* key = json_object_iter_key(iter);
+        if (json_object_get(a, key)) continue;
+        AppendJsonPointerToken(path, key);
+        bool ok = AppendOp(ops, "add", path,
+                           json_deep_copy(json_object_iter_value(iter)));
+        path.resize(length);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+/*
+ * Arrays are matched element by element after trimming the common prefix and
+ * suffix, so an insertion or removal at either end costs one operation
+ * rather than one per shifted element.
+ * */
+bool DiffArray(DiffHasher& hasher, json_t* a, json_t* b, std::string& path,
+               json_t* ops) {
+    size_t na = json_array_size(a);
+    size_t nb = json_array_size(b);
+    size_t length = path.size();
+
+    size_t prefix = 0;
+    while (prefix < na && prefix < nb &&
+           hasher.Same(json_array_get(a, prefix), json_array_get(b, prefix))) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < na - prefix && suffix < nb - prefix &&
+           hasher.Same(json_array_get(a, na - 1 - suffix),
+                       json_array_get(b, nb - 1 - suffix))) {
+        ++suffix;
+    }
+
+    size_t ma = na - prefix - suffix;
+    size_t mb = nb - prefix - suffix;
+    size_t common = ma < mb ? ma : mb;
+    bool ok = true;
+
+    for (size_t i = prefix; ok && i < prefix + common; ++i) {
+        AppendJsonPointerIndex(path, i);
+        ok = DiffNode(hasher, json_array_get(a, i), json_array_get(b, i), path,
+                      ops);
+        path.resize(length);
+    }
+
+    /* surplus elements of a are removed from the same index, each removal
+     * shifting the next one into place. */
+    for (size_t i = common; ok && i < ma; ++i) {
+        AppendJsonPointerIndex(path, prefix + common);
+        ok = AppendOp(ops, "remove", path, 0);
+        path.resize(length);
+    }
+
+    for (size_t i = common; ok && i < mb; ++i) {
+        AppendJsonPointerIndex(path, prefix + i);
+        ok = AppendOp(ops, "add", path,
+                      json_deep_copy(json_array_get(b, prefix + i)));
+        path.resize(length);
+    }
+    return ok;
+}
+
+bool DiffNode(DiffHasher& hasher, const json_t* a, const json_t* b,
+              std::string& path, json_t* ops) {
+    if (hasher.Same(a, b)) return true;
+
+    json_t* from = const_cast<json_t*>(a);
+    json_t* to = const_cast<json_t*>(b);
+    if (json_is_object(a) && json_is_object(b)) {
+        return DiffObject(hasher, from, to, path, ops);
+    }
+    if (json_is_array(a) && json_is_array(b)) {
+        return DiffArray(hasher, from, to, path, ops);
+    }
+    return AppendOp(ops, "replace", path, json_deep_copy(to));
+}
+
+/*
+ * Merges patch into the object target following RFC 7396, modifying target
+ * in place. Members whose current value is an object are merged into
+ * recursively; every other member named by the patch is replaced by a copy.
+ * */
+bool MergeObject(JsonNodeCache* cache, json_t* target, json_t* patch) {
+    if (cache) cache->Invalidate(target);
+
+    for (void* iter = json_object_iter(patch); iter;
+         iter = json_object_iter_next(patch, iter)) {
+        const char* key = json_object_iter_key(iter);
+        json_t* value = json_object_iter_value(iter);
+        json_t* current = json_object_get(target, key);
+
+        if (json_is_null(value)) {
+            if (current) {
+                if (cache) cache->Purge(current);
+                json_object_del(target, key);
+            }
+            continue;
+        }
+
+        if (json_is_object(value) && json_is_object(current)) {
+            if (!MergeObject(cache, current, value)) return false;
+            continue;
+        }
+
+        json_t* merged;
+        if (json_is_object(value)) {
+            merged = json_object();
+            if (merged && !MergeObject(0, merged, value)) {
+                json_decref(merged);
+                return false;
+            }
+        } else {
+            merged = json_deep_copy(value);
+        }
+
+        if (current && cache) cache->Purge(current);
+        if (json_object_set_new(target, key, merged) == -1) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+/*
+ * Applies the operations of a JSON Patch to one document, remembering how to
+ * undo each of them.
+ * */
+class JsonPatcher {
+   public:
+    explicit JsonPatcher(JsonSerializer& doc) : m_Doc(doc) {}
+    ~JsonPatcher() { Commit(); }
+
+    bool Apply(json_t* op);
+    void Rollback();
+    void Commit();
+
+   private:
+    JsonPatcher(const JsonPatcher&);
+    JsonPatcher& operator=(const JsonPatcher&);
+
+    enum UndoKind { kObjectSet, kArrayInsert, kArrayRemove, kArraySet, kRoot };
+
+    struct Undo {
+        UndoKind kind;
+        json_t* container;
+        std::string key;
+        size_t index;
+        json_t* old;
+        std::shared_ptr<JsonNodeCache> cache;
+        std::shared_ptr<JsonCowTree> tree;
+    };
+
+    bool Locate(const std::vector<std::string>& tokens, size_t count,
+                json_t*& node) const;
+    json_t* Get(const std::vector<std::string>& tokens) const;
+    bool Add(const std::vector<std::string>& tokens, json_t* value);
+    bool Remove(const std::vector<std::string>& tokens, json_t** removed);
+    bool Replace(const std::vector<std::string>& tokens, json_t* value);
+    void SetRoot(json_t* value);
+    void Touch(json_t* container, json_t* old);
+    void Record(UndoKind kind, json_t* container, const std::string& key,
+                size_t index, json_t* old);
+
+    /* members */
+    JsonSerializer& m_Doc;
+    std::vector<Undo> m_Undo;
+};
+
+bool JsonPatcher::Locate(const std::vector<std::string>& tokens, size_t count,
+                         json_t*& node) const {
+    node = m_Doc.m_Json;
+    for (size_t i = 0; node && i < count; ++i) {
+        if (json_is_object(node)) {
+            node = json_object_get(node, tokens[i].c_str());
+        } else if (json_is_array(node)) {
+            size_t index;
+            if (!ParseIndex(tokens[i], json_array_size(node), false, index)) {
+                return false;
+            }
+            node = json_array_get(node, index);
+        } else {
+            return false;
+        }
+    }
+    return node != 0;
+}
+
+json_t* JsonPatcher::Get(const std::vector<std::string>& tokens) const {
+    json_t* node;
+    return Locate(tokens, tokens.size(), node) ? node : 0;
+}
+
+void JsonPatcher::Touch(json_t* container, json_t* old) {
+    if (!m_Doc.m_Cache) return;
+    m_Doc.m_Cache->Invalidate(container);
+    if (old) m_Doc.m_Cache->Purge(old);
+}
+
+void JsonPatcher::Record(UndoKind kind, json_t* container,
+                         const std::string& key, size_t index, json_t* old) {
+    Undo undo;
+    undo.kind = kind;
+    undo.container = container;
+    undo.key = key;
+    undo.index = index;
+    undo.old = json_incref(old);
+    m_Undo.push_back(undo);
+}
+
+/*
+ * The whole document is replaced. This serializer becomes the only handle of
+ * a new document, exactly as after Parse.
+ * */
+void JsonPatcher::SetRoot(json_t* value) {
+    Undo undo;
+    undo.kind = kRoot;
+    undo.container = 0;
+    undo.index = 0;
+    undo.old = json_incref(m_Doc.m_Json);
+    undo.cache = m_Doc.m_Cache;
+    undo.tree = m_Doc.m_Tree;
+    m_Undo.push_back(undo);
+    m_Doc.Attach(value);
+}
+
+/* Steals value. */
+bool JsonPatcher::Add(const std::vector<std::string>& tokens, json_t* value) {
+    if (value == 0) return false;
+    if (tokens.empty()) {
+        SetRoot(value);
+        return true;
+    }
+
+    json_t* parent;
+    if (!Locate(tokens, tokens.size() - 1, parent)) {
+        json_decref(value);
+        return false;
+    }
+
+    const std::string& last = tokens.back();
+    if (json_is_object(parent)) {
+        json_t* old = json_object_get(parent, last.c_str());
+        Record(kObjectSet, parent, last, 0, old);
+        Touch(parent, old);
+        return json_object_set_new(parent, last.c_str(), value) == 0;
+    }
+
+    size_t index;
+    if (!json_is_array(parent) ||
+        !ParseIndex(last, json_array_size(parent), true, index)) {
+        json_decref(value);
+        return false;
+    }
+    Record(kArrayInsert, parent, "", index, 0);
+    Touch(parent, 0);
+    return json_array_insert_new(parent, index, value) == 0;
+}
+
+/* Hands a reference to the removed value to the caller if asked for. */
+bool JsonPatcher::Remove(const std::vector<std::string>& tokens,
+                         json_t** removed) {
+    json_t* parent;
+    if (tokens.empty() || !Locate(tokens, tokens.size() - 1, parent)) {
+        return false;
+    }
+
+    const std::string& last = tokens.back();
+    if (json_is_object(parent)) {
+        json_t* old = json_object_get(parent, last.c_str());
+        if (old == 0) return false;
+        if (removed) *removed = json_incref(old);
+        Record(kObjectSet, parent, last, 0, old);
+        Touch(parent, old);
+        return json_object_del(parent, last.c_str()) == 0;
+    }
+
+    size_t index;
+    if (!json_is_array(parent) ||
+        !ParseIndex(last, json_array_size(parent), false, index)) {
+        return false;
+    }
+    json_t* old = json_array_get(parent, index);
+    if (removed) *removed = json_incref(old);
+    Record(kArrayRemove, parent, "", index, old);
+    Touch(parent, old);
+    return json_array_remove(parent, index) == 0;
+}
+
+/* Steals value. */
+bool JsonPatcher::Replace(const std::vector<std::string>& tokens,
+                          json_t* value) {
+    if (value == 0) return false;
+    if (tokens.empty()) {
+        SetRoot(value);
+        return true;
+    }
+
+    json_t* parent;
+    json_t* old = Get(tokens);
+    if (old == 0 || !Locate(tokens, tokens.size() - 1, parent)) {
+        json_decref(value);
+        return false;
+    }
+
+    const std::string& last = tokens.back();
+    if (json_is_object(parent)) {
+        Record(kObjectSet, parent, last, 0, old);
+        Touch(parent, old);
+        return json_object_set_new(parent, last.c_str(), value) == 0;
+    }
+
+    size_t index;
+    ParseIndex(last, json_array_size(parent), false, index);
+    Record(kArraySet, parent, "", index, old);
+    Touch(parent, old);
+    return json_array_set_new(parent, index, value) == 0;
+}
+
+/*
+ * Applies one operation object.
+ * @return bool. False if the operation is malformed, names a location that
+ * does not exist, or is a "test" that does not hold.
+ * */
+bool JsonPatcher::Apply(json_t* op) {
+    const char* name = json_string_value(json_object_get(op, "op"));
+    std::vector<std::string> path, from;
+    const char* pointer = json_string_value(json_object_get(op, "path"));
+    if (name == 0 || !ParseJsonPointer(pointer, path)) return false;
+
+    json_t* value = json_object_get(op, "value");
+    if (strcmp(name, "add") == 0) {
+        return value && Add(path, json_deep_copy(value));
+    }
+    if (strcmp(name, "remove") == 0) {
+        return Remove(path, 0);
+    }
+    if (strcmp(name, "replace") == 0) {
+        return value && Replace(path, json_deep_copy(value));
+    }
+    if (strcmp(name, "test") == 0) {
+        json_t* current = Get(path);
+        return value && current && TestEqual(current, value);
+    }
+
+    pointer = json_string_value(json_object_get(op, "from"));
+    if (!ParseJsonPointer(pointer, from)) return false;
+
+    if (strcmp(name, "copy") == 0) {
+        json_t* source = Get(from);
+        return source && Add(path, json_deep_copy(source));
+    }
+    if (strcmp(name, "move") == 0) {
+        /* a value cannot be moved into one of its own children. */
+        if (from.size() < path.size() &&
+            std::equal(from.begin(), from.end(), path.begin())) {
+            return false;
+        }
+        if (from == path) return Get(from) != 0;
+
+        json_t* moved = 0;
+        if (!Remove(from, &moved)) {
+            if (moved) json_decref(moved);
+            return false;
+        }
+        return Add(path, moved);
+    }
+    return false;
+}
+
+/*
+ * Undoes every recorded change, newest first.
+ * */
+void JsonPatcher::Rollback() {
+    while (!m_Undo.empty()) {
+        Undo& undo = m_Undo.back();
+        json_t* container = undo.container;
+        if (undo.kind != kRoot) Touch(container, 0);
+
+        switch (undo.kind) {
+            case kObjectSet: {
+                json_t* current = json_object_get(container, undo.key.c_str());
+                if (current && m_Doc.m_Cache) m_Doc.m_Cache->Purge(current);
+                if (undo.old) {
+                    json_object_set_new(container, undo.key.c_str(), undo.old);
+                } else {
+                    json_object_del(container, undo.key.c_str());
+                }
+                break;
+            }
+            case kArrayInsert: {
+                json_t* current = json_array_get(container, undo.index);
+                if (current && m_Doc.m_Cache) m_Doc.m_Cache->Purge(current);
+                json_array_remove(container, undo.index);
+                break;
+            }
+            case kArrayRemove:
+                json_array_insert_new(container, undo.index, undo.old);
+                break;
+            case kArraySet: {
+                json_t* current = json_array_get(container, undo.index);
+                if (current && m_Doc.m_Cache) m_Doc.m_Cache->Purge(current);
+                json_array_set_new(container, undo.index, undo.old);
+                break;
+            }
+            case kRoot:
+                m_Doc.Clear();
+                m_Doc.m_Json = undo.old;
+                m_Doc.m_Cache = undo.cache;
+                m_Doc.m_Tree = undo.tree;
+                break;
+        }
+        m_Undo.pop_back();
+    }
+}
+
+/*
+ * Keeps every change and releases the values the undo log held on to.
+ * */
+void JsonPatcher::Commit() {
+    for (size_t i = 0; i < m_Undo.size(); ++i) {
+        if (m_Undo[i].old) json_decref(m_Undo[i].old);
+    }
+    m_Undo.clear();
+}
+
+/*!
+ * ApplyPatch function. Applies a JSON Patch (RFC 6902) to the json of this
+ * serializer in place. Either every operation is applied or, if one of them
+ * fails, none is.
+ * @param const reference to a serializer holding the array of operations.
+ * @return bool. True if the whole patch was applied. Otherwise false and the
+ * json is left unchanged.
+ * */
+bool JsonSerializer::ApplyPatch(const JsonSerializer& patch) {
+    patch.Sync();
+    if (!m_Json || !json_is_array(patch.m_Json)) return false;
+    if (!PrepareWrite()) return false;
+
+    JsonPatcher patcher(*this);
+    for (size_t i = 0; i < json_array_size(patch.m_Json); ++i) {
+        if (!patcher.Apply(json_array_get(patch.m_Json, i))) {
+            patcher.Rollback();
+            return false;
+        }
+    }
+    patcher.Commit();
+    return true;
+}
+
+/*!
+ * MergePatch function. Applies a JSON Merge Patch (RFC 7396) to the json of
+ * this serializer in place: members set to null in the patch are removed,
+ * objects are merged recursively and everything else is replaced.
+ * @param const reference to a serializer holding the merge patch.
+ * @return bool. True if the patch was applied. False if either side is empty
+ * or memory ran out part way through.
+ * */
+bool JsonSerializer::MergePatch(const JsonSerializer& patch) {
+    Sync();
+    patch.Sync();
+    if (!m_Json || !patch.m_Json) return false;
+
+    if (!json_is_object(patch.m_Json)) {
+        json_t* copy = json_deep_copy(patch.m_Json);
+        return copy ? Attach(copy) : false;
+    }
+
+    if (!json_is_object(m_Json)) {
+        json_t* object = json_object();
+        if (object == 0 || !Attach(object)) return false;
+    }
+
+    if (!PrepareWrite()) return false;
+    return MergeObject(m_Cache.get(), m_Json, patch.m_Json);
+}
+
+/*!
+ * Diff function. Computes the JSON Patch (RFC 6902) that turns the json of
+ * this serializer into the json of another one. Subtrees whose content
+ * hashes differ are descended into without being compared first, and
+ * subtrees that are the same node are skipped; subtrees with matching hashes
+ * are confirmed equal with a full comparison.
+ * @param const reference to the serializer holding the wanted json.
+ * @param reference to JsonSerializer. The patch, an array of operations, is
+ * returned in this variable.
+ * @return bool. True if the patch could be built. Otherwise false.
+ * */
+bool JsonSerializer::Diff(const JsonSerializer& target,
+                          JsonSerializer& patch) const {
+    Sync();
+    target.Sync();
+    if (!m_Json || !target.m_Json) return false;
+
+    json_t* ops = json_array();
+    if (ops == 0) return false;
+
+    if (!m_Cache) m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+    if (!target.m_Cache) {
+        target.m_Cache = std::make_shared<JsonNodeCache>(target.m_Json);
+    }
+
+    DiffHasher hasher(*m_Cache, *target.m_Cache);
+    std::string path;
+    if (!DiffNode(hasher, m_Json, target.m_Json, path, ops)) {
+        json_decref(ops);
+        return false;
+    }
+    return patch.Attach(ops);
+}
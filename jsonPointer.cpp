@@ -0,0 +1,92 @@
+/*!
+ * @file jsonPointer.cpp
+ * @brief JSON Pointer (RFC 6901) helpers shared by the JsonSerializer
+ * sources.
+ * $Id$
+ * */
+
+#include "jsonPointer.h"
+
+#include <sstream>
+
+/*!
+ * ParseJsonPointer function. Splits a JSON Pointer into its unescaped
+ * reference tokens.
+ * @param const pointer to the null terminated JSON Pointer.
+ * @param reference to a vector of strings. The tokens are returned in it.
+ * @return bool. False if the pointer is malformed.
+ * */
+bool ParseJsonPointer(const char* pointer, std::vector<std::string>& tokens) {
+    tokens.clear();
+    if (pointer == 0) return false;
+    if (*pointer == 0) return true;
+    if (*pointer != '/') return false;
+
+    std::string token;
+    for (const char* p = pointer + 1;; ++p) {
+        if (*p == '/' || *p == 0) {
+            tokens.push_back(token);
+            token.clear();
+            if (*p == 0) break;
+        } else if (*p == '~') {
+            ++p;
+            if (*p == '0')
+                token += '~';
+            else if (*p == '1')
+                token += '/';
+            else
+                return false;
+        } else {
+            token += *p;
+        }
+    }
+    return true;
+}
+
+/*!
+ * ParseJsonPointerIndex function. Converts a reference token to an array
+ * index. Leading zeros are not allowed and "-" is not an index.
+ * @param const reference to the token.
+ * @param reference to size_t. The index is returned in this variable.
+ * @return bool. False if the token is not an array index.
+ * */
+bool ParseJsonPointerIndex(const std::string& token, size_t& index) {
+    if (token.empty() || token.size() > 19) return false;
+    if (token.size() > 1 && token[0] == '0') return false;
+
+    index = 0;
+    for (size_t i = 0; i < token.size(); ++i) {
+        if (token[i] < '0' || token[i] > '9') return false;
+        index = index * 10 + (token[i] - '0');
+    }
+    return true;
+}
+
+/*!
+ * AppendJsonPointerToken function. Appends an object key to a JSON Pointer,
+ * escaping '~' and '/'.
+ * @param reference to the pointer being built.
+ * @param const pointer to the null terminated key.
+ * */
+void AppendJsonPointerToken(std::string& path, const char* key) {
+    path += '/';
+    for (; *key; ++key) {
+        if (*key == '~')
+            path += "~0";
+        else if (*key == '/')
+            path += "~1";
+        else
+            path += *key;
+    }
+}
+
+/*!
+ * AppendJsonPointerIndex function. Appends an array index to a JSON Pointer.
+ * @param reference to the pointer being built.
+ * @param size_t index.
+ * */
+void AppendJsonPointerIndex(std::string& path, size_t index) {
+    std::ostringstream oss;
+    oss << '/' << index;
+    path += oss.str();
+}
@@ -0,0 +1,20 @@
+/*!
+ * @file jsonPointer.h
+ * @brief JSON Pointer (RFC 6901) helpers shared by the JsonSerializer
+ * sources.
+ * $Id$
+ * */
+
+#ifndef JSONPOINTER_H
+#define JSONPOINTER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+bool ParseJsonPointer(const char* pointer, std::vector<std::string>& tokens);
+bool ParseJsonPointerIndex(const std::string& token, size_t& index);
+void AppendJsonPointerToken(std::string& path, const char* key);
+void AppendJsonPointerIndex(std::string& path, size_t index);
+
+#endif  // JSONPOINTER_H
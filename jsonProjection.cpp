@@ -0,0 +1,250 @@
+/*!
+ * @file jsonProjection.cpp
+ * @brief Projection parse support for JsonSerializer.
+ * Details. Only the values named by a set of JSON Pointers are decoded by
+ * jansson. Everything else is stepped over by JsonLexer, which checks the
+ * JSON grammar but allocates nothing, and the containers on the way to each
+ * requested value are rebuilt around it. Skipped values are not checked for
+ * valid UTF-8; the decoded ones are, by jansson.
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+#include "jsonLexer.h"
+#include "jsonPointer.h"
+
+#include <string.h>
+#include <map>
+
+/* Same default nesting limit jansson applies to the values it decodes. */
+#define PROJECTION_PARSE_MAX_DEPTH 2048
+
+namespace {
+
+/* One level of the set of requested pointers. */
+struct ProjectionNode {
+    ProjectionNode() : whole(false) {}
+
+    /* true if the value at this level is requested in full. */
+    bool whole;
+    std::map<std::string, ProjectionNode> members;
+    std::map<size_t, const ProjectionNode*> elements;
+};
+
+void IndexElements(ProjectionNode& node) {
+    for (std::map<std::string, ProjectionNode>::iterator it =
+             node.members.begin();
+         it != node.members.end(); ++it) {
+        size_t index;
+        if (ParseJsonPointerIndex(it->first, index)) {
+            node.elements[index] = &it->second;
+        }
+        IndexElements(it->second);
+    }
+}
+
+bool BuildProjection(const std::set<std::string>& pointers,
+                     ProjectionNode& root) {
+    std::vector<std::string> tokens;
+    for (std::set<std::string>::const_iterator it = pointers.begin();
+         it != pointers.end(); ++it) {
+        if (!ParseJsonPointer(it->c_str(), tokens)) return false;
+        ProjectionNode* node = &root;
+        for (size_t i = 0; i < tokens.size() && !node->whole; ++i) {
+            node = &node->members[tokens[i]];
+        }
+        node->whole = true;
+    }
+    IndexElements(root);
+    return true;
+}
+
+class ProjectionParser : private JsonLexer {
+   public:
+    ProjectionParser(const char* data, size_t len) : JsonLexer(data, len) {}
+
+    /* Parses the whole input; a document without any requested value
+     * yields an empty container of the root's type. */
+    json_t* ParseRoot(const ProjectionNode& root) {
+        SkipSpace();
+        if (m_Pos == m_Len || (m_Data[m_Pos] != '{' && m_Data[m_Pos] != '[')) {
+            return 0;
+        }
+        bool isObject = m_Data[m_Pos] == '{';
+
+        json_t* json = 0;
+        if (!Value(&root, 0, json)) return 0;
+        SkipSpace();
+        if (m_Pos != m_Len) {
+            json_decref(json);
+            return 0;
+        }
+        if (json == 0) json = isObject ? json_object() : json_array();
+        return json;
+    }
+
+   private:
+    /*
+     * Parses one value. node is the part of the projection at this value,
+     * null if nothing in it is requested. json is set to the projected
+     * value, or left null if the value holds nothing requested.
+     * */
+    bool Value(const ProjectionNode* node, int depth, json_t*& json) {
+        json = 0;
+        SkipSpace();
+        if (m_Pos == m_Len) return false;
+        char c = m_Data[m_Pos];
+        size_t begin = m_Pos;
+
+        if (c == '{' || c == '[') {
+            if (++depth > PROJECTION_PARSE_MAX_DEPTH) return false;
+            if (node && !node->whole) {
+                return c == '{' ? Object(*node, depth, json)
+                                : Array(*node, depth, json);
+            }
+            if (!(c == '{' ? Object(m_Skip, depth, json)
+                           : Array(m_Skip, depth, json))) {
+                return false;
+            }
+        } else if (c == '"') {
+            bool escaped;
+            if (!SkipString(escaped)) return false;
+        } else if (c == 't') {
+            if (!SkipLiteral("true")) return false;
+        } else if (c == 'f') {
+            if (!SkipLiteral("false")) return false;
+        } else if (c == 'n') {
+            if (!SkipLiteral("null")) return false;
+        } else if (!SkipNumber()) {
+            return false;
+        }
+
+        if (node && node->whole) {
+            json = json_loadb(m_Data + begin, m_Pos - begin, JSON_DECODE_ANY,
+                              NULL);
+            return json != 0;
+        }
+        return true;
+    }
+
+    bool Object(const ProjectionNode& node, int depth, json_t*& json) {
+        ++m_Pos;
+        SkipSpace();
+        if (m_Pos < m_Len && m_Data[m_Pos] == '}') {
+            ++m_Pos;
+            return true;
+        }
+
+        bool wanted = !node.members.empty();
+        std::string key;
+        for (;;) {
+            if (!ReadKey(key) || !Expect(':')) break;
+
+            const ProjectionNode* child = 0;
+            if (wanted) {
+                std::map<std::string, ProjectionNode>::const_iterator it =
+                    node.members.find(key);
+                if (it != node.members.end()) child = &it->second;
+            }
+
+            json_t* value;
+            if (!Value(child, depth, value)) break;
+            if (value) {
+                if (json == 0) json = json_object();
+                if (json_object_set_new(json, key.c_str(), value) == -1) break;
+            } else if (child && json) {
+                /* a key seen again replaces its earlier value, as in
+                 * jansson, even when nothing requested is left in it. */
+                json_object_del(json, key.c_str());
+                if (json_object_size(json) == 0) {
+                    json_decref(json);
+                    json = 0;
+                }
+            }
+
+            SkipSpace();
+            if (m_Pos == m_Len) break;
+            if (m_Data[m_Pos++] == '}') return true;
+            if (m_Data[m_Pos - 1] != ',') break;
+        }
+
+        json_decref(json);
+        json = 0;
+        return false;
+    }
+
+    /*
+     * Elements before a requested one are filled with null, so a pointer
+     * into the projection finds the same value it finds in the document.
+     * Elements after the last requested one are dropped.
+     * */
+    bool Array(const ProjectionNode& node, int depth, json_t*& json) {
+        ++m_Pos;
+        SkipSpace();
+        if (m_Pos < m_Len && m_Data[m_Pos] == ']') {
+            ++m_Pos;
+            return true;
+        }
+
+        for (size_t index = 0;; ++index) {
+            const ProjectionNode* child = 0;
+            if (!node.elements.empty()) {
+                std::map<size_t, const ProjectionNode*>::const_iterator it =
+                    node.elements.find(index);
+                if (it != node.elements.end()) child = it->second;
+            }
+
+            json_t* value;
+            if (!Value(child, depth, value)) break;
+            if (value) {
+                if (json == 0) json = json_array();
+                while (json_array_size(json) < index) {
+                    json_array_append_new(json, json_null());
+                }
+                if (json_array_append_new(json, value) == -1) break;
+            }
+
+            SkipSpace();
+            if (m_Pos == m_Len) break;
+            if (m_Data[m_Pos++] == ']') return true;
+            if (m_Data[m_Pos - 1] != ',') break;
+        }
+
+        json_decref(json);
+        json = 0;
+        return false;
+    }
+
+    /* members */
+    /* projection of a value nothing is requested from. */
+    const ProjectionNode m_Skip;
+};
+
+}  // namespace
+
+/*!
+ * function Parse. Projection form of Parse. Only the values named by the
+ * projection are decoded; the rest of the input is checked and stepped over
+ * without building any jansson nodes for it. The resulting json holds the
+ * requested values at their original pointers, inside objects and arrays
+ * that only hold what was requested. Requested pointers that do not exist
+ * in the input are left out.
+ * @param const pointer to the json formatted data stream.
+ * @param size_t length of the data stream.
+ * @param const reference to a set of JSON Pointers (RFC 6901) naming the
+ * values wanted. "" names the whole document.
+ * @return bool. True if the data is in correct format and every pointer is
+ * well formed. False otherwise
+ * */
+bool JsonSerializer::Parse(const char* data, size_t len,
+                           const std::set<std::string>& projection) {
+    Clear();
+    ProjectionNode root;
+    if (data == 0 || !BuildProjection(projection, root)) return false;
+    if (root.whole) {
+        return Attach(json_loadb(data, len, 0, NULL));
+    }
+
+    ProjectionParser parser(data, len);
+    return Attach(parser.ParseRoot(root));
+}
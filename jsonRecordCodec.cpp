@@ -0,0 +1,67 @@
+/*!
+ * @file jsonRecordCodec.cpp
+ * @brief Non template support of JsonRecordCodec.
+ * Details. See jsonRecordCodec.h.
+ * $Id$
+ * */
+
+#include "jsonRecordCodec.h"
+#include "jsonThreadPool.h"
+
+#include <atomic>
+#include <thread>
+
+/*!
+ * IsValidJsonKey function.
+ * @param const reference to the key.
+ * @return bool. True if jansson accepts key as an object key, i.e. it is
+ * valid UTF-8 without NUL bytes.
+ * */
+bool IsValidJsonKey(const std::string& key) {
+    if (key.find('\0') != std::string::npos) return false;
+    json_t* json = json_string(key.c_str());
+    if (json == 0) return false;
+    json_decref(json);
+    return true;
+}
+
+/*!
+ * RunRecordBatch function. Calls work on consecutive blocks of at most
+ * RECORD_BATCH_BLOCK records covering [0, count). Batches of at least
+ * RECORD_BATCH_PARALLEL_MIN records are shared between the calling thread and
+ * workers of the library's thread pool, so work must be safe to call
+ * concurrently on different blocks.
+ * @param size_t count of records.
+ * @param unsigned int threads. Most threads to use, the calling one included,
+ * 0 for one per core.
+ * @param const reference to the work, called with the first and one past the
+ * last record of a block. Returning false from it stops the batch.
+ * @return bool. True if every block was worked on and none failed.
+ * */
+bool RunRecordBatch(
+    size_t count, unsigned int threads,
+    const std::function<bool(size_t first, size_t last)>& work) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    size_t blocks = (count + RECORD_BATCH_BLOCK - 1) / RECORD_BATCH_BLOCK;
+    if (threads > blocks) threads = blocks;
+
+    if (count < RECORD_BATCH_PARALLEL_MIN || threads <= 1) {
+        return count == 0 || work(0, count);
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::function<void()> worker = [&]() {
+        while (!failed.load(std::memory_order_relaxed)) {
+            size_t b = next.fetch_add(1);
+            if (b >= blocks) break;
+            size_t first = b * RECORD_BATCH_BLOCK;
+            size_t last = first + RECORD_BATCH_BLOCK;
+            if (last > count) last = count;
+            if (!work(first, last)) failed = true;
+        }
+    };
+
+    JsonThreadPool::Instance().Parallel(threads - 1, worker, worker);
+    return !failed;
+}
@@ -0,0 +1,274 @@
+/*!
+ * @file jsonRecordCodec.h
+ * @brief This contains the class template that encodes a whole vector of
+ * records to a json array and decodes it back in one call.
+ * Details. A JsonRecordCodec is set up once with the key and the member of
+ * every field of the record type, then used for any number of batches. The
+ * json of each record is built directly, without a JsonSerializer per record:
+ * keys are checked once when the field is added, numbers are converted
+ * without iostreams as in GetValue/PutValue, and the few values that still
+ * need a stream share one per block of records. Batches of at least
+ * RECORD_BATCH_PARALLEL_MIN records are split into blocks that are encoded or
+ * decoded on the library's thread pool, see jsonThreadPool.h.
+ * Field members may be std::string, bool or any arithmetic type other than
+ * the character types and long double.
+ * $Id$
+ * */
+
+#ifndef JSONRECORDCODEC_H
+#define JSONRECORDCODEC_H
+
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "public/JSonSerializer.h"
+
+/* Batches with fewer records than this are handled on the calling thread. */
+#define RECORD_BATCH_PARALLEL_MIN 16384
+
+/* Records handed to one worker at a time. */
+#define RECORD_BATCH_BLOCK 2048
+
+bool IsValidJsonKey(const std::string& key);
+bool RunRecordBatch(size_t count, unsigned int threads,
+                    const std::function<bool(size_t first, size_t last)>& work);
+
+template <typename Record>
+class JsonRecordCodec {
+   public:
+    JsonRecordCodec() : m_Valid(true) {}
+
+    /*!
+     * Field function. Adds a field of the record type.
+     * @param const reference to the key of the field in the json object.
+     * @param pointer to the member holding the field.
+     * @param bool required. If true Get fails for an object without the
+     * key; otherwise the member is left as the default constructed record
+     * has it.
+     * @return reference to this codec. A key that is not valid UTF-8 makes
+     * every Put and Get fail.
+     * */
+    template <typename T>
+    JsonRecordCodec& Field(const std::string& key, T Record::*member,
+                           bool required = false) {
+        static_assert(std::is_same<T, std::string>::value ||
+                          std::is_same<T, bool>::value ||
+                          JsonSerializer::IsFastNumber<T>::value,
+                      "field type not supported by JsonRecordCodec");
+        if (!IsValidJsonKey(key)) m_Valid = false;
+        m_Fields.push_back(std::shared_ptr<FieldBase>(
+            new MemberField<T>(key, member, required)));
+        return *this;
+    }
+
+    /*!
+     * Put function. Encodes records to an array of objects, one per record,
+     * and stores it in json under key as PutCollection does. With an empty
+     * key an empty serializer gets the array as its root instead.
+     * @param reference to the serializer to store the array in.
+     * @param const reference to the key.
+     * @param const pointer to the first record.
+     * @param size_t count of records.
+     * @param unsigned int threads. Most threads to use, the calling one
+     * included, 0 for one per core.
+     * @return bool. True if every record was encoded and the array stored.
+     * */
+    bool Put(JsonSerializer& json, const std::string& key,
+             const Record* records, size_t count,
+             unsigned int threads = 0) const {
+        json.Sync();
+        bool asRoot = !json.m_Json && key.empty();
+        if (!m_Valid || (!asRoot && !json_is_object(json.m_Json))) {
+            return false;
+        }
+
+        std::vector<json_t*> elements(count, (json_t*)0);
+        bool ok = RunRecordBatch(
+            count, threads, [&](size_t first, size_t last) {
+                std::ostringstream oss;
+                for (size_t i = first; i < last; ++i) {
+                    elements[i] = Encode(records[i], oss);
+                    if (elements[i] == 0) return false;
+                }
+                return true;
+            });
+
+        json_t* array = ok ? json_array() : 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (array && json_array_append_new(array, elements[i]) == -1) {
+                json_decref(array);
+                array = 0;
+            } else if (array == 0 && elements[i]) {
+                json_decref(elements[i]);
+            }
+        }
+        if (array == 0) return false;
+
+        if (asRoot) return json.Attach(array);
+        return json.SetMember(key, array);
+    }
+
+    bool Put(JsonSerializer& json, const std::string& key,
+             const std::vector<Record>& records,
+             unsigned int threads = 0) const {
+        return Put(json, key, records.empty() ? 0 : &records[0],
+                   records.size(), threads);
+    }
+
+    /*!
+     * Get function. Decodes an array of objects, found under key as
+     * GetCollection finds it, into one record per element. records is
+     * cleared first.
+     * @param const reference to the serializer holding the array.
+     * @param const reference to the key, "" for the root.
+     * @param reference to the vector the records are returned in.
+     * @param unsigned int threads. Most threads to use, the calling one
+     * included, 0 for one per core.
+     * @return bool. True if every element is an object whose fields convert
+     * and that has every required field. Otherwise false, and the contents
+     * of records are unspecified.
+     * */
+    bool Get(const JsonSerializer& json, const std::string& key,
+             std::vector<Record>& records, unsigned int threads = 0) const {
+        records.clear();
+        json.Sync();
+        if (!m_Valid || !json.m_Json) return false;
+
+        json_t* array = json.m_Json;
+        if (!key.empty()) {
+            if (!json_is_object(array)) return false;
+            array = json_object_get(array, key.c_str());
+        }
+        if (!json_is_array(array)) return false;
+
+        records.resize(json_array_size(array));
+        return RunRecordBatch(
+            records.size(), threads, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    if (!Decode(json_array_get(array, i), records[i])) {
+                        return false;
+                    }
+                }
+                return true;
+            });
+    }
+
+   private:
+    struct FieldBase {
+        FieldBase(const std::string& k, bool r) : key(k), required(r) {}
+        virtual ~FieldBase() {}
+
+        virtual json_t* Encode(const Record& record,
+                               std::ostringstream& oss) const = 0;
+        virtual bool Decode(json_t* value, Record& record) const = 0;
+
+        std::string key;
+        bool required;
+    };
+
+    template <typename T>
+    struct MemberField : FieldBase {
+        MemberField(const std::string& k, T Record::*m, bool r)
+            : FieldBase(k, r), member(m) {}
+
+        json_t* Encode(const Record& record, std::ostringstream& oss) const {
+            return EncodeValue(record.*member, oss);
+        }
+        bool Decode(json_t* value, Record& record) const {
+            return DecodeValue(value, record.*member);
+        }
+
+        T Record::*member;
+    };
+
+    static json_t* EncodeValue(const std::string& value, std::ostringstream&) {
+        return json_stringn(value.c_str(), value.size());
+    }
+
+    /* as PutValue, which streams a bool as 0 or 1. */
+    static json_t* EncodeValue(bool value, std::ostringstream&) {
+        return json_integer(value ? 1 : 0);
+    }
+
+    /* as PutValue: numbers jansson cannot hold exactly are stored as the
+     * text iostreams give them. */
+    template <typename T>
+    static json_t* EncodeValue(const T& value, std::ostringstream& oss) {
+        json_t* number = JsonSerializer::MakeNumber(value);
+        if (number) return number;
+
+        oss.str("");
+        oss.clear();
+        if ((oss << value).fail()) return 0;
+        return json_string(oss.str().c_str());
+    }
+
+    static bool DecodeValue(json_t* item, std::string& value) {
+        if (!json_is_string(item)) return false;
+        value.assign(json_string_value(item), json_string_length(item));
+        return true;
+    }
+
+    static bool DecodeValue(json_t* item, bool& value) {
+        if (json_is_boolean(item)) {
+            value = json_is_true(item);
+            return true;
+        }
+        if (json_is_integer(item) && (json_integer_value(item) == 0 ||
+                                      json_integer_value(item) == 1)) {
+            value = json_integer_value(item) == 1;
+            return true;
+        }
+        return false;
+    }
+
+    /* numbers, and strings holding plain decimal numbers, as GetValue
+     * converts them without its iostream fallback. */
+    template <typename T>
+    static bool DecodeValue(json_t* item, T& value) {
+        return JsonSerializer::GetNumber(JsonNodeItem(item), value);
+    }
+
+    json_t* Encode(const Record& record, std::ostringstream& oss) const {
+        json_t* object = json_object();
+        if (object == 0) return 0;
+
+        for (size_t f = 0; f < m_Fields.size(); ++f) {
+            const FieldBase& field = *m_Fields[f];
+            /* the keys were checked when the fields were added. */
+            json_t* value = field.Encode(record, oss);
+            if (value == 0 || json_object_set_new_nocheck(
+                                  object, field.key.c_str(), value) == -1) {
+                json_decref(object);
+                return 0;
+            }
+        }
+        return object;
+    }
+
+    bool Decode(json_t* object, Record& record) const {
+        if (!json_is_object(object)) return false;
+
+        for (size_t f = 0; f < m_Fields.size(); ++f) {
+            const FieldBase& field = *m_Fields[f];
+            json_t* value = json_object_get(object, field.key.c_str());
+            if (value == 0) {
+                if (field.required) return false;
+                continue;
+            }
+            if (!field.Decode(value, record)) return false;
+        }
+        return true;
+    }
+
+    /* members */
+    std::vector<std::shared_ptr<FieldBase> > m_Fields;
+    /* false once a field with an invalid key was added. */
+    bool m_Valid;
+};
+
+#endif  // JSONRECORDCODEC_H
@@ -0,0 +1,588 @@
+/*!
+ * @file jsonSchema.cpp
+ * @brief This contains the class that validates the json held by a
+ * JsonSerializer and extracts typed values from it in the same pass.
+ * Details. Compile understands the following subset of JSON Schema: type,
+ * properties, required, additionalProperties (true or false), items (a single
+ * schema), minimum, maximum, exclusiveMinimum, exclusiveMaximum (number or,
+ * as in draft 4, boolean), minLength, maxLength, minItems and maxItems.
+ * Annotations such as title, description or format are ignored; any other
+ * keyword makes Compile fail rather than silently accept documents the
+ * schema would reject.
+ * $Id$
+ * */
+
+#include "jsonSchema.h"
+#include "jsonPointer.h"
+
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+namespace {
+
+const char* const kSupportedKeywords[] = {
+    "type",     "properties", "required",         "additionalProperties",
+    "items",    "minimum",    "maximum",          "exclusiveMinimum",
+    "exclusiveMaximum",       "minLength",        "maxLength",
+    "minItems", "maxItems"};
+
+/* Keywords that do not constrain what validates. */
+const char* const kAnnotationKeywords[] = {
+    "$schema",  "$id",      "id",       "$comment", "title",
+    "description", "default", "examples", "format", "readOnly",
+    "writeOnly", "deprecated", "$defs",  "definitions"};
+
+template <size_t N>
+bool IsKeyword(const char* key, const char* const (&keywords)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+        if (strcmp(key, keywords[i]) == 0) return true;
+    }
+    return false;
+}
+
+void Report(std::vector<JsonSchemaViolation>* violations,
+            const std::string& path, const std::string& message) {
+    if (violations == 0) return;
+    JsonSchemaViolation violation;
+    violation.path = path;
+    violation.message = message;
+    violations->push_back(violation);
+}
+
+std::string TypeNames(int types) {
+    static const char* const kNames[] = {"object",  "array",   "string",
+                                         "integer", "number",  "boolean",
+                                         "null"};
+    std::string names;
+    for (int i = 0; i < 7; ++i) {
+        if (types & (1 << i)) {
+            if (!names.empty()) names += " or ";
+            names += kNames[i];
+        }
+    }
+    return names;
+}
+
+bool Accepts(int types, json_t* json) {
+    if (types == JsonSchema::kAny) return true;
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            return types & JsonSchema::kObject;
+        case JSON_ARRAY:
+            return types & JsonSchema::kArray;
+        case JSON_STRING:
+            return types & JsonSchema::kString;
+        case JSON_INTEGER:
+            return types & (JsonSchema::kInteger | JsonSchema::kNumber);
+        case JSON_REAL: {
+            /* JSON Schema counts 1.0 as an integer. */
+            double value = json_real_value(json);
+            if (types & JsonSchema::kNumber) return true;
+            return (types & JsonSchema::kInteger) && floor(value) == value;
+        }
+        case JSON_TRUE:
+        case JSON_FALSE:
+            return types & JsonSchema::kBoolean;
+        case JSON_NULL:
+            return types & JsonSchema::kNull;
+    }
+    return false;
+}
+
+/* Length of a UTF-8 string in code points, as minLength counts it. */
+size_t CodePoints(json_t* json) {
+    const char* s = json_string_value(json);
+    size_t len = json_string_length(json);
+    size_t count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if ((s[i] & 0xC0) != 0x80) ++count;
+    }
+    return count;
+}
+
+bool ParseType(json_t* type, int& types) {
+    static const char* const kNames[] = {"object",  "array",   "string",
+                                         "integer", "number",  "boolean",
+                                         "null"};
+    const char* name = json_string_value(type);
+    if (name == 0) return false;
+    for (int i = 0; i < 7; ++i) {
+        if (strcmp(name, kNames[i]) == 0) {
+            types |= 1 << i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseCount(json_t* json, size_t& count) {
+    if (!json_is_integer(json) || json_integer_value(json) < 0) return false;
+    count = (size_t)json_integer_value(json);
+    return true;
+}
+
+}  // namespace
+
+/*!
+ * default no param constructor. The schema accepts any json until it is
+ * compiled or built up.
+ * */
+JsonSchema::JsonSchema() { Reset(); }
+
+/*!
+ * Destructor
+ * */
+JsonSchema::~JsonSchema() {}
+
+void JsonSchema::Reset() {
+    m_Types = kAny;
+    m_HasMin = m_HasMax = m_ExclusiveMin = m_ExclusiveMax = false;
+    m_Min = m_Max = 0;
+    m_MinLength = m_MinItems = 0;
+    m_MaxLength = m_MaxItems = (size_t)-1;
+    m_AdditionalProperties = true;
+    m_Members.clear();
+    m_Items.reset();
+    m_BindKind = kBindNone;
+    m_Bound = 0;
+}
+
+/*!
+ * Compile function. Builds this schema from a JSON Schema document, dropping
+ * whatever it held before. Values can be bound afterwards by looking the
+ * compiled nodes up with Property and Items.
+ * @param const reference to a serializer holding the JSON Schema.
+ * @return bool. True if the schema only uses the supported subset. Otherwise
+ * false and this schema accepts any json.
+ * */
+bool JsonSchema::Compile(const JsonSerializer& schema) {
+    Reset();
+    schema.Sync();
+    if (schema.m_Json && CompileNode(schema.m_Json)) return true;
+    Reset();
+    return false;
+}
+
+bool JsonSchema::CompileNode(json_t* schema) {
+    if (json_is_true(schema)) return true;
+    if (!json_is_object(schema)) return false;
+
+    for (void* iter = json_object_iter(schema); iter;
+         iter = json_object_iter_next(schema, iter)) {
+        const char* key = json_object_iter_key(iter);
+        if (!IsKeyword(key, kSupportedKeywords) &&
+            !IsKeyword(key, kAnnotationKeywords)) {
+            return false;
+        }
+    }
+
+    json_t* type = json_object_get(schema, "type");
+    if (json_is_array(type)) {
+        for (size_t i = 0; i < json_array_size(type); ++i) {
+            if (!ParseType(json_array_get(type, i), m_Types)) return false;
+        }
+    } else if (type && !ParseType(type, m_Types)) {
+        return false;
+    }
+
+    json_t* value = json_object_get(schema, "minimum");
+    if (value) {
+        if (!json_is_number(value)) return false;
+        Minimum(json_number_value(value));
+    }
+    value = json_object_get(schema, "maximum");
+    if (value) {
+        if (!json_is_number(value)) return false;
+        Maximum(json_number_value(value));
+    }
+    value = json_object_get(schema, "exclusiveMinimum");
+    if (json_is_boolean(value)) {
+        m_ExclusiveMin = m_HasMin && json_is_true(value);
+    } else if (json_is_number(value)) {
+        /* applies on top of minimum, so the tighter of the two is kept. */
+        double bound = json_number_value(value);
+        if (!m_HasMin || bound >= m_Min) Minimum(bound, true);
+    } else if (value) {
+        return false;
+    }
+    value = json_object_get(schema, "exclusiveMaximum");
+    if (json_is_boolean(value)) {
+        m_ExclusiveMax = m_HasMax && json_is_true(value);
+    } else if (json_is_number(value)) {
+        double bound = json_number_value(value);
+        if (!m_HasMax || bound <= m_Max) Maximum(bound, true);
+    } else if (value) {
+        return false;
+    }
+
+    if ((value = json_object_get(schema, "minLength")) &&
+        !ParseCount(value, m_MinLength)) {
+        return false;
+    }
+    if ((value = json_object_get(schema, "maxLength")) &&
+        !ParseCount(value, m_MaxLength)) {
+        return false;
+    }
+    if ((value = json_object_get(schema, "minItems")) &&
+        !ParseCount(value, m_MinItems)) {
+        return false;
+    }
+    if ((value = json_object_get(schema, "maxItems")) &&
+        !ParseCount(value, m_MaxItems)) {
+        return false;
+    }
+
+    value = json_object_get(schema, "additionalProperties");
+    if (json_is_boolean(value)) {
+        m_AdditionalProperties = json_is_true(value);
+    } else if (value) {
+        return false;
+    }
+
+    json_t* properties = json_object_get(schema, "properties");
+    if (properties) {
+        if (!json_is_object(properties)) return false;
+        for (void* iter = json_object_iter(properties); iter;
+             iter = json_object_iter_next(properties, iter)) {
+            if (!Property(json_object_iter_key(iter))
+                     .CompileNode(json_object_iter_value(iter))) {
+                return false;
+            }
+        }
+    }
+
+    json_t* required = json_object_get(schema, "required");
+    if (required) {
+        if (!json_is_array(required)) return false;
+        for (size_t i = 0; i < json_array_size(required); ++i) {
+            const char* key = json_string_value(json_array_get(required, i));
+            if (key == 0) return false;
+            Property(key, true);
+        }
+    }
+
+    json_t* items = json_object_get(schema, "items");
+    if (items && !Items().CompileNode(items)) return false;
+
+    return true;
+}
+
+/*!
+ * Type function. Restricts the json types this schema node accepts.
+ * @param int types. kObject, kArray etc. combined with |. kNumber accepts
+ * integers too; kInteger accepts reals with no fractional part.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::Type(int types) {
+    m_Types = types;
+    return *this;
+}
+
+/*!
+ * Minimum function. Lower bound for numbers.
+ * @param double value. The bound.
+ * @param bool exclusive. True if the bound itself is not allowed.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::Minimum(double value, bool exclusive) {
+    m_HasMin = true;
+    m_Min = value;
+    m_ExclusiveMin = exclusive;
+    return *this;
+}
+
+/*!
+ * Maximum function. Upper bound for numbers.
+ * @param double value. The bound.
+ * @param bool exclusive. True if the bound itself is not allowed.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::Maximum(double value, bool exclusive) {
+    m_HasMax = true;
+    m_Max = value;
+    m_ExclusiveMax = exclusive;
+    return *this;
+}
+
+/*!
+ * Length function. Bounds for the length of strings, in code points.
+ * @param size_t min. Shortest length allowed.
+ * @param size_t max. Longest length allowed.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::Length(size_t min, size_t max) {
+    m_MinLength = min;
+    m_MaxLength = max;
+    return *this;
+}
+
+/*!
+ * ItemCount function. Bounds for the number of elements of arrays.
+ * @param size_t min. Fewest elements allowed.
+ * @param size_t max. Most elements allowed.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::ItemCount(size_t min, size_t max) {
+    m_MinItems = min;
+    m_MaxItems = max;
+    return *this;
+}
+
+/*!
+ * AdditionalProperties function. Whether objects may have members that no
+ * Property of this schema node names.
+ * @param bool allowed.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::AdditionalProperties(bool allowed) {
+    m_AdditionalProperties = allowed;
+    return *this;
+}
+
+/*!
+ * Property function. Schema node for one member of objects, created if this
+ * schema node does not have one yet.
+ * @param const reference to string which is the key of the member.
+ * @param bool required. True if objects must have the member. A member once
+ * required stays required.
+ * @return reference to the schema node of the member.
+ * */
+JsonSchema& JsonSchema::Property(const std::string& key, bool required) {
+    for (size_t i = 0; i < m_Members.size(); ++i) {
+        if (m_Members[i].key == key) {
+            m_Members[i].required = m_Members[i].required || required;
+            return *m_Members[i].schema;
+        }
+    }
+
+    Member member;
+    member.key = key;
+    member.required = required;
+    member.schema.reset(new JsonSchema());
+    m_Members.push_back(member);
+    return *m_Members.back().schema;
+}
+
+/*!
+ * Items function. Schema node every element of arrays must satisfy, created
+ * if this schema node does not have one yet.
+ * @return reference to the schema node of the elements.
+ * */
+JsonSchema& JsonSchema::Items() {
+    if (!m_Items) m_Items.reset(new JsonSchema());
+    return *m_Items;
+}
+
+/*!
+ * Bind functions. The value validated by this schema node is stored in the
+ * passed variable during Validate. A node whose type was not restricted yet
+ * is restricted to the json types that convert to the variable. A node
+ * under Items checks every element, so its variable is left holding the
+ * last element that passed; to get them all, bind the array's own node to
+ * a JsonSerializer and take its GetCollection. An integer variable bound to
+ * a node that also allows reals, e.g. Type(kNumber), takes reals with no
+ * fractional part; any other real fails validation.
+ * @param pointer to the variable. It must outlive every call to Validate.
+ * @return reference to this schema node.
+ * */
+JsonSchema& JsonSchema::Bind(std::string* value) {
+    if (m_Types == kAny) m_Types = kString;
+    m_BindKind = kBindString;
+    m_Bound = value;
+    return *this;
+}
+
+JsonSchema& JsonSchema::Bind(int* value) {
+    if (m_Types == kAny) m_Types = kInteger;
+    m_BindKind = kBindInt;
+    m_Bound = value;
+    return *this;
+}
+
+JsonSchema& JsonSchema::Bind(long long* value) {
+    if (m_Types == kAny) m_Types = kInteger;
+    m_BindKind = kBindLongLong;
+    m_Bound = value;
+    return *this;
+}
+
+JsonSchema& JsonSchema::Bind(double* value) {
+    if (m_Types == kAny) m_Types = kNumber;
+    m_BindKind = kBindDouble;
+    m_Bound = value;
+    return *this;
+}
+
+JsonSchema& JsonSchema::Bind(bool* value) {
+    if (m_Types == kAny) m_Types = kBoolean;
+    m_BindKind = kBindBool;
+    m_Bound = value;
+    return *this;
+}
+
+JsonSchema& JsonSchema::Bind(JsonSerializer* value) {
+    m_BindKind = kBindSerializer;
+    m_Bound = value;
+    return *this;
+}
+
+/*!
+ * Validate function. Checks the json of a serializer against this schema in
+ * one walk over the document, storing every bound value that passes on the
+ * way. A value that fails its check is not stored.
+ * @param const reference to the serializer to check.
+ * @param pointer to a vector of violations. Every violation found is added to
+ * it. If null, Validate stops at the first violation.
+ * @return bool. True if the json satisfies the schema. Otherwise false.
+ * */
+bool JsonSchema::Validate(const JsonSerializer& json,
+                          std::vector<JsonSchemaViolation>* violations) const {
+    std::string path;
+    json.Sync();
+    if (json.m_Json == 0) {
+        Report(violations, path, "no json to validate");
+        return false;
+    }
+    return Check(json.m_Json, json, path, violations);
+}
+
+const JsonSchema::Member* JsonSchema::FindMember(const char* key) const {
+    for (size_t i = 0; i < m_Members.size(); ++i) {
+        if (m_Members[i].key == key) return &m_Members[i];
+    }
+    return 0;
+}
+
+bool JsonSchema::Check(json_t* json, const JsonSerializer& document,
+                       std::string& path,
+                       std::vector<JsonSchemaViolation>* violations) const {
+    if (!Accepts(m_Types, json)) {
+        Report(violations, path, "expected " + TypeNames(m_Types));
+        return false;
+    }
+
+    bool ok = true;
+    if (json_is_number(json)) {
+        double value = json_number_value(json);
+        if (m_HasMin && (value < m_Min || (m_ExclusiveMin && value == m_Min))) {
+            Report(violations, path, "below minimum");
+            ok = false;
+        }
+        if (m_HasMax && (value > m_Max || (m_ExclusiveMax && value == m_Max))) {
+            Report(violations, path, "above maximum");
+            ok = false;
+        }
+    } else if (json_is_string(json)) {
+        size_t length = CodePoints(json);
+        if (length < m_MinLength) {
+            Report(violations, path, "shorter than minLength");
+            ok = false;
+        }
+        if (length > m_MaxLength) {
+            Report(violations, path, "longer than maxLength");
+            ok = false;
+        }
+    } else if (json_is_array(json)) {
+        size_t sz = json_array_size(json);
+        if (sz < m_MinItems) {
+            Report(violations, path, "fewer items than minItems");
+            ok = false;
+        }
+        if (sz > m_MaxItems) {
+            Report(violations, path, "more items than maxItems");
+            ok = false;
+        }
+
+        size_t length = path.size();
+        for (size_t i = 0; m_Items && i < sz && (ok || violations); ++i) {
+            AppendJsonPointerIndex(path, i);
+            if (!m_Items->Check(json_array_get(json, i), document, path,
+                                violations)) {
+                ok = false;
+            }
+            path.resize(length);
+        }
+    } else if (json_is_object(json)) {
+        size_t length = path.size();
+        for (size_t i = 0; i < m_Members.size() && (ok || violations); ++i) {
+            const Member& member = m_Members[i];
+            json_t* value = json_object_get(json, member.key.c_str());
+            AppendJsonPointerToken(path, member.key.c_str());
+            if (value == 0) {
+                if (member.required) {
+                    Report(violations, path, "required property missing");
+                    ok = false;
+                }
+            } else if (!member.schema->Check(value, document, path,
+                                             violations)) {
+                ok = false;
+            }
+            path.resize(length);
+        }
+
+        if (!m_AdditionalProperties) {
+            for (void* iter = json_object_iter(json);
+                 iter && (ok || violations);
+                 iter = json_object_iter_next(json, iter)) {
+                const char* key = json_object_iter_key(iter);
+                if (FindMember(key)) continue;
+                AppendJsonPointerToken(path, key);
+                Report(violations, path, "additional property not allowed");
+                path.resize(length);
+                ok = false;
+            }
+        }
+    }
+
+    if (ok && !Extract(json, document)) {
+        Report(violations, path, "does not fit the bound variable");
+        ok = false;
+    }
+    return ok;
+}
+
+bool JsonSchema::Extract(json_t* json, const JsonSerializer& document) const {
+    switch (m_BindKind) {
+        case kBindNone:
+            return true;
+        case kBindString:
+            if (!json_is_string(json)) return false;
+            static_cast<std::string*>(m_Bound)->assign(
+                json_string_value(json), json_string_length(json));
+            return true;
+        case kBindInt:
+        case kBindLongLong: {
+            long long value;
+            if (json_is_integer(json)) {
+                value = json_integer_value(json);
+            } else if (json_is_real(json) &&
+                       fabs(json_real_value(json)) < 9.2e18 &&
+                       floor(json_real_value(json)) == json_real_value(json)) {
+                /* a real is only taken if it has no fractional part. */
+                value = (long long)json_real_value(json);
+            } else {
+                return false;
+            }
+            if (m_BindKind == kBindLongLong) {
+                *static_cast<long long*>(m_Bound) = value;
+                return true;
+            }
+            if (value < INT_MIN || value > INT_MAX) return false;
+            *static_cast<int*>(m_Bound) = (int)value;
+            return true;
+        }
+        case kBindDouble:
+            if (!json_is_number(json)) return false;
+            *static_cast<double*>(m_Bound) = json_number_value(json);
+            return true;
+        case kBindBool:
+            if (!json_is_boolean(json)) return false;
+            *static_cast<bool*>(m_Bound) = json_is_true(json);
+            return true;
+        case kBindSerializer:
+            *static_cast<JsonSerializer*>(m_Bound) = document.Derive(json);
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,105 @@
+/*!
+ * @file jsonSchema.h
+ * @brief This contains the class that validates the json held by a
+ * JsonSerializer and extracts typed values from it in the same pass.
+ * Details. A JsonSchema is built once, either with the builder functions or
+ * by compiling a JSON Schema document, and can then check any number of
+ * documents. Every value a schema node is bound to is filled in while the
+ * document is walked, and every violation is reported with the JSON Pointer
+ * of the offending value rather than just the first one.
+ * $Id$
+ * */
+
+#ifndef JSONSCHEMA_H
+#define JSONSCHEMA_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "public/JSonSerializer.h"
+
+/* One problem found by JsonSchema::Validate. */
+struct JsonSchemaViolation {
+    /* JSON Pointer of the offending value, "" for the root. */
+    std::string path;
+    std::string message;
+};
+
+class JsonSchema {
+   public:
+    /* Type flags, combined with | where more than one type is allowed. */
+    enum {
+        kAny = 0,
+        kObject = 1 << 0,
+        kArray = 1 << 1,
+        kString = 1 << 2,
+        kInteger = 1 << 3,
+        kNumber = 1 << 4,
+        kBoolean = 1 << 5,
+        kNull = 1 << 6
+    };
+
+    JsonSchema();
+    ~JsonSchema();
+
+    bool Compile(const JsonSerializer& schema);
+    JsonSchema& Type(int types);
+    JsonSchema& Minimum(double value, bool exclusive = false);
+    JsonSchema& Maximum(double value, bool exclusive = false);
+    JsonSchema& Length(size_t min, size_t max);
+    JsonSchema& ItemCount(size_t min, size_t max);
+    JsonSchema& AdditionalProperties(bool allowed);
+    JsonSchema& Property(const std::string& key, bool required = false);
+    JsonSchema& Items();
+    JsonSchema& Bind(std::string* value);
+    JsonSchema& Bind(int* value);
+    JsonSchema& Bind(long long* value);
+    JsonSchema& Bind(double* value);
+    JsonSchema& Bind(bool* value);
+    JsonSchema& Bind(JsonSerializer* value);
+    bool Validate(const JsonSerializer& json,
+                  std::vector<JsonSchemaViolation>* violations = 0) const;
+
+   private:
+    JsonSchema(const JsonSchema&);
+    JsonSchema& operator=(const JsonSchema&);
+
+    enum BindKind {
+        kBindNone,
+        kBindString,
+        kBindInt,
+        kBindLongLong,
+        kBindDouble,
+        kBindBool,
+        kBindSerializer
+    };
+
+    struct Member {
+        std::string key;
+        bool required;
+        std::shared_ptr<JsonSchema> schema;
+    };
+
+    void Reset();
+    bool CompileNode(json_t* schema);
+    bool Check(json_t* json, const JsonSerializer& document, std::string& path,
+               std::vector<JsonSchemaViolation>* violations) const;
+    bool Extract(json_t* json, const JsonSerializer& document) const;
+    const Member* FindMember(const char* key) const;
+
+    /* members */
+    int m_Types;
+    bool m_HasMin, m_HasMax, m_ExclusiveMin, m_ExclusiveMax;
+    double m_Min, m_Max;
+    size_t m_MinLength, m_MaxLength;
+    size_t m_MinItems, m_MaxItems;
+    bool m_AdditionalProperties;
+    std::vector<Member> m_Members;
+    std::shared_ptr<JsonSchema> m_Items;
+    BindKind m_BindKind;
+    void* m_Bound;
+};
+
+#endif  // JSONSCHEMA_H
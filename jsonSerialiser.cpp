@@ -13,6 +13,257 @@
  * */
 
 #include "public/JSonSerializer.h"
+#include "jsonNodeCache.h"
+#include "jsonThreadPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/* Nesting deeper than this makes ParseParallel fall back to Parse, so that
+ * jansson's own depth limit is applied to the document exactly as json_loads
+ * would apply it. */
+#define PARALLEL_PARSE_MAX_DEPTH 512
+
+/* Lower bound on the bytes handed to one worker at a time. May be defined
+ * when building, see PARALLEL_PARSE_MIN_SIZE. */
+#ifndef PARALLEL_PARSE_MIN_CHUNK
+#define PARALLEL_PARSE_MIN_CHUNK (64 * 1024)
+#endif
+
+/* Chunks a worker may parse ahead of the streaming consumer. */
+#define PARALLEL_PARSE_WINDOW 4
+
+namespace {
+
+/* Byte range [begin, end) of one element of a top-level array. */
+struct ElementSpan {
+    size_t begin;
+    size_t end;
+};
+
+/* Contiguous run of elements [first, last) parsed by one worker. */
+struct ElementChunk {
+    size_t first;
+    size_t last;
+};
+
+inline bool IsJsonSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*
+ * Structural pre-scan of a top-level array. Records the byte range of every
+ * depth 1 element without decoding anything. Only string quoting and bracket
+ * depth are tracked; the elements themselves are validated later by jansson,
+ * so any input that is split into elements which all parse is a valid array.
+ * @return bool. False if the input is not a plain top-level array this scan
+ * can split, in which case the caller falls back to a serial parse.
+ * */
+bool ScanTopLevelArray(const char* data, size_t len,
+                       std::vector<ElementSpan>& spans) {
+    size_t i = 0;
+    while (i < len && IsJsonSpace(data[i])) ++i;
+    if (i == len || data[i] != '[') return false;
+    ++i;
+
+    int depth = 0;
+    bool inString = false;
+    size_t begin = i;
+    bool closed = false;
+
+    for (; i < len && !closed; ++i) {
+        char c = data[i];
+        if (inString) {
+            if (c == '\\')
+                ++i;
+            else if (c == '"')
+                inString = false;
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                inString = true;
+                break;
+            case '[':
+            case '{':
+                if (++depth > PARALLEL_PARSE_MAX_DEPTH) return false;
+                break;
+            case '}':
+                if (--depth < 0) return false;
+                break;
+            case ']':
+                if (depth-- == 0) {
+                    ElementSpan span = {begin, i};
+                    spans.push_back(span);
+                    closed = true;
+                }
+                break;
+            case ',':
+                if (depth == 0) {
+                    ElementSpan span = {begin, i};
+                    spans.push_back(span);
+                    begin = i + 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!closed) return false;
+    while (i < len && IsJsonSpace(data[i])) ++i;
+    if (i != len) return false;
+
+    /* "[]" yields one blank span; any other blank span is a syntax error
+     * that Parse reports. */
+    for (size_t e = 0; e < spans.size(); ++e) {
+        size_t b = spans[e].begin;
+        while (b < spans[e].end && IsJsonSpace(data[b])) ++b;
+        if (b == spans[e].end) {
+            if (spans.size() != 1) return false;
+            spans.clear();
+        }
+    }
+    return true;
+}
+
+/*
+ * Groups element spans into chunks of roughly equal byte size so that a few
+ * huge elements do not serialise the whole parse behind one worker.
+ * */
+void BuildChunks(const std::vector<ElementSpan>& spans, size_t len,
+                 unsigned int threads, std::vector<ElementChunk>& chunks) {
+    size_t target = len / (threads * 4);
+    if (target < PARALLEL_PARSE_MIN_CHUNK) target = PARALLEL_PARSE_MIN_CHUNK;
+
+    ElementChunk chunk = {0, 0};
+    size_t bytes = 0;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        bytes += spans[i].end - spans[i].begin;
+        chunk.last = i + 1;
+        if (bytes >= target) {
+            chunks.push_back(chunk);
+            chunk.first = chunk.last;
+            bytes = 0;
+        }
+    }
+    if (chunk.first != chunk.last) chunks.push_back(chunk);
+}
+
+/*
+ * Parses the elements of one chunk into their slots.
+ * @return bool. False as soon as one element fails to parse.
+ * */
+bool ParseChunk(const char* data, const std::vector<ElementSpan>& spans,
+                const ElementChunk& chunk, std::vector<json_t*>& elements) {
+    for (size_t i = chunk.first; i < chunk.last; ++i) {
+        elements[i] = json_loadb(data + spans[i].begin,
+                                 spans[i].end - spans[i].begin,
+                                 JSON_DECODE_ANY, NULL);
+        if (elements[i] == 0) return false;
+    }
+    return true;
+}
+
+void ReleaseElements(std::vector<json_t*>& elements, size_t first,
+                     size_t last) {
+    for (size_t i = first; i < last; ++i) {
+        if (elements[i]) json_decref(elements[i]);
+        elements[i] = 0;
+    }
+}
+
+unsigned int ResolveThreads(unsigned int threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+}  // namespace
+
+/* Shared by the trees that refer to the same nodes since a copy-on-write
+ * DeepClone, until they are modified. */
+struct JsonCowShare {};
+
+/*
+ * One tree of nodes, shared by every handle into it, i.e. a document and
+ * every handle taken from it. A copy-on-write clone is a new tree over the
+ * same nodes. When a tree that shares its nodes is modified it copies them
+ * first and forwards: next is the tree of the copy, cache its node cache and
+ * moved maps every container to its copy. Each handle of the old tree moves
+ * over the next time it is used, so a handle into a nested object keeps
+ * seeing the changes made through its document and the other way round.
+ * */
+struct JsonCowTree {
+    explicit JsonCowTree(json_t* json)
+        : root(json_incref(json)), forwarded(false) {}
+    ~JsonCowTree() {
+        if (root) json_decref(root);
+    }
+
+    std::mutex mutex;
+    json_t* root;
+    std::shared_ptr<JsonCowShare> share;
+    /* set once next, cache and moved are final. */
+    std::atomic<bool> forwarded;
+    std::shared_ptr<JsonCowTree> next;
+    std::shared_ptr<JsonNodeCache> cache;
+    std::unordered_map<const json_t*, json_t*> moved;
+};
+
+namespace {
+
+/*
+ * Copies the containers of a tree and records the copy of each. Scalars are
+ * never modified in place, so the copy shares them, and the source text the
+ * cache of the tree keeps for its numbers is recorded for the copy's cache.
+ * */
+json_t* CopyTree(json_t* json,
+                 std::unordered_map<const json_t*, json_t*>& moved,
+                 JsonNodeCache* cache, JsonNodeCache::Source& source) {
+    if (!json_is_object(json) && !json_is_array(json)) {
+        std::string text;
+        if (cache && json_is_number(json) && cache->RawNumber(json, text)) {
+            source.numbers.push_back(std::make_pair(json, text));
+        }
+        return json_incref(json);
+    }
+
+    json_t* copy = json_is_array(json) ? json_array() : json_object();
+    if (copy == 0) return 0;
+    moved[json] = copy;
+
+    if (json_is_array(json)) {
+        for (size_t i = 0; i < json_array_size(json); ++i) {
+            json_t* child =
+                CopyTree(json_array_get(json, i), moved, cache, source);
+            if (json_array_append_new(copy, child) == -1) {
+                json_decref(copy);
+                return 0;
+            }
+        }
+        return copy;
+    }
+
+    for (void* iter = json_object_iter(json); iter;
+         iter = json_object_iter_next(json, iter)) {
+        json_t* child =
+            CopyTree(json_object_iter_value(iter), moved, cache, source);
+        if (json_object_set_new(copy, json_object_iter_key(iter), child) ==
+            -1) {
+            json_decref(copy);
+            return 0;
+        }
+    }
+    return copy;
+}
+
+}  // namespace
 
 /*!
  * default no param constructor
@@ -20,19 +271,28 @@
 JsonSerializer::JsonSerializer() : m_Json(0) {}
 
 /*!
- * overloaded one param constructor. This gets passed a json pointer.
+ * overloaded one param constructor. This gets passed a json pointer. Other
+ * serializers made from the same pointer are separate handles that do not
+ * see each other's changes in their caches, so nothing is memoised for the
+ * json, see jsonNodeCache.h.
  * @param pointer to an allocated json struct
  * */
 JsonSerializer::JsonSerializer(json_t* json) : m_Json(json) {
     json_incref(m_Json);
+    if (m_Json) {
+        m_Cache = std::make_shared<JsonNodeCache>(m_Json, false);
+        m_Tree = std::make_shared<JsonCowTree>(m_Json);
+    }
 }
 
 /*!
  * Copy constructor.
  * @param const reference to a jsonserializer object.
  * */
-JsonSerializer::JsonSerializer(const JsonSerializer& serializer) {
-    m_Json = serializer.m_Json;
+JsonSerializer::JsonSerializer(const JsonSerializer& serializer)
+    : m_Json(serializer.m_Json),
+      m_Cache(serializer.m_Cache),
+      m_Tree(serializer.m_Tree) {
     json_incref(m_Json);
 }
 
@@ -41,9 +301,13 @@ JsonSerializer::JsonSerializer(const JsonSerializer& serializer) {
  * @return reference to JsonSerializer object.
  * */
 JsonSerializer& JsonSerializer::operator=(const JsonSerializer& serializer) {
-    Clear();
-    m_Json = serializer.m_Json;
-    json_incref(m_Json);
+    if (this != &serializer) {
+        json_t* json = json_incref(serializer.m_Json);
+        Clear();
+        m_Json = json;
+        m_Cache = serializer.m_Cache;
+        m_Tree = serializer.m_Tree;
+    }
     return *this;
 }
 
@@ -55,6 +319,142 @@ JsonSerializer::~JsonSerializer() { Clear(); }
 void JsonSerializer::Clear() {
     if (m_Json) json_decref(m_Json);
     m_Json = 0;
+    m_Cache.reset();
+    m_Tree.reset();
+}
+
+/*
+ * Makes this serializer the only handle of a new document. Takes over the
+ * reference to the passed json.
+ * */
+bool JsonSerializer::Attach(json_t* json) {
+    Clear();
+    m_Json = json;
+    if (m_Json) {
+        m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+        m_Tree = std::make_shared<JsonCowTree>(m_Json);
+    }
+    return m_Json ? true : false;
+}
+
+/*
+ * Handle to a node of this document, sharing its cache and its tree.
+ * */
+JsonSerializer JsonSerializer::Derive(json_t* json) const {
+    JsonSerializer serializer;
+    serializer.m_Json = json_incref(json);
+    serializer.m_Cache = m_Cache;
+    serializer.m_Tree = m_Tree;
+    return serializer;
+}
+
+/*
+ * Called before every use of m_Json. Moves this handle over to the copy of
+ * its tree if the tree was copied on write through another handle.
+ * */
+void JsonSerializer::Sync() const {
+    if (m_Tree && m_Tree->forwarded.load(std::memory_order_acquire)) {
+        Follow();
+    }
+}
+
+void JsonSerializer::Follow() const {
+    while (m_Tree && m_Tree->forwarded.load(std::memory_order_acquire)) {
+        std::shared_ptr<JsonCowTree> tree = m_Tree;
+        /* a scalar is shared by the copy, and a node that had already left
+         * the tree has no copy; both stay as they are. */
+        std::unordered_map<const json_t*, json_t*>::const_iterator it =
+            tree->moved.find(m_Json);
+        if (it != tree->moved.end()) {
+            json_t* json = json_incref(it->second);
+            json_decref(m_Json);
+            m_Json = json;
+        }
+        m_Cache = tree->cache;
+        m_Tree = tree->next;
+    }
+}
+
+/*
+ * Gives the tree of this handle a copy of its nodes if it still shares them
+ * with a copy-on-write clone. Every handle into the tree moves to the copy;
+ * the clones keep the nodes.
+ * */
+bool JsonSerializer::Unshare() const {
+    Sync();
+    if (!m_Tree) return true;
+
+    {
+        JsonCowTree& tree = *m_Tree;
+        std::lock_guard<std::mutex> lock(tree.mutex);
+        if (!tree.share) return true;
+        if (tree.share.use_count() == 1) {
+            tree.share.reset();
+            return true;
+        }
+
+        JsonNodeCache::Source source;
+        json_t* copy = CopyTree(tree.root, tree.moved, m_Cache.get(), source);
+        if (copy == 0) {
+            tree.moved.clear();
+            return false;
+        }
+        tree.next = std::make_shared<JsonCowTree>(copy);
+        tree.cache = std::make_shared<JsonNodeCache>(copy);
+        if (!source.numbers.empty()) tree.cache->Seed(source);
+        json_decref(copy);
+        tree.share.reset();
+        json_decref(tree.root);
+        tree.root = 0;
+        tree.forwarded.store(true, std::memory_order_release);
+    }
+
+    Follow();
+    return true;
+}
+
+/*
+ * Called before every modification of m_Json.
+ * */
+bool JsonSerializer::PrepareWrite() const {
+    if (!Unshare()) return false;
+    if (m_Cache && m_Json) m_Cache->Invalidate(m_Json);
+    return true;
+}
+
+/*
+ * Sets key to value in m_Json, stealing the reference to value.
+ * */
+bool JsonSerializer::SetMember(const std::string& key, json_t* value) const {
+    if (!PrepareWrite()) {
+        json_decref(value);
+        return false;
+    }
+
+    if (m_Cache && m_Json) {
+        json_t* old = json_object_get(m_Json, key.c_str());
+        if (old && old != value) m_Cache->Purge(old);
+    }
+
+    int ret = json_object_set_new(m_Json, key.c_str(), value);
+    return ret == 0 ? true : false;
+}
+
+/*
+ * Prepares a serializer whose json is about to be nested into this one. Both
+ * trees are copied first if they share their nodes with copy-on-write
+ * clones, so that neither clone can be changed through the other document,
+ * and the two documents start sharing one cache.
+ * */
+bool JsonSerializer::Adopt(JsonSerializer& object) {
+    if (!object.m_Json) return true;
+    if (!Unshare() || !object.Unshare()) return false;
+    if (!object.m_Cache) {
+        object.m_Cache = std::make_shared<JsonNodeCache>(object.m_Json);
+    }
+    if (!m_Cache && m_Json) m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+    JsonNodeCache::Merge(m_Cache, object.m_Cache);
+    return true;
 }
 
 /*!
@@ -67,8 +467,205 @@ void JsonSerializer::Clear() {
  * */
 bool JsonSerializer::Parse(const std::string& instr) {
     Clear();
-    m_Json = json_loads(instr.c_str(), 0, NULL);
-    return m_Json ? true : false;
+    return Attach(json_loads(instr.c_str(), 0, NULL));
+}
+
+/*!
+ * function ParseParallel. Same as Parse, but a large top-level array is split
+ * at its depth 1 element boundaries and the elements are parsed concurrently
+ * into separate jansson subtrees, which are then assembled into one array in
+ * their original order. The result is identical to Parse on the same input.
+ * Inputs below PARALLEL_PARSE_MIN_SIZE, inputs that are not a top-level array
+ * and very deeply nested inputs are handed to Parse. The calling thread is
+ * helped by workers of the library's thread pool, see jsonThreadPool.h.
+ * @param const reference to a string which contains the json formatted data
+ * stream.
+ * @param unsigned int threads. Number of threads to use, the calling one
+ * included, 0 for one per core.
+ * @return bool. True if the data is in correct format and we could create a
+ * json object from it.False otherwise
+ * */
+bool JsonSerializer::ParseParallel(const std::string& instr,
+                                   unsigned int threads) {
+    return ParseParallel(instr, threads, 0);
+}
+
+/*
+ * ParseParallel that gives up, returning false, once cancelled is set. The
+ * flag is checked between chunks.
+ * */
+bool JsonSerializer::ParseParallel(const std::string& instr,
+                                   unsigned int threads,
+                                   const std::atomic<bool>* cancelled) {
+    const char* data = instr.c_str();
+    size_t len = strlen(data);
+    threads = ResolveThreads(threads);
+
+    std::vector<ElementSpan> spans;
+    if (threads == 1 || len < PARALLEL_PARSE_MIN_SIZE ||
+        !ScanTopLevelArray(data, len, spans)) {
+        return Parse(instr);
+    }
+
+    Clear();
+    std::vector<ElementChunk> chunks;
+    BuildChunks(spans, len, threads, chunks);
+    if (threads > chunks.size()) threads = chunks.size();
+
+    std::vector<json_t*> elements(spans.size(), (json_t*)0);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+
+    std::function<void()> worker = [&]() {
+        while (!failed.load(std::memory_order_relaxed)) {
+            if (cancelled && cancelled->load(std::memory_order_relaxed)) {
+                failed = true;
+                break;
+            }
+            size_t c = next.fetch_add(1);
+            if (c >= chunks.size()) break;
+            if (!ParseChunk(data, spans, chunks[c], elements)) failed = true;
+        }
+    };
+
+    /* the calling thread works through the chunks too, so the parse
+     * finishes even if no worker of the pool is free to help. */
+    JsonThreadPool::Instance().Parallel(threads - 1, worker, worker);
+
+    json_t* array = failed ? 0 : json_array();
+    if (array == 0) {
+        ReleaseElements(elements, 0, elements.size());
+        return false;
+    }
+
+    for (size_t i = 0; i < elements.size(); ++i) {
+        json_t* element = elements[i];
+        elements[i] = 0;
+        if (json_array_append_new(array, element) == -1) {
+            ReleaseElements(elements, i + 1, elements.size());
+            json_decref(array);
+            return false;
+        }
+    }
+
+    return Attach(array);
+}
+
+/*!
+ * function ParseParallel. Streaming form of ParseParallel. The elements of a
+ * top-level array are parsed concurrently and handed to the consumer one at a
+ * time in their original order; no array holding all of them is built. Each
+ * element is released once the consumer returns, unless the consumer kept a
+ * copy of the serializer it was given.
+ * NOTE: when an element is malformed the elements before it may already have
+ * been delivered.
+ * @param const reference to a string which contains the json formatted data
+ * stream.
+ * @param const reference to the consumer called for each element. Returning
+ * false from it stops the parse.
+ * @param unsigned int threads. Number of threads to use, 0 for one per core.
+ * @return bool. True if the data is a well formed top-level array and every
+ * element was consumed. False otherwise
+ * */
+bool JsonSerializer::ParseParallel(const std::string& instr,
+                                   const ElementConsumer& consumer,
+                                   unsigned int threads) {
+    const char* data = instr.c_str();
+    size_t len = strlen(data);
+    threads = ResolveThreads(threads);
+
+    std::vector<ElementSpan> spans;
+    if (threads == 1 || len < PARALLEL_PARSE_MIN_SIZE ||
+        !ScanTopLevelArray(data, len, spans)) {
+        JsonSerializer json;
+        std::vector<JsonSerializer> vec;
+        if (!json.Parse(instr) || !json.GetCollection("", vec)) return false;
+        for (size_t i = 0; i < vec.size(); ++i) {
+            if (!consumer(i, vec[i])) return false;
+        }
+        return true;
+    }
+
+    std::vector<ElementChunk> chunks;
+    BuildChunks(spans, len, threads, chunks);
+    if (threads > chunks.size()) threads = chunks.size();
+
+    std::vector<json_t*> elements(spans.size(), (json_t*)0);
+    std::vector<char> done(chunks.size(), 0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t next = 0;
+    size_t delivered = 0;
+    bool stop = false;
+    const size_t window = PARALLEL_PARSE_WINDOW * threads;
+
+    /* claims and parses the next chunk; called and returns with the lock
+     * held. */
+    auto parseNext = [&](std::unique_lock<std::mutex>& lock) {
+        size_t c = next++;
+        lock.unlock();
+        bool ok = ParseChunk(data, spans, chunks[c], elements);
+        lock.lock();
+        if (ok)
+            done[c] = 1;
+        else
+            stop = true;
+        cond.notify_all();
+    };
+
+    std::function<void()> worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (!stop && next < chunks.size() &&
+                   next >= delivered + window) {
+                cond.wait(lock);
+            }
+            if (stop || next >= chunks.size()) return;
+            parseNext(lock);
+        }
+    };
+
+    /* the calling thread delivers the chunks in order, and parses the next
+     * unclaimed one itself whenever the chunk it waits for is not done, so
+     * the parse finishes even if no worker of the pool is free to help. */
+    std::function<void()> deliver = [&]() {
+        bool ok = true;
+        for (size_t c = 0; c < chunks.size() && ok; ++c) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!done[c] && !stop) {
+                    if (next < chunks.size() && next < delivered + window) {
+                        parseNext(lock);
+                    } else {
+                        cond.wait(lock);
+                    }
+                }
+                if (!done[c]) ok = false;
+            }
+
+            for (size_t i = chunks[c].first; ok && i < chunks[c].last; ++i) {
+                JsonSerializer element;
+                element.Attach(elements[i]);
+                elements[i] = 0;
+                ok = consumer(i, element);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            delivered = c + 1;
+            if (!ok) stop = true;
+            cond.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) stop = true;
+        cond.notify_all();
+    };
+
+    JsonThreadPool::Instance().Parallel(threads - 1, worker, deliver);
+
+    bool ok = !stop;
+    ReleaseElements(elements, 0, elements.size());
+    return ok;
 }
 
 /*!
@@ -79,8 +676,7 @@ bool JsonSerializer::Parse(const std::string& instr) {
  * */
 bool JsonSerializer::CreateRootObject() {
     Clear();
-    m_Json = json_object();
-    return m_Json ? true : false;
+    return Attach(json_object());
 }
 
 /*!
@@ -94,6 +690,7 @@ bool JsonSerializer::CreateRootObject() {
  * */
 bool JsonSerializer::GetValue(const std::string& key,
                               std::string& value) const {
+    Sync();
     if (m_Json && json_is_object(m_Json)) {
         json_t* item = json_object_get(m_Json, key.c_str());
         if (item && json_is_string(item)) {
@@ -105,6 +702,38 @@ bool JsonSerializer::GetValue(const std::string& key,
     return false;
 }
 
+/*!
+ * GetNumberText function. Given a string key, this returns the number found
+ * as json text: as it was written in the input if Parse kept it, e.g. for an
+ * integer beyond long long or a real with more digits than a double holds,
+ * otherwise the way StreamJsonToBuffer writes it.
+ * @param const reference to string which is the key to look for in the current
+ * json struct.
+ * @param reference to string. The text is returned in this variable.
+ * @return bool. True if the value exists in the json and is a number.
+ * Otherwise false.
+ * */
+bool JsonSerializer::GetNumberText(const std::string& key,
+                                   std::string& text) const {
+    Sync();
+    if (m_Json && json_is_object(m_Json)) {
+        json_t* item = json_object_get(m_Json, key.c_str());
+        if (item && json_is_number(item)) {
+            if (m_Cache && m_Cache->RawNumber(item, text)) return true;
+
+            char buffer[JSON_NUMBER_BUFFER_SIZE];
+            size_t length =
+                json_is_integer(item)
+                    ? FormatJsonInteger(json_integer_value(item), buffer)
+                    : FormatJsonReal(json_real_value(item), false, buffer);
+            text.assign(buffer, length);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /*!
  * PutValue function. Given a string key, and a string value, this function adds
  * them to the json object.
@@ -117,9 +746,7 @@ bool JsonSerializer::GetValue(const std::string& key,
 bool JsonSerializer::PutValue(const std::string& key,
                               const std::string& value) {
     if (m_Json && json_is_object(m_Json)) {
-        int ret = json_object_set_new(m_Json, key.c_str(),
-                                      json_string(value.c_str()));
-        if (ret == 0) return true;
+        if (SetMember(key, json_string(value.c_str()))) return true;
     }
 
     return false;
@@ -136,12 +763,11 @@ bool JsonSerializer::PutValue(const std::string& key,
  * */
 bool JsonSerializer::GetObject(const std::string& key,
                                JsonSerializer& serializer) const {
+    Sync();
     if (m_Json && json_is_object(m_Json)) {
         json_t* json = json_object_get(m_Json, key.c_str());
         if (json) {
-            serializer.Clear();
-            serializer.m_Json = json;
-            json_incref(serializer.m_Json);
+            serializer = Derive(json);
             return true;
         }
     }
@@ -158,9 +784,8 @@ bool JsonSerializer::GetObject(const std::string& key,
  * @return bool. True
  * */
 bool JsonSerializer::PutObject(const std::string& key, JsonSerializer& object) {
-    int ret = json_object_set(m_Json, key.c_str(), object.m_Json);
-    if (ret == 0) return true;
-    return false;
+    if (!Adopt(object)) return false;
+    return SetMember(key, json_incref(object.m_Json));
 }
 
 /*!
@@ -174,6 +799,7 @@ bool JsonSerializer::PutObject(const std::string& key, JsonSerializer& object) {
  * */
 bool JsonSerializer::GetCollection(const std::string& key,
                                    std::vector<JsonSerializer>& vec) const {
+    Sync();
     if (m_Json) {
         json_t* array = 0;
 
@@ -195,7 +821,7 @@ bool JsonSerializer::GetCollection(const std::string& key,
             /* each row in the arary will be one serializer object. */
             json_t* json = json_array_get(array, i);
             if (json == 0) return false;
-            vec.push_back(json);
+            vec.push_back(Derive(json));
         }
 
         return true;
@@ -222,17 +848,16 @@ bool JsonSerializer::PutCollection(const std::string& key,
     if (array == 0) return false;
 
     for (size_t i = 0; i < collection.size(); ++i) {
-        ret = json_array_append(array, collection[i].m_Json);
+        ret = Adopt(collection[i])
+                  ? json_array_append(array, collection[i].m_Json)
+                  : -1;
         if (ret == -1) {
             json_decref(array);
             return false;
         }
     }
 
-    ret = json_object_set_new(m_Json, key.c_str(), array);
-    if (ret == -1) return false;
-
-    return true;
+    return SetMember(key, array);
 }
 
 /*!
@@ -248,6 +873,7 @@ bool JsonSerializer::PutCollection(const std::string& key,
 bool JsonSerializer::GetStringCollection(const std::string& key,
                                          std::set<std::string>& collection,
                                          int limit) const {
+    Sync();
     if (m_Json) {
         json_t* array = 0;
 
@@ -317,27 +943,117 @@ bool JsonSerializer::PutStringCollection(
         }
     }
 
-    if (!m_Json && key.empty()) {
-        m_Json = array;
-        return m_Json ? true : false;
-    }
-
-    ret = json_object_set_new(m_Json, key.c_str(), array);
-    if (ret == -1) return false;
+    if (!m_Json && key.empty()) return Attach(array);
 
-    return true;
+    return SetMember(key, array);
 }
 
 /*!
  * StreamJsonToBuffer function.This function streams the member json object
  * into a null terminated string in which the data is json formatted.
+ * @param bool shortestReals. If true reals are written with few digits that
+ * still read back to the same double (the fewest where std::to_chars is
+ * available, see FormatJsonReal). Otherwise with 17 significant digits,
+ * exactly as json_dumps writes them.
  * @return char*. Pointer to a buffer containing the streamed json formatted
  * null terminated data.
  * NOTE: users need to free the pointer returned. ....use free not delete....
  * */
-char* JsonSerializer::StreamJsonToBuffer() const {
-    if (m_Json) {
-        return json_dumps(m_Json, JSON_ENCODE_ANY | JSON_COMPACT);
+char* JsonSerializer::StreamJsonToBuffer(bool shortestReals) const {
+    std::string out;
+    if (Dump(out, shortestReals)) {
+        char* buffer = (char*)malloc(out.size() + 1);
+        if (buffer) memcpy(buffer, out.c_str(), out.size() + 1);
+        return buffer;
     }
     return NULL;
 }
+
+/*
+ * Serialises m_Json into out. The serialisation of every large container is
+ * kept until it is modified through a serializer, so only changed paths are
+ * encoded again; by default the output is what json_dumps(JSON_COMPACT)
+ * produces.
+ * */
+bool JsonSerializer::Dump(std::string& out, bool shortestReals) const {
+    Sync();
+    if (!m_Json) return false;
+    if (!m_Cache) m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+    m_Cache->Dump(m_Json, out, shortestReals);
+    return true;
+}
+
+/*!
+ * DeepClone function. Copies the whole json tree, so that nothing can be
+ * changed through the copy that is visible through this serializer and the
+ * other way round.
+ * @param bool copyOnWrite. If true the tree is not copied up front. The
+ * clone is a new document over the same nodes, until either document is
+ * modified through any of its handles; that document then copies the nodes
+ * first and all its handles move to the copy. Handles into the same nodes
+ * taken from a different document, e.g. the one an object was put into with
+ * PutObject, are not covered and must not modify them.
+ * @return JsonSerializer. The clone. Empty if this one is empty or the copy
+ * failed.
+ * */
+JsonSerializer JsonSerializer::DeepClone(bool copyOnWrite) const {
+    JsonSerializer clone;
+    Sync();
+    if (!m_Json) return clone;
+
+    if (copyOnWrite) {
+        if (!m_Cache) m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+        if (!m_Tree) m_Tree = std::make_shared<JsonCowTree>(m_Json);
+        std::shared_ptr<JsonCowTree> tree =
+            std::make_shared<JsonCowTree>(m_Json);
+        {
+            std::lock_guard<std::mutex> lock(m_Tree->mutex);
+            std::shared_ptr<JsonCowShare>& share = m_Tree->share;
+            if (!share) share = std::make_shared<JsonCowShare>();
+            tree->share = share;
+        }
+        clone.m_Json = json_incref(m_Json);
+        clone.m_Cache = m_Cache;
+        clone.m_Tree = tree;
+        return clone;
+    }
+
+    clone.Attach(json_deep_copy(m_Json));
+    return clone;
+}
+
+/*!
+ * Equals function. Structural comparison of the json of two serializers.
+ * Identical nodes are equal without being looked at and known different
+ * hashes make the comparison fail straight away.
+ * @param const reference to the other serializer.
+ * @return bool. True if both are empty or hold equal json. Otherwise false.
+ * */
+bool JsonSerializer::Equals(const JsonSerializer& other) const {
+    Sync();
+    other.Sync();
+    if (m_Json == other.m_Json) return true;
+    if (!m_Json || !other.m_Json) return false;
+
+    uint64_t mine, theirs;
+    if (m_Cache && other.m_Cache && m_Cache->PeekHash(m_Json, mine) &&
+        other.m_Cache->PeekHash(other.m_Json, theirs) && mine != theirs) {
+        return false;
+    }
+
+    return json_equal(m_Json, other.m_Json) ? true : false;
+}
+
+/*!
+ * Hash function. Stable 64 bit content hash of the json of this serializer.
+ * Serializers that are Equals hash equally. The hash of every object and
+ * array is remembered until it is modified through a serializer, so hashing
+ * again after a small change only revisits the changed path.
+ * @return uint64_t. The hash, 0 for an empty serializer.
+ * */
+uint64_t JsonSerializer::Hash() const {
+    Sync();
+    if (!m_Json) return 0;
+    if (!m_Cache) m_Cache = std::make_shared<JsonNodeCache>(m_Json);
+    return m_Cache->Hash(m_Json);
+}
@@ -15,22 +15,94 @@
 #ifndef JSONSERIALIZER_H
 #define JSONSERIALIZER_H
 
+#include <stdint.h>
+#include <atomic>
 #include <string>
 #include <set>
 #include <vector>
 #include <sstream>
 #include <memory>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <math.h>
+#include <stdlib.h>
 
 #include <jansson.h>
 
+#include "jsonNumber.h"
+
 #define DEFAULT_LIMIT_GET_COLLECTION -1
 
+/* Inputs smaller than this are not worth splitting across threads and
+ * ParseParallel hands them straight to Parse. May be defined when building
+ * the library, e.g. to 1 by the fuzz build, so that small inputs are split
+ * too. */
+#ifndef PARALLEL_PARSE_MIN_SIZE
+#define PARALLEL_PARSE_MIN_SIZE (1024 * 1024)
+#endif
+
+class JsonNodeCache;
+class JsonDocumentCache;
+class JsonAsync;
+class JsonBinaryStore;
+class JsonBinaryView;
+
+/* Read access to one jansson node, for the conversions of GetValue. */
+struct JsonNodeItem {
+    explicit JsonNodeItem(json_t* item) : json(item) {}
+
+    bool IsInteger() const { return json_is_integer(json); }
+    bool IsReal() const { return json_is_real(json); }
+    bool IsString() const { return json_is_string(json); }
+    bool IsBoolean() const { return json_is_boolean(json); }
+    long long Integer() const { return json_integer_value(json); }
+    double Real() const { return json_real_value(json); }
+    const char* String() const { return json_string_value(json); }
+    size_t Length() const { return json_string_length(json); }
+    int Boolean() const { return json_boolean_value(json); }
+    /* appends the compact json text of the node to out. The text does not
+     * go through jansson's allocator, which may be JsonNodePool's. */
+    bool Dump(std::string& out) const {
+        return json_dump_callback(json, Append, &out,
+                                  JSON_ENCODE_ANY | JSON_COMPACT) == 0;
+    }
+    static int Append(const char* buffer, size_t size, void* out) {
+        static_cast<std::string*>(out)->append(buffer, size);
+        return 0;
+    }
+
+    json_t* json;
+};
+struct JsonCowTree;
+
 /* Class JsonSerializer is a wrapper which hides the details of underlying cJSON
  * apis from the user. It also provides a C++ way of interaction with the json
  * formatting code.
  * */
 class JsonSerializer {
    public:
+    /* Consumer for streamed top-level array elements. Return false to stop. */
+    typedef std::function<bool(size_t index, const JsonSerializer& element)>
+        ElementConsumer;
+
+    /* Options of Parse, combined with |. */
+    enum ParseOptions {
+        /* fail on an object that has the same key twice, instead of
+         * keeping the last value. */
+        kRejectDuplicates = 1 << 0,
+        /* keep the source text, so that the document dumps as it was read:
+         * members in their order, spacing and escapes as in the input. */
+        kPreserveOrder = 1 << 1,
+        /* accept any json value as the root, not only objects and arrays. */
+        kDecodeAny = 1 << 2,
+        /* keep the text of numbers: integers beyond long long are accepted,
+         * and GetNumberText and the dumps give every number as written.
+         * Such an integer is held as the nearest real, so GetValue converts
+         * it as a real and a copy that drops the text dumps it as one. */
+        kLosslessNumbers = 1 << 3
+    };
+
     JsonSerializer();
     JsonSerializer(json_t* json);
     ~JsonSerializer();
@@ -38,8 +110,18 @@ class JsonSerializer {
     JsonSerializer& operator=(const JsonSerializer& serializer);
     void Clear();
     bool Parse(const std::string& instr);
+    bool Parse(const std::string& instr, int options);
+    bool Parse(const char* data, size_t len,
+               const std::set<std::string>& projection);
+    bool Parse(const std::string& instr, JsonDocumentCache& cache,
+               int options = 0);
+    bool ParseParallel(const std::string& instr, unsigned int threads = 0);
+    static bool ParseParallel(const std::string& instr,
+                              const ElementConsumer& consumer,
+                              unsigned int threads = 0);
     bool CreateRootObject();
     bool GetValue(const std::string& key, std::string& value) const;
+    bool GetNumberText(const std::string& key, std::string& text) const;
     bool PutValue(const std::string& key, const std::string& value);
     bool GetObject(const std::string& key, JsonSerializer& serializer) const;
     bool PutObject(const std::string& key, JsonSerializer& object);
@@ -53,7 +135,13 @@ class JsonSerializer {
     bool PutStringCollection(const std::string& key,
                              const std::set<std::string>& collection,
                              int limit = DEFAULT_LIMIT_GET_COLLECTION);
-    char* StreamJsonToBuffer() const;
+    char* StreamJsonToBuffer(bool shortestReals = false) const;
+    JsonSerializer DeepClone(bool copyOnWrite = false) const;
+    bool Equals(const JsonSerializer& other) const;
+    uint64_t Hash() const;
+    bool Diff(const JsonSerializer& target, JsonSerializer& patch) const;
+    bool ApplyPatch(const JsonSerializer& patch);
+    bool MergePatch(const JsonSerializer& patch);
 
     /*!
      * GetValue is a template function that gets the value out from the parsed
@@ -70,28 +158,10 @@ class JsonSerializer {
     template <typename T>
     bool GetValue(const std::string& key, T& value,
                   std::ios_base& (*f)(std::ios_base&) = std::dec) const {
+        Sync();
         if (m_Json && json_is_object(m_Json)) {
             json_t* item = json_object_get(m_Json, key.c_str());
-            if (item) {
-                std::ostringstream oss;
-                if (json_is_integer(item)) {
-                    oss << json_integer_value(item);
-                } else if (json_is_real(item)) {
-                    oss << json_real_value(item);
-                } else if (json_is_string(item)) {
-                    oss << json_string_value(item);
-                } else if (json_is_boolean(item)) {
-                    oss << json_boolean_value(item);
-                } else {
-                    char* s = json_dumps(item, JSON_ENCODE_ANY | JSON_COMPACT);
-                    if (s == 0) return false;
-                    oss << s;
-                    free(s);
-                }
-
-                std::istringstream iss(oss.str());
-                return !(iss >> f >> value).fail();
-            }
+            if (item) return ConvertValue(JsonNodeItem(item), value, f);
         }
 
         return false;
@@ -112,7 +182,13 @@ class JsonSerializer {
     template <typename T>
     bool PutValue(const std::string& key, const T& value,
                   std::ios_base& (*f)(std::ios_base&) = std::dec) const {
+        Sync();
         if (m_Json && json_is_object(m_Json)) {
+            /* integers are stored as json integers and reals as json reals,
+             * so that they read back exactly. */
+            json_t* number = f == std::dec ? MakeNumber(value) : 0;
+            if (number) return SetMember(key, number);
+
             std::ostringstream oss;
             if ((oss << f << value).fail()) return false;
 
@@ -120,13 +196,10 @@ class JsonSerializer {
             long long val;
 
             if (!(iss >> val).fail()) {
-                int ret = json_object_set_new(m_Json, key.c_str(),
-                                              json_integer(value));
-                if (ret == -1) return false;
+                if (!SetMember(key, json_integer(value))) return false;
             } else {
-                int ret = json_object_set_new(m_Json, key.c_str(),
-                                              json_string(oss.str().c_str()));
-                if (ret == -1) return false;
+                if (!SetMember(key, json_string(oss.str().c_str())))
+                    return false;
             }
 
             return true;
@@ -136,8 +209,166 @@ class JsonSerializer {
     }
 
    private:
+    /* Converts a scalar, or the json text of anything else, to T. item is a
+     * JsonNodeItem or anything else with the same members. */
+    template <typename T, typename Item>
+    static bool ConvertValue(const Item& item, T& value,
+                             std::ios_base& (*f)(std::ios_base&)) {
+        /* numbers, and strings holding plain decimal numbers, are converted
+         * directly; everything else takes the iostream path below, which
+         * also decides the edge cases. */
+        if (f == std::dec && GetNumber(item, value)) return true;
+
+        std::ostringstream oss;
+        if (item.IsInteger()) {
+            oss << item.Integer();
+        } else if (item.IsReal()) {
+            char buffer[JSON_NUMBER_BUFFER_SIZE];
+            FormatJsonReal(item.Real(), true, buffer);
+            oss << buffer;
+        } else if (item.IsString()) {
+            oss << item.String();
+        } else if (item.IsBoolean()) {
+            oss << item.Boolean();
+        } else {
+            std::string text;
+            if (!item.Dump(text)) return false;
+            oss << text;
+        }
+
+        std::istringstream iss(oss.str());
+        return !(iss >> f >> value).fail();
+    }
+
+    /* Arithmetic types converted without iostreams. Character types stream
+     * as text and bool as 0/1, so they keep the iostream path. */
+    template <typename T>
+    struct IsFastNumber {
+        static const bool value =
+            std::is_arithmetic<T>::value && !std::is_same<T, bool>::value &&
+            !std::is_same<T, char>::value &&
+            !std::is_same<T, signed char>::value &&
+            !std::is_same<T, unsigned char>::value &&
+            !std::is_same<T, wchar_t>::value &&
+            !std::is_same<T, char16_t>::value &&
+            !std::is_same<T, char32_t>::value &&
+            !std::is_same<T, long double>::value;
+    };
+
+    template <typename T, typename Item>
+    static typename std::enable_if<!IsFastNumber<T>::value, bool>::type
+    GetNumber(const Item&, T&) {
+        return false;
+    }
+
+    template <typename T, typename Item>
+    static typename std::enable_if<
+        IsFastNumber<T>::value && std::is_integral<T>::value, bool>::type
+    GetNumber(const Item& item, T& value) {
+        if (std::is_signed<T>::value) {
+            long long number;
+            if (item.IsInteger()) {
+                number = item.Integer();
+            } else if (!item.IsString() ||
+                       !ParseJsonNumber(item.String(), item.Length(),
+                                        number)) {
+                return false;
+            }
+            if (number < (long long)std::numeric_limits<T>::min() ||
+                number > (long long)std::numeric_limits<T>::max()) {
+                return false;
+            }
+            value = (T)number;
+            return true;
+        }
+
+        unsigned long long number;
+        if (item.IsInteger()) {
+            if (item.Integer() < 0) return false;
+            number = (unsigned long long)item.Integer();
+        } else if (!item.IsString() ||
+                   !ParseJsonNumber(item.String(), item.Length(), number)) {
+            return false;
+        }
+        if (number > (unsigned long long)std::numeric_limits<T>::max()) {
+            return false;
+        }
+        value = (T)number;
+        return true;
+    }
+
+    template <typename T, typename Item>
+    static typename std::enable_if<
+        IsFastNumber<T>::value && std::is_floating_point<T>::value, bool>::type
+    GetNumber(const Item& item, T& value) {
+        if (item.IsInteger()) {
+            value = (T)item.Integer();
+            return true;
+        }
+        if (item.IsReal()) {
+            double number = item.Real();
+            if (fabs(number) > std::numeric_limits<T>::max()) return false;
+            value = (T)number;
+            return true;
+        }
+        return item.IsString() &&
+               ParseJsonNumber(item.String(), item.Length(), value);
+    }
+
+    template <typename T>
+    static typename std::enable_if<!IsFastNumber<T>::value, json_t*>::type
+    MakeNumber(const T&) {
+        return 0;
+    }
+
+    template <typename T>
+    static typename std::enable_if<
+        IsFastNumber<T>::value && std::is_integral<T>::value, json_t*>::type
+    MakeNumber(const T& value) {
+        if (!std::is_signed<T>::value &&
+            (unsigned long long)value >
+                (unsigned long long)std::numeric_limits<long long>::max()) {
+            return 0;
+        }
+        return json_integer((json_int_t)value);
+    }
+
+    template <typename T>
+    static typename std::enable_if<
+        IsFastNumber<T>::value && std::is_floating_point<T>::value,
+        json_t*>::type
+    MakeNumber(const T& value) {
+        return isfinite(value) ? json_real(value) : 0;
+    }
+
+    friend class JsonPatcher;
+    friend class JsonSchema;
+    friend class JsonAsync;
+    friend class JsonBinaryView;
+    friend class JsonBinaryStore;
+    friend class JsonDocumentCache;
+    template <typename Record>
+    friend class JsonRecordCodec;
+
+    bool Attach(json_t* json);
+    bool ParseParallel(const std::string& instr, unsigned int threads,
+                       const std::atomic<bool>* cancelled);
+    bool Dump(std::string& out, bool shortestReals) const;
+    JsonSerializer Derive(json_t* json) const;
+    void Sync() const;
+    void Follow() const;
+    bool Unshare() const;
+    bool PrepareWrite() const;
+    bool SetMember(const std::string& key, json_t* value) const;
+    bool Adopt(JsonSerializer& object);
+
     /* members */
-    json_t* m_Json;
+    /* moved to the copy when the tree is copied on write, see Sync. */
+    mutable json_t* m_Json;
+    /* shared by every handle into the same document. */
+    mutable std::shared_ptr<JsonNodeCache> m_Cache;
+    /* shared by every handle into the same tree. */
+    mutable std::shared_ptr<JsonCowTree> m_Tree;
 };
 
 #endif  // JSONSERIALIZER_H
@@ -9,12 +9,23 @@
 
 #include "cxxtest/TestSuite.h"
 #include "common/qappframework/JSonSerializer.h"
+#include "common/qappframework/JSonSchema.h"
+#include "common/qappframework/JSonDocumentCache.h"
+#include "common/qappframework/JSonAsync.h"
+#include "common/qappframework/JSonRecordCodec.h"
+#include "common/qappframework/JSonBinaryStore.h"
+#include "common/qappframework/JSonNodePool.h"
 #include "common/qappframework/Utils.h"
 #include "common/qappframework/Logger.h"
 #include <vector>
 #include <set>
 #include <algorithm>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <functional>
+#include <atomic>
+#include <thread>
 #include <iostream>
 #include <fstream>
 
@@ -46,8 +57,43 @@ class JSonSerializerTest : public CxxTest::TestSuite {
     void testGetStringCollectionPositive2();
     void testPutStringCollectionPositive1();
     void testPutStringCollectionPositive2();
+    void testParseParallelPositive();
+    void testParseParallelNegative();
+    void testParseParallelConsumer();
+    void testDeepClone();
+    void testDeepCloneCopyOnWrite();
+    void testEquals();
+    void testHash();
+    void testDiffApplyPatch();
+    void testApplyPatchNegative();
+    void testMergePatch();
+    void testSchemaBuilder();
+    void testSchemaCompile();
+    void testSchemaViolations();
+    void testParseProjectionPositive();
+    void testParseProjectionNegative();
+    void testDocumentCache();
+    void testDocumentCacheEviction();
+    void testStreamJsonToBufferCached();
+    void testNumberRoundTrip();
+    void testGetValueNumbers();
+    void testParseAsync();
+    void testStreamAsync();
+    void testRecordCodec();
+    void testRecordCodecParallel();
+    void testBinaryStore();
+    void testBinaryStoreNegative();
+    void testParseKeepSource();
+    void testParseOptionsNegative();
+    void testNodePool();
+    void testNodePoolNegative();
+    void testDeepCloneCopyOnWriteHandles();
 
    private:
+    static string BuildLargeArray();
+    static bool DumpsMatch(const JsonSerializer& json, json_t* root);
+    static string Dumped(const JsonSerializer& json);
+
     static const string m_kStrval;
     static const string m_kWrongval;
     static const string m_kTeststr;
@@ -506,3 +552,1603 @@ void JSonSerializerTest::testPutStringCollectionPositive2() {
 
     TS_ASSERT(json.PutStringCollection("test", vec, -15));
 }
+
+/*
+ * Builds a top-level array big enough for ParseParallel to split it.
+ */
+string JSonSerializerTest::BuildLargeArray() {
+    std::ostringstream strm;
+    strm << "[";
+    for (int i = 0; strm.tellp() < 2 * PARALLEL_PARSE_MIN_SIZE; ++i) {
+        if (i) strm << ",";
+        strm << "{\"id\":" << i << ",\"name\":\"a,]\\\"[" << i
+             << "\",\"list\":[1,2.5,{\"x\":null}]}";
+    }
+    strm << ", 7 ,\"tail\"]";
+    return strm.str();
+}
+
+/* Test24
+ * Method : ParseParallel()
+ * This test is to check ParseParallel builds the same json as Parse
+ * This is positive test, on success returns true
+ */
+
+void JSonSerializerTest::testParseParallelPositive() {
+    string input = BuildLargeArray();
+    JsonSerializer serial, parallel;
+    TS_ASSERT(serial.Parse(input));
+    TS_ASSERT(parallel.ParseParallel(input, 4));
+
+    char* exp_str = serial.StreamJsonToBuffer();
+    char* got_str = parallel.StreamJsonToBuffer();
+    TS_ASSERT(exp_str && got_str && strcmp(exp_str, got_str) == 0);
+    free(exp_str);
+    free(got_str);
+
+    TS_ASSERT(parallel.ParseParallel(m_kStrval));
+    TS_ASSERT(parallel.GetValue("dbtype", input));
+}
+
+/* Test25
+ * Method : ParseParallel()
+ * This test is to check ParseParallel rejects a malformed array
+ * This is negative test, on failure returns false
+ */
+
+void JSonSerializerTest::testParseParallelNegative() {
+    string input = BuildLargeArray();
+    JsonSerializer json;
+    TS_ASSERT(!(json.ParseParallel(input + ",", 4)));
+    TS_ASSERT(!(json.ParseParallel(input.insert(input.size() / 2, "{"), 4)));
+    TS_ASSERT(NULL == json.StreamJsonToBuffer());
+}
+
+/*
+ * Consumer for testParseParallelConsumer. Checks elements arrive in order.
+ */
+static bool CountElement(size_t* count, size_t index,
+                         const JsonSerializer& element) {
+    int id = -1;
+    if (index != *count) return false;
+    ++*count;
+    return element.GetValue("id", id) ? id == (int)index : true;
+}
+
+/* Test26
+ * Method : ParseParallel()
+ * This test is to check ParseParallel streams the elements in order
+ * This is positive test, on success returns true
+ */
+
+void JSonSerializerTest::testParseParallelConsumer() {
+    string input = BuildLargeArray();
+    JsonSerializer json;
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(json.Parse(input));
+    TS_ASSERT(json.GetCollection("", vec));
+
+    size_t count = 0;
+    TS_ASSERT(JsonSerializer::ParseParallel(
+        input,
+        std::bind(CountElement, &count, std::placeholders::_1,
+                  std::placeholders::_2),
+        4));
+    TS_ASSERT_EQUALS(vec.size(), count);
+}
+
+/* Test27
+ * Method : DeepClone()
+ * This test is to check changes to a clone are not seen by the original
+ * This is positive test
+ */
+
+void JSonSerializerTest::testDeepClone() {
+    JsonSerializer objJson, tempJson, clone;
+    string got_val;
+    TS_ASSERT(objJson.Parse(m_kStrval));
+
+    clone = objJson.DeepClone();
+    TS_ASSERT(clone.Equals(objJson));
+    TS_ASSERT(clone.GetObject("mongo", tempJson));
+    TS_ASSERT(tempJson.PutValue("hostip", string("10.0.0.1")));
+
+    TS_ASSERT(!clone.Equals(objJson));
+    TS_ASSERT(objJson.GetObject("mongo", tempJson));
+    TS_ASSERT(tempJson.GetValue("hostip", got_val));
+    TS_ASSERT_EQUALS("127.0.0.1", got_val);
+}
+
+/* Test28
+ * Method : DeepClone()
+ * This test is to check a copy-on-write clone shares the json until one
+ * side writes to it
+ * This is positive test
+ */
+
+void JSonSerializerTest::testDeepCloneCopyOnWrite() {
+    JsonSerializer objJson, clone;
+    string got_val;
+    TS_ASSERT(objJson.Parse(m_kStrval));
+
+    clone = objJson.DeepClone(true);
+    TS_ASSERT(clone.Equals(objJson));
+    TS_ASSERT(clone.PutValue("dbtype", string("mysql")));
+
+    TS_ASSERT(objJson.GetValue("dbtype", got_val));
+    TS_ASSERT_EQUALS("mongo", got_val);
+    TS_ASSERT(clone.GetValue("dbtype", got_val));
+    TS_ASSERT_EQUALS("mysql", got_val);
+
+    clone = objJson.DeepClone(true);
+    TS_ASSERT(objJson.PutValue("dbtype", string("redis")));
+    TS_ASSERT(clone.GetValue("dbtype", got_val));
+    TS_ASSERT_EQUALS("mongo", got_val);
+}
+
+/* Test29
+ * Method : Equals()
+ * This test is to check structural comparison ignores key order
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testEquals() {
+    JsonSerializer first, second, empty;
+    TS_ASSERT(first.Parse("{\"a\":1,\"b\":[true,null,\"x\"]}"));
+    TS_ASSERT(second.Parse("{\"b\":[true,null,\"x\"],\"a\":1}"));
+    TS_ASSERT(first.Equals(second));
+    TS_ASSERT_EQUALS(first.Hash(), second.Hash());
+
+    TS_ASSERT(second.Parse("{\"b\":[true,null,\"x\"],\"a\":1.0}"));
+    TS_ASSERT(!first.Equals(second));
+    TS_ASSERT(!first.Equals(empty));
+    TS_ASSERT(empty.Equals(JsonSerializer()));
+}
+
+/* Test30
+ * Method : Hash()
+ * This test is to check the hash follows changes made through nested
+ * objects and collections
+ * This is positive test
+ */
+
+void JSonSerializerTest::testHash() {
+    JsonSerializer json, tempJson, other;
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(json.Parse(m_kTeststr));
+    TS_ASSERT(other.Parse(m_kTeststr));
+
+    uint64_t before = json.Hash();
+    TS_ASSERT_EQUALS(before, other.Hash());
+
+    TS_ASSERT(json.GetCollection("test", vec));
+    TS_ASSERT(vec[3].PutValue("3", string("changed")));
+    TS_ASSERT_DIFFERS(before, json.Hash());
+    TS_ASSERT(!json.Equals(other));
+
+    TS_ASSERT(vec[3].PutValue("3", string("7b8f16aa-25d2-44c4-b2f2-18828492fc62")));
+    TS_ASSERT_EQUALS(before, json.Hash());
+    TS_ASSERT(json.Equals(other));
+
+    TS_ASSERT(tempJson.CreateRootObject());
+    TS_ASSERT(json.PutObject("nested", tempJson));
+    uint64_t nested = json.Hash();
+    TS_ASSERT(tempJson.PutValue("key", 5));
+    TS_ASSERT_DIFFERS(nested, json.Hash());
+}
+
+/* Test31
+ * Method : Diff(), ApplyPatch()
+ * This test is to check the patch built by Diff turns one json into the other
+ * and that "test" compares numbers by value
+ * This is positive test
+ */
+
+void JSonSerializerTest::testDiffApplyPatch() {
+    JsonSerializer from, to, patch;
+    TS_ASSERT(from.Parse(
+        "{\"a\":1,\"b\":{\"c\":[1,2,3,4],\"d\":\"x\"},\"e/f\":true}"));
+    TS_ASSERT(to.Parse(
+        "{\"a\":1,\"b\":{\"c\":[1,9,4,5],\"g\":null},\"e/f\":false}"));
+
+    TS_ASSERT(from.Diff(to, patch));
+    TS_ASSERT(from.ApplyPatch(patch));
+    TS_ASSERT(from.Equals(to));
+
+    TS_ASSERT(to.Diff(from, patch));
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(patch.GetCollection("", vec));
+    TS_ASSERT_EQUALS(0, vec.size());
+
+    /* "test" compares numbers by value, also inside containers. */
+    TS_ASSERT(from.Parse("{\"a\":1,\"b\":[2.5,{\"c\":-3}]}"));
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"test\",\"path\":\"/a\",\"value\":1.0},"
+        "{\"op\":\"test\",\"path\":\"/b\",\"value\":[2.5,{\"c\":-3.0}]},"
+        "{\"op\":\"test\",\"path\":\"/b/1/c\",\"value\":-3e0}]"));
+    TS_ASSERT(from.ApplyPatch(patch));
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"test\",\"path\":\"/a\",\"value\":1.5}]"));
+    TS_ASSERT(!from.ApplyPatch(patch));
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"test\",\"path\":\"/a\",\"value\":\"1\"}]"));
+    TS_ASSERT(!from.ApplyPatch(patch));
+}
+
+/* Test32
+ * Method : ApplyPatch()
+ * This test is to check a failing patch leaves the json unchanged
+ * This is negative test
+ */
+
+void JSonSerializerTest::testApplyPatchNegative() {
+    JsonSerializer objJson, before, patch;
+    TS_ASSERT(objJson.Parse(m_kStrval));
+    before = objJson.DeepClone();
+
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"replace\",\"path\":\"/dbtype\",\"value\":\"x\"},"
+        "{\"op\":\"move\",\"from\":\"/mongo/port\",\"path\":\"/port\"},"
+        "{\"op\":\"remove\",\"path\":\"/mongo/WC\"},"
+        "{\"op\":\"test\",\"path\":\"/port\",\"value\":\"1\"}]"));
+    TS_ASSERT(!(objJson.ApplyPatch(patch)));
+    TS_ASSERT(objJson.Equals(before));
+
+    TS_ASSERT(patch.Parse("[{\"op\":\"remove\",\"path\":\"/missing\"}]"));
+    TS_ASSERT(!(objJson.ApplyPatch(patch)));
+    TS_ASSERT(objJson.Equals(before));
+}
+
+/* Test33
+ * Method : MergePatch()
+ * This test is to check merge patch against the example of RFC 7396
+ * This is positive test
+ */
+
+void JSonSerializerTest::testMergePatch() {
+    JsonSerializer objJson, patch, expected;
+    TS_ASSERT(objJson.Parse(
+        "{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\","
+        "\"familyName\":\"Doe\"},\"tags\":[\"example\",\"sample\"],"
+        "\"content\":\"This will be unchanged\"}"));
+    TS_ASSERT(patch.Parse(
+        "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\","
+        "\"author\":{\"familyName\":null},\"tags\":[\"example\"]}"));
+    TS_ASSERT(expected.Parse(
+        "{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},"
+        "\"tags\":[\"example\"],\"content\":\"This will be unchanged\","
+        "\"phoneNumber\":\"+01-123-456-7890\"}"));
+
+    uint64_t before = objJson.Hash();
+    TS_ASSERT(objJson.MergePatch(patch));
+    TS_ASSERT(objJson.Equals(expected));
+    TS_ASSERT_DIFFERS(before, objJson.Hash());
+    TS_ASSERT_EQUALS(expected.Hash(), objJson.Hash());
+}
+
+/* Test34
+ * Method : JsonSchema::Validate()
+ * This test is to check a built schema validates and extracts bound values
+ * This is positive test
+ */
+
+void JSonSerializerTest::testSchemaBuilder() {
+    string dbtype, hostip;
+    int port = 0;
+    JsonSerializer mongo;
+    JsonSchema schema;
+    schema.Type(JsonSchema::kObject);
+    schema.Property("dbtype", true).Bind(&dbtype).Length(1, 16);
+    schema.Property("mongo", true).Bind(&mongo).Type(JsonSchema::kObject);
+    schema.Property("mongo").Property("hostip", true).Bind(&hostip);
+    schema.Property("mongo").Property("port").Type(JsonSchema::kString);
+
+    JsonSerializer objJson;
+    TS_ASSERT(objJson.Parse(m_kStrval));
+    std::vector<JsonSchemaViolation> violations;
+    TS_ASSERT(schema.Validate(objJson, &violations));
+    TS_ASSERT_EQUALS(0, violations.size());
+    TS_ASSERT_EQUALS("mongo", dbtype);
+    TS_ASSERT_EQUALS("127.0.0.1", hostip);
+    string value;
+    TS_ASSERT(mongo.GetValue("WC", value));
+    TS_ASSERT_EQUALS("1", value);
+
+    JsonSchema portSchema;
+    portSchema.Property("port", true).Bind(&port).Minimum(1).Maximum(65535);
+    TS_ASSERT(objJson.Parse("{\"port\":30000}"));
+    TS_ASSERT(portSchema.Validate(objJson));
+    TS_ASSERT_EQUALS(30000, port);
+}
+
+/* Test35
+ * Method : JsonSchema::Compile()
+ * This test is to check the supported JSON Schema subset compiles and
+ * unsupported keywords are refused
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testSchemaCompile() {
+    JsonSerializer schemaJson, objJson;
+    TS_ASSERT(schemaJson.Parse(
+        "{\"type\":\"object\",\"required\":[\"ids\"],"
+        "\"additionalProperties\":false,\"properties\":{"
+        "\"ids\":{\"type\":\"array\",\"minItems\":1,\"items\":"
+        "{\"type\":\"integer\",\"exclusiveMinimum\":0}},"
+        "\"name\":{\"type\":[\"string\",\"null\"],\"maxLength\":3}}}"));
+    JsonSchema schema;
+    TS_ASSERT(schema.Compile(schemaJson));
+    long long id = 0;
+    schema.Property("ids").Items().Bind(&id);
+
+    TS_ASSERT(objJson.Parse("{\"ids\":[1,2.0,3],\"name\":null}"));
+    TS_ASSERT(schema.Validate(objJson));
+    TS_ASSERT_EQUALS(3, id);
+    TS_ASSERT(objJson.Parse("{\"ids\":[1],\"name\":\"\\u00e9t\\u00e9\"}"));
+    TS_ASSERT(schema.Validate(objJson));
+    TS_ASSERT(objJson.Parse("{\"ids\":[0]}"));
+    TS_ASSERT(!(schema.Validate(objJson)));
+    TS_ASSERT(objJson.Parse("{\"ids\":[],\"other\":1}"));
+    TS_ASSERT(!(schema.Validate(objJson)));
+
+    TS_ASSERT(schemaJson.Parse("{\"anyOf\":[{\"type\":\"string\"}]}"));
+    TS_ASSERT(!(schema.Compile(schemaJson)));
+    TS_ASSERT(schemaJson.Parse("{\"type\":\"text\"}"));
+    TS_ASSERT(!(schema.Compile(schemaJson)));
+    TS_ASSERT(schemaJson.Parse("{\"minimun\":1}"));
+    TS_ASSERT(!(schema.Compile(schemaJson)));
+
+    /* minimum and exclusiveMinimum both apply. */
+    TS_ASSERT(schemaJson.Parse(
+        "{\"title\":\"n\",\"minimum\":5,\"exclusiveMinimum\":3,"
+        "\"maximum\":9,\"exclusiveMaximum\":9}"));
+    TS_ASSERT(schema.Compile(schemaJson));
+    TS_ASSERT(objJson.Parse("4", JsonSerializer::kDecodeAny));
+    TS_ASSERT(!(schema.Validate(objJson)));
+    TS_ASSERT(objJson.Parse("5", JsonSerializer::kDecodeAny));
+    TS_ASSERT(schema.Validate(objJson));
+    TS_ASSERT(objJson.Parse("9", JsonSerializer::kDecodeAny));
+    TS_ASSERT(!(schema.Validate(objJson)));
+}
+
+/* Test36
+ * Method : JsonSchema::Validate()
+ * This test is to check every violation is listed with its JSON Pointer
+ * This is negative test
+ */
+
+void JSonSerializerTest::testSchemaViolations() {
+    int port = -1;
+    JsonSchema schema;
+    schema.Property("dbtype", true).Type(JsonSchema::kString);
+    JsonSchema& mongo = schema.Property("mongo", true);
+    mongo.AdditionalProperties(false);
+    mongo.Property("port", true).Bind(&port);
+    mongo.Property("hostip").Length(10, 15);
+    schema.Property("list").Items().Type(JsonSchema::kNumber);
+
+    JsonSerializer objJson;
+    TS_ASSERT(objJson.Parse(
+        "{\"mongo\":{\"hostip\":\"::1\",\"port\":\"30000\",\"a/b\":1},"
+        "\"list\":[1,\"2\",3.5,null]}"));
+    std::vector<JsonSchemaViolation> violations;
+    TS_ASSERT(!(schema.Validate(objJson, &violations)));
+    TS_ASSERT_EQUALS(-1, port);
+
+    std::set<string> paths;
+    for (size_t i = 0; i < violations.size(); ++i) {
+        paths.insert(violations[i].path);
+    }
+    TS_ASSERT_EQUALS(6, violations.size());
+    TS_ASSERT(paths.count("/dbtype"));
+    TS_ASSERT(paths.count("/mongo/port"));
+    TS_ASSERT(paths.count("/mongo/hostip"));
+    TS_ASSERT(paths.count("/mongo/a~1b"));
+    TS_ASSERT(paths.count("/list/1"));
+    TS_ASSERT(paths.count("/list/3"));
+
+    violations.clear();
+    TS_ASSERT(!(schema.Validate(objJson)));
+
+    /* an integer variable takes no real with a fractional part. */
+    JsonSchema real;
+    real.Property("n", true).Type(JsonSchema::kNumber).Bind(&port);
+    TS_ASSERT(objJson.Parse("{\"n\":1.5}"));
+    TS_ASSERT(!(real.Validate(objJson, &violations)));
+    TS_ASSERT_EQUALS(1, violations.size());
+    TS_ASSERT_EQUALS(-1, port);
+    TS_ASSERT(objJson.Parse("{\"n\":2.0}"));
+    TS_ASSERT(real.Validate(objJson));
+    TS_ASSERT_EQUALS(2, port);
+}
+
+/* Test37
+ * Method : Parse() with a projection
+ * This test is to check only the requested values are parsed
+ * This is positive test
+ */
+
+void JSonSerializerTest::testParseProjectionPositive() {
+    JsonSerializer objJson, mongo, full;
+    std::set<string> projection;
+    projection.insert("/mongo/port");
+    projection.insert("/missing/value");
+    TS_ASSERT(objJson.Parse(m_kStrval.c_str(), m_kStrval.size(), projection));
+
+    string value;
+    TS_ASSERT(!(objJson.GetValue("dbtype", value)));
+    TS_ASSERT(objJson.GetObject("mongo", mongo));
+    TS_ASSERT(mongo.GetValue("port", value));
+    TS_ASSERT_EQUALS("30000", value);
+    TS_ASSERT(!(mongo.GetValue("hostip", value)));
+    char* buffer = objJson.StreamJsonToBuffer();
+    TS_ASSERT_EQUALS(string("{\"mongo\":{\"port\":\"30000\"}}"), buffer);
+    free(buffer);
+
+    projection.clear();
+    projection.insert("/test/2");
+    TS_ASSERT(objJson.Parse(m_kTeststr.c_str(), m_kTeststr.size(),
+                            projection));
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(objJson.GetCollection("test", vec));
+    TS_ASSERT_EQUALS(3, vec.size());
+    TS_ASSERT(vec[2].GetValue("2", value));
+    TS_ASSERT_EQUALS("8551a577-b9bb-4724-aa4e-b0abac71d9da", value);
+
+    const string escaped = "{\"a\\/b\":{\"x\":[1,2]},\"c~d\":true,\"e\":1}";
+    projection.clear();
+    projection.insert("/a~1b");
+    projection.insert("/c~0d");
+    TS_ASSERT(objJson.Parse(escaped.c_str(), escaped.size(), projection));
+    TS_ASSERT(full.Parse("{\"a/b\":{\"x\":[1,2]},\"c~d\":true}"));
+    TS_ASSERT(objJson.Equals(full));
+
+    projection.clear();
+    projection.insert("");
+    TS_ASSERT(objJson.Parse(escaped.c_str(), escaped.size(), projection));
+    TS_ASSERT(full.Parse(escaped));
+    TS_ASSERT(objJson.Equals(full));
+
+    /* of a key given twice the last value counts, as in Parse. */
+    const string twice =
+        "{\"r\":{\"a\":{\"x\":1},\"b\":2,\"a\":{\"y\":2}},\"b\":1,\"b\":3}";
+    projection.clear();
+    projection.insert("/r/a/x");
+    projection.insert("/b");
+    TS_ASSERT(objJson.Parse(twice.c_str(), twice.size(), projection));
+    TS_ASSERT(full.Parse("{\"b\":3}"));
+    TS_ASSERT(objJson.Equals(full));
+    projection.insert("/r/a/y");
+    TS_ASSERT(objJson.Parse(twice.c_str(), twice.size(), projection));
+    TS_ASSERT(full.Parse("{\"r\":{\"a\":{\"y\":2}},\"b\":3}"));
+    TS_ASSERT(objJson.Equals(full));
+}
+
+/* Test38
+ * Method : Parse() with a projection
+ * This test is to check malformed input is refused even where it is skipped
+ * This is negative test
+ */
+
+void JSonSerializerTest::testParseProjectionNegative() {
+    JsonSerializer objJson;
+    std::set<string> projection;
+    projection.insert("/b");
+
+    const char* inputs[] = {"{\"a\":[1,,2],\"b\":1}", "{\"a\":01,\"b\":1}",
+                            "{\"a\":\"\\x\",\"b\":1}", "{\"a\":tru,\"b\":1}",
+                            "{\"a\":{\"b\":1},\"b\":1", "{\"b\":1} x",
+                            "\"b\""};
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+        TS_ASSERT(!(objJson.Parse(inputs[i], strlen(inputs[i]), projection)));
+    }
+    TS_ASSERT(!(objJson.Parse(m_kWrongval.c_str(), m_kWrongval.size(),
+                              projection)));
+
+    projection.insert("b");
+    TS_ASSERT(!(objJson.Parse(m_kStrval.c_str(), m_kStrval.size(),
+                              projection)));
+}
+
+/* Test39
+ * Method : Parse() through a JsonDocumentCache
+ * This test is to check repeated inputs share one copy-on-write document,
+ * parsed apart for different parse options
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testDocumentCache() {
+    JsonDocumentCache cache(8);
+    JsonSerializer first, second, other;
+    TS_ASSERT(first.Parse(m_kStrval, cache));
+    TS_ASSERT(second.Parse(m_kStrval, cache));
+    TS_ASSERT(first.Equals(second));
+
+    JsonDocumentCacheStats stats = cache.Stats();
+    TS_ASSERT_EQUALS(1, stats.hits);
+    TS_ASSERT_EQUALS(1, stats.misses);
+    TS_ASSERT_EQUALS(1, stats.entries);
+
+    string value;
+    TS_ASSERT(first.PutValue("dbtype", string("mysql")));
+    TS_ASSERT(second.GetValue("dbtype", value));
+    TS_ASSERT_EQUALS("mongo", value);
+    TS_ASSERT(other.Parse(m_kStrval, cache));
+    TS_ASSERT(other.GetValue("dbtype", value));
+    TS_ASSERT_EQUALS("mongo", value);
+
+    TS_ASSERT(!(other.Parse(m_kWrongval, cache)));
+    TS_ASSERT(!(other.Parse(m_kWrongval, cache)));
+    TS_ASSERT(cache.Parse("\"scalar\"", other, JSON_DECODE_ANY));
+    TS_ASSERT(!(cache.Parse("\"scalar\"", other)));
+    stats = cache.Stats();
+    TS_ASSERT_EQUALS(2, stats.hits);
+    TS_ASSERT_EQUALS(5, stats.misses);
+    TS_ASSERT_EQUALS(2, stats.entries);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&cache, &failures]() {
+            for (int i = 0; i < 100; ++i) {
+                JsonSerializer json;
+                string dbtype;
+                if (!json.Parse(m_kStrval, cache) ||
+                    !json.PutValue("dbtype", string("redis")) ||
+                    !json.GetValue("dbtype", dbtype) || dbtype != "redis") {
+                    ++failures;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    TS_ASSERT_EQUALS(0, failures.load());
+    TS_ASSERT(other.Parse(m_kStrval, cache));
+    uint64_t hits = cache.Stats().hits;
+    TS_ASSERT(other.GetValue("dbtype", value));
+    TS_ASSERT_EQUALS("mongo", value);
+
+    /* a nested object of a cached document is modified in place. */
+    JsonSerializer mongo;
+    TS_ASSERT(other.GetObject("mongo", mongo));
+    TS_ASSERT(mongo.PutValue("port", string("30001")));
+    TS_ASSERT(other.GetObject("mongo", mongo));
+    TS_ASSERT(mongo.GetValue("port", value));
+    TS_ASSERT_EQUALS("30001", value);
+    TS_ASSERT(second.Parse(m_kStrval, cache));
+    TS_ASSERT(second.GetObject("mongo", mongo));
+    TS_ASSERT(mongo.GetValue("port", value));
+    TS_ASSERT_EQUALS("30000", value);
+
+    /* parse options reach the parse and key the cache. */
+    string lossless = "{\"n\":1.50,\"n\":2.50}";
+    TS_ASSERT(!other.Parse(lossless, cache,
+                           JsonSerializer::kRejectDuplicates));
+    TS_ASSERT(other.Parse(lossless, cache, JsonSerializer::kLosslessNumbers));
+    TS_ASSERT(second.Parse(lossless, cache,
+                           JsonSerializer::kLosslessNumbers));
+    TS_ASSERT(second.GetNumberText("n", value));
+    TS_ASSERT_EQUALS("2.50", value);
+    TS_ASSERT_EQUALS("{\"n\":2.50}", Dumped(second));
+    TS_ASSERT(second.Parse(lossless, cache));
+    TS_ASSERT_EQUALS("{\"n\":2.5}", Dumped(second));
+    stats = cache.Stats();
+    TS_ASSERT_EQUALS(2, stats.hits - hits);
+}
+
+/* Test40
+ * Method : JsonDocumentCache
+ * This test is to check the least recently used document is evicted
+ * This is positive test
+ */
+
+void JSonSerializerTest::testDocumentCacheEviction() {
+    JsonDocumentCache cache(2, 1);
+    JsonSerializer json;
+    TS_ASSERT(json.Parse("{\"a\":1}", cache));
+    TS_ASSERT(json.Parse("{\"b\":1}", cache));
+    TS_ASSERT(json.Parse("{\"a\":1}", cache));
+    TS_ASSERT(json.Parse("{\"c\":1}", cache));
+    TS_ASSERT(json.Parse("{\"a\":1}", cache));
+    TS_ASSERT(json.Parse("{\"b\":1}", cache));
+
+    JsonDocumentCacheStats stats = cache.Stats();
+    TS_ASSERT_EQUALS(2, stats.hits);
+    TS_ASSERT_EQUALS(4, stats.misses);
+    TS_ASSERT_EQUALS(2, stats.evictions);
+    TS_ASSERT_EQUALS(2, stats.entries);
+
+    cache.Clear();
+    TS_ASSERT_EQUALS(0, cache.Stats().entries);
+    int a = 0;
+    TS_ASSERT(json.Parse("{\"a\":1}", cache));
+    TS_ASSERT(json.GetValue("a", a));
+    TS_ASSERT_EQUALS(1, a);
+}
+
+/* Helper to compare StreamJsonToBuffer with a fresh jansson dump. */
+bool JSonSerializerTest::DumpsMatch(const JsonSerializer& json,
+                                    json_t* root) {
+    char* got = json.StreamJsonToBuffer();
+    char* expected = json_dumps(root, JSON_ENCODE_ANY | JSON_COMPACT);
+    bool match = got && expected && strcmp(got, expected) == 0;
+    free(got);
+    free(expected);
+    return match;
+}
+
+/* Test41
+ * Method : StreamJsonToBuffer()
+ * This test is to check cached serialisations are dropped on every change
+ * and the output stays identical to json_dumps
+ * This is positive test
+ */
+
+void JSonSerializerTest::testStreamJsonToBufferCached() {
+    std::ostringstream strm;
+    strm << "{\"text\":\"tab\\there \\u0001 \\\"q\\\" \\u00e9/\",\"real\":1e20,"
+         << "\"small\":-2.5e-7,\"whole\":100.0,\"records\":[";
+    for (int i = 0; i < 200; ++i) {
+        if (i) strm << ",";
+        strm << "{\"id\":" << i << ",\"name\":\"record number " << i
+             << "\",\"tags\":[\"a\",\"b\"],\"pos\":{\"x\":" << i * 0.5
+             << ",\"y\":null,\"ok\":true,\"label\":\"some padding text\"}}";
+    }
+    strm << "],\"meta\":{\"count\":200}}";
+
+    /* the same edits go to a handle made from a raw pointer, which caches
+     * nothing, and to a parsed document, which caches its dumps. */
+    json_t* root = json_loads(strm.str().c_str(), 0, NULL);
+    TS_ASSERT(root);
+    JsonSerializer objJson[2], pos[2], meta[2], twin(root);
+    json_decref(root);
+    objJson[0] = twin;
+    TS_ASSERT(objJson[1].Parse(strm.str()));
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+
+    std::vector<JsonSerializer> vec[2];
+    for (int d = 0; d < 2; ++d) {
+        TS_ASSERT(objJson[d].GetCollection("records", vec[d]));
+        TS_ASSERT(vec[d][150].GetObject("pos", pos[d]));
+        TS_ASSERT(pos[d].PutValue("label", string("changed\n")));
+    }
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+    TS_ASSERT(DumpsMatch(vec[0][150], json_array_get(
+                                          json_object_get(root, "records"),
+                                          150)));
+    TS_ASSERT_EQUALS(Dumped(vec[0][150]), Dumped(vec[1][150]));
+
+    for (int d = 0; d < 2; ++d) {
+        TS_ASSERT(objJson[d].GetObject("meta", meta[d]));
+        TS_ASSERT(meta[d].PutValue("count", 201));
+    }
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+
+    for (int d = 0; d < 2; ++d) {
+        vec[d].resize(3);
+        TS_ASSERT(objJson[d].PutCollection("records", vec[d]));
+    }
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+    for (int d = 0; d < 2; ++d) {
+        TS_ASSERT(vec[d][1].PutValue("name", string("again")));
+    }
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+    for (int d = 0; d < 2; ++d) {
+        TS_ASSERT(objJson[d].PutObject("moved", pos[d]));
+        TS_ASSERT(pos[d].PutValue("y", 3));
+    }
+    TS_ASSERT(DumpsMatch(objJson[0], root));
+    TS_ASSERT_EQUALS(Dumped(objJson[0]), Dumped(objJson[1]));
+
+    /* handles made from the same pointer see each other's changes. */
+    JsonSerializer first(root), second(root);
+    TS_ASSERT(DumpsMatch(second, root));
+    uint64_t hash = second.Hash();
+    TS_ASSERT(first.PutValue("added", 1));
+    TS_ASSERT(DumpsMatch(second, root));
+    TS_ASSERT_DIFFERS(hash, second.Hash());
+    TS_ASSERT_EQUALS(first.Hash(), second.Hash());
+}
+
+/* Test42
+ * Method : PutValue(), StreamJsonToBuffer(), GetValue()
+ * This test is to check reals and integers round trip bit exactly
+ * This is positive test
+ */
+
+void JSonSerializerTest::testNumberRoundTrip() {
+    const double reals[] = {0.1,     -0.0,   1e-300, 5e-324,
+                            1.7976931348623157e308, 123456.789,
+                            2.5,     100.0,  1e20,   -3.0e-7};
+    const long long integers[] = {0, -1, 99, 100, LLONG_MAX, LLONG_MIN};
+
+    JsonSerializer json, parsed;
+    TS_ASSERT(json.CreateRootObject());
+    for (size_t i = 0; i < sizeof(reals) / sizeof(reals[0]); ++i) {
+        std::ostringstream key;
+        key << "r" << i;
+        TS_ASSERT(json.PutValue(key.str(), reals[i]));
+    }
+    for (size_t i = 0; i < sizeof(integers) / sizeof(integers[0]); ++i) {
+        std::ostringstream key;
+        key << "i" << i;
+        TS_ASSERT(json.PutValue(key.str(), integers[i]));
+    }
+
+    for (int shortest = 0; shortest < 2; ++shortest) {
+        char* buffer = json.StreamJsonToBuffer(shortest != 0);
+        TS_ASSERT(buffer);
+        TS_ASSERT(parsed.Parse(buffer));
+        free(buffer);
+
+        for (size_t i = 0; i < sizeof(reals) / sizeof(reals[0]); ++i) {
+            std::ostringstream key;
+            key << "r" << i;
+            double value = 1;
+            TS_ASSERT(parsed.GetValue(key.str(), value));
+            TS_ASSERT_EQUALS(0, memcmp(&value, &reals[i], sizeof(value)));
+        }
+        for (size_t i = 0; i < sizeof(integers) / sizeof(integers[0]); ++i) {
+            std::ostringstream key;
+            key << "i" << i;
+            long long value = 1;
+            TS_ASSERT(parsed.GetValue(key.str(), value));
+            TS_ASSERT_EQUALS(integers[i], value);
+        }
+    }
+
+    TS_ASSERT(parsed.Parse("{\"a\":0.1,\"b\":100.0,\"c\":1e20,\"d\":-7}"));
+    char* buffer = parsed.StreamJsonToBuffer(true);
+    TS_ASSERT_EQUALS(string("{\"a\":0.1,\"b\":100.0,\"c\":1e20,\"d\":-7}"),
+                     buffer);
+    free(buffer);
+    buffer = parsed.StreamJsonToBuffer();
+    TS_ASSERT_EQUALS(
+        string("{\"a\":0.10000000000000001,\"b\":100.0,\"c\":1e20,\"d\":-7}"),
+        buffer);
+    free(buffer);
+}
+
+/* Test43
+ * Method : GetValue()
+ * This test is to check numbers convert directly and out of range values
+ * are refused
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testGetValueNumbers() {
+    JsonSerializer json;
+    TS_ASSERT(json.Parse(
+        "{\"port\":\"30000\",\"big\":3000000000,\"neg\":-5,\"real\":2.75,"
+        "\"hex\":\"1A\",\"text\":\"12ab\",\"flag\":true,\"huge\":1e300}"));
+
+    int port = 0;
+    TS_ASSERT(json.GetValue("port", port));
+    TS_ASSERT_EQUALS(30000, port);
+    int big = 0;
+    TS_ASSERT(!(json.GetValue("big", big)));
+    long long bigger = 0;
+    TS_ASSERT(json.GetValue("big", bigger));
+    TS_ASSERT_EQUALS(3000000000LL, bigger);
+    unsigned short small = 0;
+    TS_ASSERT(!(json.GetValue("big", small)));
+
+    float real = 0;
+    TS_ASSERT(json.GetValue("real", real));
+    TS_ASSERT_EQUALS(2.75f, real);
+    TS_ASSERT(!(json.GetValue("huge", real)));
+    int truncated = 0;
+    TS_ASSERT(json.GetValue("real", truncated));
+    TS_ASSERT_EQUALS(2, truncated);
+
+    int hex = 0;
+    TS_ASSERT(json.GetValue("hex", hex, std::hex));
+    TS_ASSERT_EQUALS(26, hex);
+    int leading = 0;
+    TS_ASSERT(json.GetValue("text", leading));
+    TS_ASSERT_EQUALS(12, leading);
+    double neg = 0;
+    TS_ASSERT(json.GetValue("neg", neg));
+    TS_ASSERT_EQUALS(-5.0, neg);
+    bool flag = false;
+    TS_ASSERT(json.GetValue("flag", flag));
+    TS_ASSERT(flag);
+}
+
+/* Test44
+ * Method : JsonAsync::ParseAsync()
+ * This test is to check async parses match Parse, inline and on the pool,
+ * and that completions go through the executor and cancellation is seen
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testParseAsync() {
+    string input = BuildLargeArray();
+    JsonSerializer serial;
+    TS_ASSERT(serial.Parse(input));
+
+    std::vector<std::function<void()> > posted;
+    JsonAsyncOptions options;
+    options.executor = [&posted](const std::function<void()>& task) {
+        posted.push_back(task);
+    };
+    std::atomic<int> completions(0);
+    std::future<JsonParseResult> pending = JsonAsync::ParseAsync(
+        input, options, [&completions](const JsonParseResult& result) {
+            if (result.ok) ++completions;
+        });
+
+    std::future<JsonParseResult> large = JsonAsync::ParseAsync(input);
+    JsonParseResult result = large.get();
+    TS_ASSERT(result.ok);
+    TS_ASSERT(!result.cancelled);
+    TS_ASSERT(result.json.Equals(serial));
+
+    std::future<JsonParseResult> small = JsonAsync::ParseAsync(m_kStrval);
+    TS_ASSERT(small.wait_for(std::chrono::seconds(0)) ==
+              std::future_status::ready);
+    TS_ASSERT(small.get().ok);
+    TS_ASSERT(!JsonAsync::ParseAsync("{\"a\":").get().ok);
+
+    /* the completion only runs once the caller's loop runs it. */
+    while (pending.wait_for(std::chrono::milliseconds(1)) !=
+           std::future_status::ready) {
+        std::vector<std::function<void()> > tasks;
+        tasks.swap(posted);
+        for (size_t i = 0; i < tasks.size(); ++i) tasks[i]();
+    }
+    TS_ASSERT_EQUALS(1, completions.load());
+    TS_ASSERT(pending.get().json.Equals(serial));
+
+    JsonAsyncOptions cancelled;
+    cancelled.cancellation.Cancel();
+    result = JsonAsync::ParseAsync(input, cancelled).get();
+    TS_ASSERT(!result.ok);
+    TS_ASSERT(result.cancelled);
+    result = JsonAsync::ParseAsync(m_kStrval, cancelled).get();
+    TS_ASSERT(result.cancelled);
+}
+
+/* Test45
+ * Method : JsonAsync::StreamAsync()
+ * This test is to check async serialisation matches StreamJsonToBuffer and
+ * is not affected by later changes to the document, also through handles
+ * taken before the call
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testStreamAsync() {
+    JsonSerializer array, json;
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(array.Parse(BuildLargeArray()));
+    TS_ASSERT(array.GetCollection("", vec));
+    TS_ASSERT(json.CreateRootObject());
+    TS_ASSERT(json.PutCollection("records", vec));
+    char* buffer = json.StreamJsonToBuffer();
+    TS_ASSERT(buffer);
+    string expected(buffer ? buffer : "");
+    free(buffer);
+
+    std::future<JsonStreamResult> large = JsonAsync::StreamAsync(json);
+    TS_ASSERT(json.PutValue("extra", 1));
+
+    JsonStreamResult result = large.get();
+    TS_ASSERT(result.ok);
+    TS_ASSERT_EQUALS(expected, result.text);
+
+    std::vector<JsonSerializer> records;
+    TS_ASSERT(json.GetCollection("records", records));
+    TS_ASSERT(!records.empty());
+    expected = Dumped(json);
+    large = JsonAsync::StreamAsync(json);
+    TS_ASSERT(!records.empty() && records[0].PutValue("edited", 1));
+    TS_ASSERT_EQUALS(expected, large.get().text);
+    TS_ASSERT(Dumped(json).find("\"edited\":1") != string::npos);
+
+    JsonSerializer small;
+    TS_ASSERT(small.Parse(m_kStrval));
+    std::future<JsonStreamResult> inlined = JsonAsync::StreamAsync(small);
+    TS_ASSERT(inlined.wait_for(std::chrono::seconds(0)) ==
+              std::future_status::ready);
+    buffer = small.StreamJsonToBuffer();
+    TS_ASSERT_EQUALS(string(buffer), inlined.get().text);
+    free(buffer);
+
+    TS_ASSERT(!JsonAsync::StreamAsync(JsonSerializer()).get().ok);
+    JsonAsyncOptions cancelled;
+    cancelled.cancellation.Cancel();
+    result = JsonAsync::StreamAsync(json, cancelled).get();
+    TS_ASSERT(result.cancelled);
+    TS_ASSERT(result.text.empty());
+}
+
+/*
+ * Record type for the JsonRecordCodec tests.
+ */
+struct TestRecord {
+    TestRecord() : id(0), score(0), active(false), count(0) {}
+
+    long long id;
+    string name;
+    double score;
+    bool active;
+    unsigned int count;
+};
+
+static void SetupRecordCodec(JsonRecordCodec<TestRecord>& codec) {
+    codec.Field("id", &TestRecord::id, true)
+        .Field("name", &TestRecord::name)
+        .Field("score", &TestRecord::score)
+        .Field("active", &TestRecord::active)
+        .Field("count", &TestRecord::count);
+}
+
+static TestRecord MakeTestRecord(size_t i) {
+    TestRecord record;
+    record.id = i * 7919;
+    std::ostringstream name;
+    name << "record \"" << i << "\"";
+    record.name = name.str();
+    record.score = i * 0.1;
+    record.active = i % 3 == 0;
+    record.count = i % 1000;
+    return record;
+}
+
+/* Test46
+ * Method : JsonRecordCodec::Put(), JsonRecordCodec::Get()
+ * This test is to check a batch encodes as the per record putters do and
+ * decodes back
+ * This is positive and negative test
+ */
+
+void JSonSerializerTest::testRecordCodec() {
+    JsonRecordCodec<TestRecord> codec;
+    SetupRecordCodec(codec);
+
+    std::vector<TestRecord> records;
+    std::vector<JsonSerializer> vec;
+    for (size_t i = 0; i < 10; ++i) {
+        records.push_back(MakeTestRecord(i));
+        JsonSerializer element;
+        TS_ASSERT(element.CreateRootObject());
+        TS_ASSERT(element.PutValue("id", records[i].id));
+        TS_ASSERT(element.PutValue("name", records[i].name));
+        TS_ASSERT(element.PutValue("score", records[i].score));
+        TS_ASSERT(element.PutValue("active", records[i].active));
+        TS_ASSERT(element.PutValue("count", records[i].count));
+        vec.push_back(element);
+    }
+
+    JsonSerializer batch, single;
+    TS_ASSERT(batch.CreateRootObject());
+    TS_ASSERT(codec.Put(batch, "records", records));
+    TS_ASSERT(single.CreateRootObject());
+    TS_ASSERT(single.PutCollection("records", vec));
+    TS_ASSERT(batch.Equals(single));
+
+    std::vector<TestRecord> decoded;
+    TS_ASSERT(codec.Get(batch, "records", decoded));
+    TS_ASSERT_EQUALS(records.size(), decoded.size());
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        TS_ASSERT_EQUALS(records[i].id, decoded[i].id);
+        TS_ASSERT_EQUALS(records[i].name, decoded[i].name);
+        TS_ASSERT_EQUALS(records[i].score, decoded[i].score);
+        TS_ASSERT_EQUALS(records[i].active, decoded[i].active);
+        TS_ASSERT_EQUALS(records[i].count, decoded[i].count);
+    }
+
+    JsonSerializer root;
+    TS_ASSERT(codec.Put(root, "", records));
+    TS_ASSERT(codec.Get(root, "", decoded));
+    TS_ASSERT_EQUALS(records.size(), decoded.size());
+
+    /* a copy of a handle whose tree another handle already copied on
+     * write stores into that copy, not into the clone. */
+    JsonSerializer handle = batch;
+    JsonSerializer clone = batch.DeepClone(true);
+    TS_ASSERT(batch.PutValue("x", 1));
+    JsonSerializer stale = handle;
+    TS_ASSERT(codec.Put(stale, "again", records));
+    TS_ASSERT(codec.Get(batch, "again", decoded));
+    TS_ASSERT_EQUALS(records.size(), decoded.size());
+    TS_ASSERT(!codec.Get(clone, "again", decoded));
+    TS_ASSERT(clone.Equals(single));
+
+    JsonSerializer json;
+    TS_ASSERT(json.Parse("{\"a\":[{\"id\":1,\"name\":\"x\"},{\"name\":\"y\"}],"
+                         "\"b\":[{\"id\":\"12\",\"count\":-1}],"
+                         "\"c\":[{\"id\":1,\"active\":\"yes\"}],"
+                         "\"d\":[{\"id\":2,\"count\":\"7\"}],\"e\":[3]}"));
+    TS_ASSERT(!codec.Get(json, "a", decoded));
+    TS_ASSERT(!codec.Get(json, "b", decoded));
+    TS_ASSERT(!codec.Get(json, "c", decoded));
+    TS_ASSERT(!codec.Get(json, "e", decoded));
+    TS_ASSERT(!codec.Get(json, "missing", decoded));
+    TS_ASSERT(codec.Get(json, "d", decoded));
+    TS_ASSERT_EQUALS(1U, decoded.size());
+    TS_ASSERT_EQUALS(7U, decoded[0].count);
+    TS_ASSERT_EQUALS(string(""), decoded[0].name);
+
+    JsonRecordCodec<TestRecord> invalid;
+    invalid.Field("bad\xff", &TestRecord::id);
+    TS_ASSERT(!invalid.Put(json, "x", records));
+}
+
+/* Test47
+ * Method : JsonRecordCodec::Put(), JsonRecordCodec::Get()
+ * This test is to check a batch large enough to be split across threads
+ * gives the same json and records as a serial one
+ * This is positive test
+ */
+
+void JSonSerializerTest::testRecordCodecParallel() {
+    JsonRecordCodec<TestRecord> codec;
+    SetupRecordCodec(codec);
+
+    std::vector<TestRecord> records;
+    for (size_t i = 0; i < 50000; ++i) records.push_back(MakeTestRecord(i));
+
+    JsonSerializer parallel, serial;
+    TS_ASSERT(parallel.CreateRootObject());
+    TS_ASSERT(codec.Put(parallel, "records", records, 4));
+    TS_ASSERT(serial.CreateRootObject());
+    TS_ASSERT(codec.Put(serial, "records", records, 1));
+    TS_ASSERT(parallel.Equals(serial));
+
+    std::vector<TestRecord> decoded;
+    TS_ASSERT(codec.Get(parallel, "records", decoded, 4));
+    TS_ASSERT_EQUALS(records.size(), decoded.size());
+    bool same = decoded.size() == records.size();
+    for (size_t i = 0; same && i < decoded.size(); ++i) {
+        same = records[i].id == decoded[i].id &&
+               records[i].name == decoded[i].name &&
+               records[i].score == decoded[i].score &&
+               records[i].active == decoded[i].active &&
+               records[i].count == decoded[i].count;
+    }
+    TS_ASSERT(same);
+
+    std::vector<JsonSerializer> vec;
+    TS_ASSERT(parallel.GetCollection("records", vec));
+    TS_ASSERT(vec[49999].PutValue("count", string("many")));
+    TS_ASSERT(!codec.Get(parallel, "records", decoded, 4));
+}
+
+/* Test48
+ * Method : JsonBinaryStore::Compile(), JsonBinaryStore::Open(),
+ *          JsonBinaryView getters
+ * This test is to check a compiled store answers the getters as the
+ * serializer it was compiled from does
+ * This is positive test
+ */
+
+void JSonSerializerTest::testBinaryStore() {
+    const char* path = "jsonBinaryStoreTest.bin";
+    JsonSerializer json;
+    TS_ASSERT(json.Parse(
+        "{\"name\":\"ref\",\"port\":\"30000\",\"big\":3000000000,"
+        "\"real\":2.75,\"flag\":true,\"none\":null,\"z\":{\"k\":[1,2]},"
+        "\"tags\":[\"b\",\"a\",\"c\"],\"rows\":[{\"id\":1},{\"id\":2}],"
+        "\"a\":{\"name\":\"nested\"}}"));
+    TS_ASSERT(JsonBinaryStore::Compile(json, path));
+
+    JsonBinaryView root;
+    {
+        JsonBinaryStore store;
+        TS_ASSERT(!store.Root(root));
+        TS_ASSERT(store.Open(path));
+        TS_ASSERT(store.Root(root));
+    }
+
+    string name;
+    TS_ASSERT(root.GetValue("name", name));
+    TS_ASSERT_EQUALS(string("ref"), name);
+    int port = 0;
+    TS_ASSERT(root.GetValue("port", port));
+    TS_ASSERT_EQUALS(30000, port);
+    int big = 0;
+    TS_ASSERT(!root.GetValue("big", big));
+    long long bigger = 0;
+    TS_ASSERT(root.GetValue("big", bigger));
+    TS_ASSERT_EQUALS(3000000000LL, bigger);
+    double real = 0;
+    TS_ASSERT(root.GetValue("real", real));
+    TS_ASSERT_EQUALS(2.75, real);
+    bool flag = false;
+    TS_ASSERT(root.GetValue("flag", flag));
+    TS_ASSERT(flag);
+    TS_ASSERT(!root.GetValue("missing", port));
+
+    string text;
+    TS_ASSERT(!root.GetValue("z", text));
+    TS_ASSERT(!root.GetValue("none", port));
+
+    JsonBinaryView nested;
+    TS_ASSERT(root.GetObject("a", nested));
+    TS_ASSERT(nested.GetValue("name", name));
+    TS_ASSERT_EQUALS(string("nested"), name);
+
+    std::vector<JsonBinaryView> rows;
+    TS_ASSERT(root.GetCollection("rows", rows));
+    TS_ASSERT_EQUALS(2U, rows.size());
+    int id = 0;
+    TS_ASSERT(rows[1].GetValue("id", id));
+    TS_ASSERT_EQUALS(2, id);
+    TS_ASSERT(!root.GetCollection("name", rows));
+
+    std::set<string> tags, expectedTags;
+    TS_ASSERT(root.GetStringCollection("tags", tags));
+    TS_ASSERT(json.GetStringCollection("tags", expectedTags));
+    TS_ASSERT(tags == expectedTags);
+    TS_ASSERT(!root.GetStringCollection("rows", tags));
+
+    JsonSerializer copy;
+    TS_ASSERT(root.Materialize(copy));
+    TS_ASSERT(copy.Equals(json));
+    char* a = copy.StreamJsonToBuffer();
+    char* b = json.StreamJsonToBuffer();
+    TS_ASSERT_EQUALS(string(b), string(a));
+    free(a);
+    free(b);
+
+    remove(path);
+}
+
+/* Test49
+ * Method : JsonBinaryStore::Open(), JsonBinaryView getters
+ * This test is to check missing, foreign and damaged files are refused or
+ * make the getters fail, and that files whose arrays share nodes or point
+ * forward are not materialised
+ * This is negative test
+ */
+
+void JSonSerializerTest::testBinaryStoreNegative() {
+    const char* path = "jsonBinaryStoreTest.bin";
+    JsonBinaryStore store;
+    JsonBinaryView view;
+    string value;
+    TS_ASSERT(!store.Open("no/such/file.bin"));
+    TS_ASSERT(!view.GetValue("a", value));
+    TS_ASSERT(!JsonBinaryStore::Compile(JsonSerializer(), path));
+
+    FILE* file = fopen(path, "wb");
+    fputs("{\"a\":1}                                    ", file);
+    fclose(file);
+    TS_ASSERT(!store.Open(path));
+
+    JsonSerializer json;
+    TS_ASSERT(json.Parse("{\"a\":\"x\",\"b\":[\"y\",\"z\"],\"c\":{\"d\":1}}"));
+    TS_ASSERT(JsonBinaryStore::Compile(json, path));
+    std::ifstream in(path, std::ios::binary);
+    string image((std::istreambuf_iterator<char>(in)),
+                 std::istreambuf_iterator<char>());
+    in.close();
+
+    /* every single byte overwritten in turn: opening may fail, but the
+     * getters must never read outside the file. */
+    for (size_t i = 0; i < image.size(); ++i) {
+        string damaged = image;
+        damaged[i] = (char)0xff;
+        file = fopen(path, "wb");
+        fwrite(damaged.data(), 1, damaged.size(), file);
+        fclose(file);
+        if (!store.Open(path)) continue;
+
+        TS_ASSERT(store.Root(view));
+        std::vector<JsonBinaryView> vec;
+        std::set<string> strings;
+        JsonBinaryView nested;
+        JsonSerializer copy;
+        int number;
+        view.GetValue("a", value);
+        view.GetValue("c", value);
+        view.GetCollection("b", vec);
+        view.GetStringCollection("b", strings);
+        if (view.GetObject("c", nested)) nested.GetValue("d", number);
+        view.Materialize(copy);
+    }
+
+    /* hand written files: 40 arrays of two items that both point at the
+     * array before, 2^40 nodes once expanded, then an array whose item
+     * lies after it. Type 1 is null and type 7 an array. */
+    struct Image {
+        void Put32(uint32_t value) { bytes.append((char*)&value, 4); }
+        void Put64(uint64_t value) { bytes.append((char*)&value, 8); }
+        void Array(uint64_t a, uint64_t b) {
+            Put32(7); Put32(0); Put64(2); Put64(a); Put64(b);
+        }
+        bool Store(const char* path, uint64_t root) {
+            memcpy(&bytes[0], "JSNB", 4);
+            uint64_t size = bytes.size();
+            memcpy(&bytes[16], &size, 8);
+            memcpy(&bytes[24], &root, 8);
+            FILE* file = fopen(path, "wb");
+            fwrite(bytes.data(), 1, bytes.size(), file);
+            return fclose(file) == 0;
+        }
+        std::string bytes;
+    };
+    Image shared;
+    shared.Put32(0); shared.Put32(0x01020304u); shared.Put32(1);
+    shared.Put32(0); shared.Put64(0); shared.Put64(0);
+    uint64_t previous = shared.bytes.size();
+    shared.Put32(1); shared.Put32(0);
+    for (int i = 0; i < 40; ++i) {
+        uint64_t offset = shared.bytes.size();
+        shared.Array(previous, previous);
+        previous = offset;
+    }
+    TS_ASSERT(shared.Store(path, previous));
+    TS_ASSERT(store.Open(path));
+    TS_ASSERT(store.Root(view));
+    JsonSerializer copy;
+    TS_ASSERT(!view.Materialize(copy));
+
+    Image forward = shared;
+    forward.bytes.resize(32);
+    forward.Array(64, 64);
+    forward.Put32(1); forward.Put32(0);
+    TS_ASSERT(forward.Store(path, 32));
+    TS_ASSERT(store.Open(path));
+    TS_ASSERT(store.Root(view));
+    TS_ASSERT(!view.Materialize(copy));
+
+    remove(path);
+}
+
+string JSonSerializerTest::Dumped(const JsonSerializer& json) {
+    char* buffer = json.StreamJsonToBuffer();
+    string text(buffer ? buffer : "");
+    free(buffer);
+    return text;
+}
+
+/* Test50
+ * Method : Parse(instr, options), GetNumberText()
+ * This test is to check a document parsed with its source kept dumps byte
+ * for byte as it was read, keeps numbers json_loads cannot hold, only
+ * re-encodes the path to a modified value, and drops the text of numbers
+ * a patch removed
+ * This is positive test
+ */
+
+void JSonSerializerTest::testParseKeepSource() {
+    string other = "{ \"list\" : [ 1.50, 2e3, -0, \"\\u00e9\" ],";
+    for (char c = 'a'; c < 'k'; ++c) {
+        other += string(" \"pad") + c + "\": \"0123456789\",";
+    }
+    other += " \"end\" : true }";
+    string text =
+        "{ \"z\" : 1.10,\n  \"a\" : 12345678901234567890123,\n"
+        "  \"obj\" : {\"k\" : 1},\n  \"other\" : " + other + " }";
+
+    JsonSerializer plain;
+    TS_ASSERT(!plain.Parse(text));
+
+    int keep = JsonSerializer::kPreserveOrder |
+               JsonSerializer::kLosslessNumbers;
+    JsonSerializer json;
+    TS_ASSERT(json.Parse("  " + text + "\n", keep));
+    TS_ASSERT_EQUALS(text, Dumped(json));
+    TS_ASSERT_EQUALS(text, Dumped(json));
+
+    string number;
+    TS_ASSERT(json.GetNumberText("z", number));
+    TS_ASSERT_EQUALS(string("1.10"), number);
+    TS_ASSERT(json.GetNumberText("a", number));
+    TS_ASSERT_EQUALS(string("12345678901234567890123"), number);
+    TS_ASSERT(!json.GetNumberText("obj", number));
+    double real = 0;
+    TS_ASSERT(json.GetValue("z", real));
+    TS_ASSERT_EQUALS(1.1, real);
+
+    /* an integer beyond long long is held as the nearest real. */
+    TS_ASSERT(json.GetValue("a", real));
+    TS_ASSERT_EQUALS(12345678901234567890123.0, real);
+    JsonSerializer copy = json.DeepClone();
+    TS_ASSERT(Dumped(copy).find("\"a\":1.2345678901234568e22") !=
+              string::npos);
+
+    /* only the modified object and the root are encoded again. */
+    JsonSerializer obj;
+    TS_ASSERT(json.GetObject("obj", obj));
+    TS_ASSERT(obj.PutValue("k", 2));
+    string modified = Dumped(json);
+    TS_ASSERT_EQUALS(
+        "{\"z\":1.10,\"a\":12345678901234567890123,\"obj\":{\"k\":2},"
+        "\"other\":" + other + "}",
+        modified);
+    JsonSerializer expected;
+    TS_ASSERT(expected.Parse(modified, keep));
+    TS_ASSERT(expected.Equals(json));
+
+    /* numbers alone keep their text; containers are encoded compactly. */
+    JsonSerializer numbers;
+    TS_ASSERT(
+        numbers.Parse("{ \"n\" : 1.10, \"m\" : [99999999999999999999] }",
+                      JsonSerializer::kLosslessNumbers));
+    TS_ASSERT_EQUALS(string("{\"n\":1.10,\"m\":[99999999999999999999]}"),
+                     Dumped(numbers));
+    TS_ASSERT(numbers.PutValue("n", 2.5));
+    TS_ASSERT(numbers.GetNumberText("n", number));
+    TS_ASSERT_EQUALS(string("2.5"), number);
+
+    JsonSerializer scalar;
+    TS_ASSERT(scalar.Parse(" 1.0e3 ", JsonSerializer::kDecodeAny |
+                                          JsonSerializer::kLosslessNumbers));
+    TS_ASSERT_EQUALS(string("1.0e3"), Dumped(scalar));
+
+    JsonSerializer any;
+    TS_ASSERT(any.Parse("\"text\"", JsonSerializer::kDecodeAny));
+    TS_ASSERT_EQUALS(string("\"text\""), Dumped(any));
+
+    /* the last of duplicate keys wins, as with Parse. */
+    JsonSerializer duplicate;
+    TS_ASSERT(duplicate.Parse(
+        "{ \"a\" : 1, \"b\" : {\"c\": 1}, \"a\" : [ 2 ] }", keep));
+    TS_ASSERT_EQUALS(string("{\"a\":[2],\"b\":{\"c\":1}}"),
+                     Dumped(duplicate));
+    JsonSerializer last;
+    TS_ASSERT(last.Parse("{\"a\":[2],\"b\":{\"c\":1}}"));
+    TS_ASSERT(last.Equals(duplicate));
+
+    /* the text of a number replaced by a patch goes with it, even though
+     * the patch kept the number for its undo, and a failed patch puts the
+     * number back with its text. */
+    JsonSerializer patched, patch;
+    TS_ASSERT(patched.Parse("{\"a\":1.50,\"b\":2}",
+                            JsonSerializer::kLosslessNumbers));
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"replace\",\"path\":\"/b\",\"value\":3},"
+        "{\"op\":\"remove\",\"path\":\"/missing\"}]"));
+    TS_ASSERT(!patched.ApplyPatch(patch));
+    TS_ASSERT_EQUALS(string("{\"a\":1.50,\"b\":2}"), Dumped(patched));
+    TS_ASSERT(patch.Parse(
+        "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":\"s\"},"
+        "{\"op\":\"remove\",\"path\":\"/a\"}]"));
+    TS_ASSERT(patched.ApplyPatch(patch));
+    string added = "{\"b\":2";
+    for (int i = 0; i < 40; ++i) {
+        TS_ASSERT(patched.PutValue("c" + std::to_string(i), 1));
+        added += ",\"c" + std::to_string(i) + "\":1";
+    }
+    TS_ASSERT_EQUALS(added + "}", Dumped(patched));
+    TS_ASSERT(patched.GetNumberText("c1", number));
+    TS_ASSERT_EQUALS(string("1"), number);
+}
+
+/* Test51
+ * Method : Parse(instr, options)
+ * This test is to check the parse options reject what json_loads rejects,
+ * and duplicate keys and scalar roots unless asked to accept them
+ * This is negative test
+ */
+
+void JSonSerializerTest::testParseOptionsNegative() {
+    int modes[] = {0, JsonSerializer::kPreserveOrder,
+                   JsonSerializer::kLosslessNumbers};
+    const char* bad[] = {"",          "{",          "{\"a\":}",
+                         "[1,]",      "{\"a\" 1}",  "{\"a\":1,}",
+                         "[01]",      "[1.]",       "[.5]",
+                         "[-]",       "[1e]",       "[tru]",
+                         "[1e400]",   "[\"\\u0000\"]", "[\"\\x\"]",
+                         "[\"\xff\"]", "{\"\xff\":1}", "{\"a\":1} x",
+                         "[1] [2]",   "{1:2}",      "[\"a\nb\"]"};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+            JsonSerializer json;
+            TS_ASSERT(!json.Parse(bad[i], modes[m]));
+            TS_ASSERT(!json.Parse(bad[i], modes[m] |
+                                              JsonSerializer::kDecodeAny));
+        }
+
+        JsonSerializer json;
+        TS_ASSERT(json.Parse("{\"a\":1,\"a\":2}", modes[m]));
+        TS_ASSERT(!json.Parse("{\"a\":1,\"a\":2}",
+                              modes[m] | JsonSerializer::kRejectDuplicates));
+        TS_ASSERT(!json.Parse("[{\"b\":{\"a\":1,\"a\":2}}]",
+                              modes[m] | JsonSerializer::kRejectDuplicates));
+        TS_ASSERT(json.Parse("{\"a\":1,\"b\":2}",
+                             modes[m] | JsonSerializer::kRejectDuplicates));
+
+        TS_ASSERT(!json.Parse("5", modes[m]));
+        TS_ASSERT(!json.Parse("\"s\"", modes[m]));
+        TS_ASSERT(json.Parse("5", modes[m] | JsonSerializer::kDecodeAny));
+        TS_ASSERT(json.Parse("null", modes[m] | JsonSerializer::kDecodeAny));
+
+        string deep(2048, '[');
+        deep += string(2048, ']');
+        TS_ASSERT(json.Parse(deep, modes[m]));
+        TS_ASSERT(!json.Parse("[" + deep + "]", modes[m]));
+    }
+
+    /* integers beyond long long only parse with lossless numbers. */
+    JsonSerializer json;
+    TS_ASSERT(!json.Parse("[9223372036854775808]",
+                          JsonSerializer::kPreserveOrder));
+    TS_ASSERT(json.Parse("[9223372036854775807]",
+                         JsonSerializer::kPreserveOrder));
+    TS_ASSERT(json.Parse("[-9223372036854775809]",
+                         JsonSerializer::kLosslessNumbers));
+    TS_ASSERT(!json.Parse("[1e400]", JsonSerializer::kLosslessNumbers));
+    TS_ASSERT(json.Parse("[1e-400]", JsonSerializer::kLosslessNumbers));
+}
+
+/* Test52
+ * Method : JsonNodePool::Install(), JsonNodePool::Allocate(),
+ *          JsonNodePool::Free()
+ * This test is to check blocks are reused from the thread's free list, the
+ * caches stay bounded, blocks freed on another thread come back through the
+ * depot, and documents built with the pool installed work as before
+ * This is positive test
+ */
+
+void JSonSerializerTest::testNodePool() {
+    JsonNodePool::Trim();
+
+    size_t sizes[] = {0, 1, 16, 17, 100, 256};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        char* block = static_cast<char*>(JsonNodePool::Allocate(sizes[i]));
+        TS_ASSERT(block != 0);
+        memset(block, 0x5A, sizes[i]);
+        JsonNodePool::Free(block);
+        TS_ASSERT_EQUALS(block, JsonNodePool::Allocate(sizes[i]));
+        JsonNodePool::Free(block);
+    }
+    void* large = JsonNodePool::Allocate(NODE_POOL_MAX_SIZE + 1);
+    TS_ASSERT(large != 0);
+    size_t cached = JsonNodePool::CachedBlocks();
+    JsonNodePool::Free(large);
+    TS_ASSERT_EQUALS(cached, JsonNodePool::CachedBlocks());
+
+    /* at most NODE_POOL_THREAD_CACHE blocks of a class stay with the
+     * thread; the rest goes to the depot. */
+    std::vector<void*> blocks;
+    for (int i = 0; i < 3 * NODE_POOL_THREAD_CACHE; ++i) {
+        blocks.push_back(JsonNodePool::Allocate(40));
+    }
+    JsonNodePool::Trim();
+    std::thread releaser([&blocks]() {
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            JsonNodePool::Free(blocks[i]);
+        }
+        TS_ASSERT(JsonNodePool::CachedBlocks() <= NODE_POOL_THREAD_CACHE);
+    });
+    releaser.join();
+    TS_ASSERT_EQUALS(0u, JsonNodePool::CachedBlocks());
+    TS_ASSERT_EQUALS(blocks.size(), JsonNodePool::DepotBlocks());
+
+    /* the blocks freed on the other thread are handed out here. */
+    std::set<void*> freed(blocks.begin(), blocks.end());
+    void* block = JsonNodePool::Allocate(40);
+    TS_ASSERT(freed.count(block) != 0);
+    JsonNodePool::Free(block);
+    JsonNodePool::Trim();
+    TS_ASSERT_EQUALS(0u, JsonNodePool::DepotBlocks());
+
+    json_malloc_t oldMalloc;
+    json_free_t oldFree;
+    json_get_alloc_funcs(&oldMalloc, &oldFree);
+    JsonNodePool::Install();
+    std::vector<std::string> dumps(4);
+    std::vector<std::thread> builders;
+    for (size_t t = 0; t < dumps.size(); ++t) {
+        builders.push_back(std::thread([&dumps, t]() {
+            for (int round = 0; round < 50; ++round) {
+                JsonSerializer root;
+                root.CreateRootObject();
+                std::vector<JsonSerializer> rows;
+                for (int i = 0; i < 20; ++i) {
+                    JsonSerializer row;
+                    row.CreateRootObject();
+                    row.PutValue("id", i);
+                    row.PutValue("name", std::string("row"));
+                    row.PutValue("weight", 0.25 * i);
+                    rows.push_back(row);
+                }
+                root.PutCollection("rows", rows);
+                std::string text;
+                TS_ASSERT(root.GetValue<std::string>("rows", text));
+                char* buffer = root.StreamJsonToBuffer();
+                if (buffer) dumps[t] = buffer;
+                free(buffer);
+            }
+        }));
+    }
+    for (size_t t = 0; t < builders.size(); ++t) builders[t].join();
+    json_set_alloc_funcs(oldMalloc, oldFree);
+    JsonNodePool::Trim();
+
+    JsonSerializer back;
+    TS_ASSERT(back.Parse(dumps[0]));
+    std::vector<JsonSerializer> rows;
+    TS_ASSERT(back.GetCollection("rows", rows));
+    TS_ASSERT_EQUALS(20u, rows.size());
+    for (size_t t = 1; t < dumps.size(); ++t) {
+        TS_ASSERT_EQUALS(dumps[0], dumps[t]);
+    }
+}
+
+/* Test53
+ * Method : JsonNodePool::Allocate(), JsonNodePool::Free()
+ * This test is to check requests that cannot be met fail cleanly and null
+ * is accepted by Free
+ * This is negative test
+ */
+
+void JSonSerializerTest::testNodePoolNegative() {
+    TS_ASSERT(JsonNodePool::Allocate((size_t)-1) == 0);
+    TS_ASSERT(JsonNodePool::Allocate((size_t)-1 - 8) == 0);
+    size_t cached = JsonNodePool::CachedBlocks();
+    JsonNodePool::Free(0);
+    TS_ASSERT_EQUALS(cached, JsonNodePool::CachedBlocks());
+}
+
+/* Test54
+ * Method : DeepClone()
+ * This test is to check handles into nested objects keep aliasing their
+ * document after a copy-on-write clone, whichever handle writes first, and
+ * that the copy keeps the source text of numbers
+ * This is positive test
+ */
+
+void JSonSerializerTest::testDeepCloneCopyOnWriteHandles() {
+    JsonSerializer root, child, early, clone;
+    TS_ASSERT(root.Parse("{\"a\":{},\"b\":{\"c\":[1]}}"));
+    TS_ASSERT(root.GetObject("b", early));
+
+    clone = root.DeepClone(true);
+    TS_ASSERT(root.GetObject("a", child));
+    TS_ASSERT(child.PutValue("x", 1));
+    clone.Clear();
+    TS_ASSERT_EQUALS("{\"a\":{\"x\":1},\"b\":{\"c\":[1]}}", Dumped(root));
+
+    /* a handle taken before the clone follows the document as well. */
+    clone = root.DeepClone(true);
+    TS_ASSERT(root.PutValue("y", 2));
+    TS_ASSERT(early.PutValue("d", 3));
+    TS_ASSERT(child.PutValue("z", 4));
+    TS_ASSERT_EQUALS(
+        "{\"a\":{\"x\":1,\"z\":4},\"b\":{\"c\":[1],\"d\":3},\"y\":2}",
+        Dumped(root));
+    TS_ASSERT_EQUALS("{\"a\":{\"x\":1},\"b\":{\"c\":[1]}}", Dumped(clone));
+
+    /* the same holds on the clone's side. */
+    JsonSerializer cloneChild, again;
+    TS_ASSERT(clone.GetObject("b", cloneChild));
+    again = clone.DeepClone(true);
+    TS_ASSERT(cloneChild.PutValue("e", 5));
+    TS_ASSERT(clone.GetObject("b", child));
+    int got_val = 0;
+    TS_ASSERT(child.GetValue("e", got_val));
+    TS_ASSERT_EQUALS(5, got_val);
+    TS_ASSERT_EQUALS("{\"a\":{\"x\":1},\"b\":{\"c\":[1]}}", Dumped(again));
+
+    /* PutValue stays const; a write through a const handle still copies
+     * the shared tree first. */
+    const JsonSerializer& view = again;
+    clone = again.DeepClone(true);
+    TS_ASSERT(view.PutValue("f", 6));
+    TS_ASSERT(again.GetValue("f", got_val));
+    TS_ASSERT_EQUALS(6, got_val);
+    TS_ASSERT(!clone.GetValue("f", got_val));
+
+    /* numbers keep their source text in the copy made on write. */
+    JsonSerializer numbers;
+    TS_ASSERT(numbers.Parse("{\"n\":1.50,\"m\":{\"k\":[2.0]}}",
+                            JsonSerializer::kLosslessNumbers));
+    clone = numbers.DeepClone(true);
+    TS_ASSERT(numbers.PutValue("o", 1));
+    TS_ASSERT(clone.PutValue("p", 2));
+    TS_ASSERT_EQUALS("{\"n\":1.50,\"m\":{\"k\":[2.0]},\"o\":1}",
+                     Dumped(numbers));
+    TS_ASSERT_EQUALS("{\"n\":1.50,\"m\":{\"k\":[2.0]},\"p\":2}",
+                     Dumped(clone));
+}
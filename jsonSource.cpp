@@ -0,0 +1,355 @@
+/*!
+ * @file jsonSource.cpp
+ * @brief Parse modes of JsonSerializer that keep what json_loads drops.
+ * Details. SourceParser builds the jansson tree itself: JsonLexer finds the
+ * tokens and jansson only decodes the strings that hold escapes. It accepts
+ * and rejects what json_loads accepts and rejects with the same flags, apart
+ * from integers out of range when numbers are kept lossless. Next to the
+ * tree it records the source text of the containers and of the numbers that
+ * do not dump as they were written. That record seeds the JsonNodeCache of
+ * the document, so the document dumps as it was read.
+ * $Id$
+ * */
+
+#include "public/JSonSerializer.h"
+#include "jsonLexer.h"
+#include "jsonNodeCache.h"
+
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+
+/* Same nesting limit json_loads applies. */
+#define SOURCE_PARSE_MAX_DEPTH 2048
+
+namespace {
+
+inline bool IsContainer(const json_t* json) {
+    return json_is_object(json) || json_is_array(json);
+}
+
+/* jansson reads a number without fraction and exponent as an integer. */
+bool IsIntegerText(const char* text, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (text[i] == '.' || text[i] == 'e' || text[i] == 'E') return false;
+    }
+    return true;
+}
+
+/* Real as jansson reads it: strtod with the decimal point of the current
+ * locale. Overflow is an error, underflow is not. */
+bool ReadReal(const char* text, size_t len, double& value) {
+    if (ParseJsonNumber(text, len, value)) return true;
+
+    std::string copy(text, len);
+    const char* point = localeconv()->decimal_point;
+    size_t dot = copy.find('.');
+    if (dot != std::string::npos && strcmp(point, ".") != 0) {
+        copy.replace(dot, 1, point);
+    }
+    errno = 0;
+    value = strtod(copy.c_str(), 0);
+    return !(errno == ERANGE && (value == HUGE_VAL || value == -HUGE_VAL));
+}
+
+template <typename Pair>
+struct FirstIn {
+    explicit FirstIn(const std::unordered_set<const json_t*>& nodes)
+        : set(nodes) {}
+    bool operator()(const Pair& pair) const {
+        return set.count(pair.first) != 0;
+    }
+    const std::unordered_set<const json_t*>& set;
+};
+
+template <typename Pair>
+void EraseNodes(std::vector<Pair>& pairs,
+                const std::unordered_set<const json_t*>& nodes) {
+    pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+                               FirstIn<Pair>(nodes)),
+                pairs.end());
+}
+
+class SourceParser : private JsonLexer {
+   public:
+    SourceParser(const char* data, size_t len, int options)
+        : JsonLexer(data, len),
+          m_Options(options),
+          m_KeepContainers((options & JsonSerializer::kPreserveOrder) != 0) {}
+
+    /* values replaced by a later duplicate key are kept alive until the
+     * parse is over, so that no node of the tree can reuse their address. */
+    ~SourceParser() {
+        for (size_t i = 0; i < m_Replaced.size(); ++i) {
+            json_decref(m_Replaced[i]);
+        }
+    }
+
+    /* Parses the whole input. Returns null on any error. */
+    json_t* ParseRoot(JsonNodeCache::Source& source) {
+        SkipSpace();
+        bool container =
+            m_Pos < m_Len && (m_Data[m_Pos] == '{' || m_Data[m_Pos] == '[');
+        if (!container && !(m_Options & JsonSerializer::kDecodeAny)) return 0;
+
+        json_t* json;
+        bool verbatim;
+        if (!Value(0, json, verbatim)) return 0;
+        SkipSpace();
+        if (m_Pos != m_Len) {
+            json_decref(json);
+            return 0;
+        }
+
+        if (!m_Replaced.empty()) Forget();
+        std::swap(source, m_Source);
+        return json;
+    }
+
+   private:
+    /* A child whose source text is cached apart from its parent's. */
+    struct Splice {
+        size_t begin;
+        size_t end;
+        const json_t* json;
+    };
+
+    /*
+     * Parses one value. verbatim is cleared if the source text of a
+     * container in it must not be kept, i.e. if it holds a duplicate key.
+     * */
+    bool Value(int depth, json_t*& json, bool& verbatim) {
+        json = 0;
+        verbatim = true;
+        SkipSpace();
+        if (m_Pos == m_Len) return false;
+        char c = m_Data[m_Pos];
+
+        if (c == '{' || c == '[') {
+            if (++depth > SOURCE_PARSE_MAX_DEPTH) return false;
+            return Container(depth, json, verbatim);
+        } else if (c == '"') {
+            return String(json);
+        } else if (c == 't') {
+            if (!SkipLiteral("true")) return false;
+            json = json_true();
+        } else if (c == 'f') {
+            if (!SkipLiteral("false")) return false;
+            json = json_false();
+        } else if (c == 'n') {
+            if (!SkipLiteral("null")) return false;
+            json = json_null();
+        } else {
+            return Number(json);
+        }
+        return true;
+    }
+
+    bool Container(int depth, json_t*& json, bool& verbatim) {
+        bool isObject = m_Data[m_Pos] == '{';
+        char close = isObject ? '}' : ']';
+        size_t begin = m_Pos++;
+        json = isObject ? json_object() : json_array();
+        if (json == 0) return false;
+
+        std::vector<Splice> splices;
+        std::string key;
+        bool closed = false;
+        SkipSpace();
+        if (m_Pos < m_Len && m_Data[m_Pos] == close) {
+            ++m_Pos;
+            closed = true;
+        }
+        while (!closed) {
+            if (isObject && (!ReadKey(key) || !Expect(':'))) break;
+
+            SkipSpace();
+            size_t childBegin = m_Pos;
+            json_t* child;
+            bool childVerbatim;
+            if (!Value(depth, child, childVerbatim)) break;
+            if (!childVerbatim) verbatim = false;
+            if (m_KeepContainers && IsContainer(child)) {
+                m_Source.links.push_back(std::make_pair(child, json));
+                if (m_Pos - childBegin >= DUMP_CACHE_MIN_SIZE) {
+                    Splice splice = {childBegin, m_Pos, child};
+                    splices.push_back(splice);
+                }
+            }
+
+            bool added = isObject ? Insert(json, key, child, verbatim)
+                                  : json_array_append_new(json, child) == 0;
+            if (!added) break;
+
+            SkipSpace();
+            if (m_Pos == m_Len) break;
+            char c = m_Data[m_Pos++];
+            if (c == close) {
+                closed = true;
+            } else if (c != ',') {
+                break;
+            }
+        }
+        if (!closed) {
+            json_decref(json);
+            json = 0;
+            return false;
+        }
+
+        /* like EncodeChild, only large containers are cached apart. */
+        if (m_KeepContainers && verbatim &&
+            (depth == 1 || m_Pos - begin >= DUMP_CACHE_MIN_SIZE)) {
+            Record(json, begin, splices);
+        }
+        return true;
+    }
+
+    void Record(const json_t* json, size_t begin,
+                const std::vector<Splice>& splices) {
+        m_Source.dumps.push_back(
+            std::make_pair(json, JsonNodeCache::DumpEntry()));
+        JsonNodeCache::DumpEntry& entry = m_Source.dumps.back().second;
+        size_t done = begin;
+        for (size_t i = 0; i < splices.size(); ++i) {
+            entry.text.append(m_Data + done, splices[i].begin - done);
+            entry.splices.push_back(
+                std::make_pair(entry.text.size(), splices[i].json));
+            done = splices[i].end;
+        }
+        entry.text.append(m_Data + done, m_Pos - done);
+    }
+
+    bool Insert(json_t* object, const std::string& key, json_t* value,
+                bool& verbatim) {
+        json_t* old = json_object_get(object, key.c_str());
+        if (old) {
+            if (m_Options & JsonSerializer::kRejectDuplicates) {
+                json_decref(value);
+                return false;
+            }
+            /* the object now dumps differently from its source. */
+            m_Replaced.push_back(json_incref(old));
+            verbatim = false;
+        }
+        return json_object_set_new(object, key.c_str(), value) == 0;
+    }
+
+    bool String(json_t*& json) {
+        size_t begin = m_Pos;
+        bool escaped;
+        if (!SkipString(escaped)) return false;
+        if (escaped) {
+            json = json_loadb(m_Data + begin, m_Pos - begin, JSON_DECODE_ANY,
+                              NULL);
+        } else {
+            json = json_stringn(m_Data + begin + 1, m_Pos - begin - 2);
+        }
+        return json != 0;
+    }
+
+    bool Number(json_t*& json) {
+        size_t begin = m_Pos;
+        if (!SkipNumber()) return false;
+        const char* text = m_Data + begin;
+        size_t len = m_Pos - begin;
+
+        char buffer[JSON_NUMBER_BUFFER_SIZE];
+        size_t length = 0;
+        long long integer;
+        double real;
+        if (!IsIntegerText(text, len)) {
+            if (!ReadReal(text, len, real)) return false;
+            json = json_real(real);
+            length = FormatJsonReal(real, false, buffer);
+        } else if (ParseJsonNumber(text, len, integer)) {
+            json = json_integer(integer);
+            length = FormatJsonInteger(integer, buffer);
+        } else if (m_Options & JsonSerializer::kLosslessNumbers) {
+            /* out of range of json_int_t; kept as the nearest real, so the
+             * node is a real and only its text is the integer, see
+             * kLosslessNumbers. */
+            if (!ReadReal(text, len, real)) return false;
+            json = json_real(real);
+        } else {
+            return false;
+        }
+        if (json == 0) return false;
+
+        if (length != len || memcmp(text, buffer, len) != 0) {
+            m_Source.numbers.push_back(
+                std::make_pair(json, std::string(text, len)));
+        }
+        return true;
+    }
+
+    /* Drops what was recorded for the values duplicate keys replaced. */
+    void Forget() {
+        std::unordered_set<const json_t*> nodes;
+        std::vector<json_t*> pending(m_Replaced);
+        while (!pending.empty()) {
+            json_t* node = pending.back();
+            pending.pop_back();
+            nodes.insert(node);
+            if (json_is_array(node)) {
+                for (size_t i = 0; i < json_array_size(node); ++i) {
+                    pending.push_back(json_array_get(node, i));
+                }
+            } else if (json_is_object(node)) {
+                for (void* iter = json_object_iter(node); iter;
+                     iter = json_object_iter_next(node, iter)) {
+                    pending.push_back(json_object_iter_value(iter));
+                }
+            }
+        }
+        EraseNodes(m_Source.links, nodes);
+        EraseNodes(m_Source.dumps, nodes);
+        EraseNodes(m_Source.numbers, nodes);
+    }
+
+    /* members */
+    int m_Options;
+    bool m_KeepContainers;
+    JsonNodeCache::Source m_Source;
+    std::vector<json_t*> m_Replaced;
+};
+
+}  // namespace
+
+/*!
+ * function Parse. Parse with options. kRejectDuplicates and kDecodeAny
+ * alone are handed to jansson as its own flags. kPreserveOrder and
+ * kLosslessNumbers keep the source text of the document: until it is
+ * modified it dumps byte for byte as the input, without the whitespace
+ * around the root, and a modification only re-encodes the containers on the
+ * path to the modified value. Source text is lost where a tree is copied,
+ * i.e. by DeepClone without copy-on-write and by the first write to either
+ * side of a copy-on-write clone, and a dump with shortest reals drops the
+ * source text of the containers.
+ * @param const reference to a string which contains the json formatted data
+ * stream.
+ * @param int options. ParseOptions combined with |.
+ * @return bool. True if the data is in correct format and we could create a
+ * json object from it.False otherwise
+ * */
+bool JsonSerializer::Parse(const std::string& instr, int options) {
+    Clear();
+    /* the end of instr is found the way json_loads finds it. */
+    const char* data = instr.c_str();
+    size_t len = strlen(data);
+    if (!(options & (kPreserveOrder | kLosslessNumbers))) {
+        size_t flags = 0;
+        if (options & kRejectDuplicates) flags |= JSON_REJECT_DUPLICATES;
+        if (options & kDecodeAny) flags |= JSON_DECODE_ANY;
+        return Attach(json_loadb(data, len, flags, NULL));
+    }
+
+    JsonNodeCache::Source source;
+    SourceParser parser(data, len, options);
+    if (!Attach(parser.ParseRoot(source))) return false;
+    m_Cache->Seed(source);
+    return true;
+}
@@ -0,0 +1,164 @@
+/*!
+ * @file jsonThreadPool.cpp
+ * @brief Work stealing thread pool owned by the JsonSerializer library.
+ * Details. See jsonThreadPool.h. Idle workers sleep on one condition
+ * variable and are woken for every task submitted.
+ * $Id$
+ * */
+
+#include "jsonThreadPool.h"
+
+namespace {
+
+/* Pool and queue of the worker running on this thread, if any. */
+thread_local JsonThreadPool* t_Pool = 0;
+thread_local unsigned int t_Index = 0;
+
+}  // namespace
+
+/*!
+ * Constructor. Starts the workers.
+ * @param unsigned int threads. Number of workers, 0 for one per core.
+ * */
+JsonThreadPool::JsonThreadPool(unsigned int threads)
+    : m_Pending(0), m_Next(0), m_Stop(false) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_Queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_Threads.push_back(std::thread(&JsonThreadPool::Work, this, i));
+    }
+}
+
+/*!
+ * Destructor. Runs the tasks still queued, then stops the workers.
+ * */
+JsonThreadPool::~JsonThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Wake.notify_all();
+    for (size_t i = 0; i < m_Threads.size(); ++i) m_Threads[i].join();
+}
+
+/*!
+ * Instance function. The pool the library runs its own background work on,
+ * with one worker per core. It is created on first use.
+ * @return reference to the pool.
+ * */
+JsonThreadPool& JsonThreadPool::Instance() {
+    static JsonThreadPool pool;
+    return pool;
+}
+
+/*!
+ * Size function.
+ * @return unsigned int. Number of workers.
+ * */
+unsigned int JsonThreadPool::Size() const { return m_Threads.size(); }
+
+/*!
+ * Submit function. Queues a task to run on one of the workers.
+ * @param const reference to the task.
+ * */
+void JsonThreadPool::Submit(const Task& task) {
+    unsigned int index =
+        t_Pool == this ? t_Index : m_Next.fetch_add(1) % m_Queues.size();
+
+    /* counted before it is queued, so that the count never drops below the
+     * number of queued tasks. */
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        ++m_Pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+        m_Queues[index]->tasks.push_back(task);
+    }
+    m_Wake.notify_one();
+}
+
+/*!
+ * Parallel function. Runs caller on the calling thread while up to helpers
+ * workers run helper alongside it, and returns once caller and every helper
+ * that started have returned. A helper that has not started by the time
+ * caller returns is skipped, so the work must be shared out such that caller
+ * alone can finish it. This makes Parallel safe to call from a worker of
+ * this pool even when every other worker is busy.
+ * @param unsigned int helpers. Most workers to use.
+ * @param const reference to the work of the helpers.
+ * @param const reference to the work of the calling thread.
+ * */
+void JsonThreadPool::Parallel(unsigned int helpers, const Task& helper,
+                              const Task& caller) {
+    struct State {
+        State() : closed(false), active(0) {}
+
+        std::mutex mutex;
+        std::condition_variable idle;
+        bool closed;
+        unsigned int active;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+
+    if (helpers > Size()) helpers = Size();
+    for (unsigned int i = 0; i < helpers; ++i) {
+        Submit([state, helper]() {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->closed) return;
+                ++state->active;
+            }
+            helper();
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (--state->active == 0) state->idle.notify_all();
+        });
+    }
+
+    caller();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    while (state->active != 0) state->idle.wait(lock);
+}
+
+void JsonThreadPool::Work(unsigned int index) {
+    t_Pool = this;
+    t_Index = index;
+
+    for (;;) {
+        Task task;
+        if (Take(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        while (!m_Stop && m_Pending == 0) m_Wake.wait(lock);
+        if (m_Stop && m_Pending == 0) return;
+    }
+}
+
+/* Newest task of the own queue, else the oldest one of another queue. */
+bool JsonThreadPool::Take(unsigned int index, Task& task) {
+    for (size_t i = 0; i < m_Queues.size(); ++i) {
+        Queue& queue = *m_Queues[(index + i) % m_Queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+
+        if (i == 0) {
+            task.swap(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task.swap(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        --m_Pending;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+/*!
+ * @file jsonThreadPool.h
+ * @brief Work stealing thread pool owned by the JsonSerializer library.
+ * Details. Every worker has its own task queue. Tasks submitted from a
+ * worker go to the back of its own queue and are taken from there, newest
+ * first; a worker whose queue is empty steals the oldest task of another.
+ * Tasks submitted from other threads are spread over the queues in turn.
+ * $Id$
+ * */
+
+#ifndef JSONTHREADPOOL_H
+#define JSONTHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JsonThreadPool {
+   public:
+    typedef std::function<void()> Task;
+
+    explicit JsonThreadPool(unsigned int threads = 0);
+    ~JsonThreadPool();
+
+    static JsonThreadPool& Instance();
+
+    unsigned int Size() const;
+    void Submit(const Task& task);
+    void Parallel(unsigned int helpers, const Task& helper,
+                  const Task& caller);
+
+   private:
+    JsonThreadPool(const JsonThreadPool&);
+    JsonThreadPool& operator=(const JsonThreadPool&);
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Work(unsigned int index);
+    bool Take(unsigned int index, Task& task);
+
+    /* members */
+    std::vector<std::unique_ptr<Queue> > m_Queues;
+    std::vector<std::thread> m_Threads;
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;
+    std::atomic<size_t> m_Pending;
+    std::atomic<unsigned int> m_Next;
+    bool m_Stop;
+};
+
+#endif  // JSONTHREADPOOL_H